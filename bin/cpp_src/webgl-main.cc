@@ -27,6 +27,11 @@
 #if !defined(REPEAT_LAST_FRAME)
 #define REPEAT_LAST_FRAME 0
 #endif
+// Runs the step list this many times, timing each step, instead of
+// displaying it once. Rendering is then done offscreen.
+#if !defined(BENCHMARK_ITERATIONS)
+#define BENCHMARK_ITERATIONS 0
+#endif
 
 
 #if defined(WIN32)
@@ -71,6 +76,43 @@ bool extensions_initialized = false;
 PFNGLDRAWARRAYSINSTANCEDWGLPROC glDrawArraysInstancedWGL = 0;
 PFNGLDRAWELEMENTSINSTANCEDWGLPROC glDrawElementsInstancedWGL = 0;
 PFNGLVERTEXATTRIBDIVISORWGLPROC glVertexAttribDivisorWGL = 0;
+PFNGLGENQUERIESWGLPROC glGenQueriesWGL = 0;
+PFNGLDELETEQUERIESWGLPROC glDeleteQueriesWGL = 0;
+PFNGLBEGINQUERYWGLPROC glBeginQueryWGL = 0;
+PFNGLENDQUERYWGLPROC glEndQueryWGL = 0;
+PFNGLGETQUERYOBJECTUI64VWGLPROC glGetQueryObjectui64vWGL = 0;
+bool timer_queries_disjoint = false;
+PFNGLMAPBUFFERRANGEWGLPROC glMapBufferRangeWGL = 0;
+PFNGLUNMAPBUFFERWGLPROC glUnmapBufferWGL = 0;
+
+void* GetGLProcAddress(const char* name) {
+#if USE_ANGLE
+  return (void*)eglGetProcAddress(name);
+#else
+  return SDL_GL_GetProcAddress(name);
+#endif  // USE_ANGLE
+}
+
+// Loads the timer query functions, whose names end in suffix.
+void InitializeTimerQueries(const char* suffix) {
+  char name[64];
+  sprintf(name, "glGenQueries%s", suffix);
+  glGenQueriesWGL = (PFNGLGENQUERIESWGLPROC)GetGLProcAddress(name);
+  sprintf(name, "glDeleteQueries%s", suffix);
+  glDeleteQueriesWGL = (PFNGLDELETEQUERIESWGLPROC)GetGLProcAddress(name);
+  sprintf(name, "glBeginQuery%s", suffix);
+  glBeginQueryWGL = (PFNGLBEGINQUERYWGLPROC)GetGLProcAddress(name);
+  sprintf(name, "glEndQuery%s", suffix);
+  glEndQueryWGL = (PFNGLENDQUERYWGLPROC)GetGLProcAddress(name);
+  sprintf(name, "glGetQueryObjectui64v%s", suffix);
+  glGetQueryObjectui64vWGL =
+      (PFNGLGETQUERYOBJECTUI64VWGLPROC)GetGLProcAddress(name);
+  if (!glGenQueriesWGL || !glDeleteQueriesWGL || !glBeginQueryWGL ||
+      !glEndQueryWGL || !glGetQueryObjectui64vWGL) {
+    printf("Timer query functions not available!\n");
+    glGenQueriesWGL = 0;
+  }
+}
 
 void InitializeExtensions() {
   if (extensions_initialized) {
@@ -115,13 +157,63 @@ void InitializeExtensions() {
       (PFNGLVERTEXATTRIBDIVISORWGLPROC)SDL_GL_GetProcAddress(
           "glVertexAttribDivisorARB");
 #endif  // USE_ANGLE
+
+  // Timer queries are optional: benchmarks go without GPU times if missing.
+#if USE_ANGLE
+  bool has_disjoint_timer_query =
+      strstr((const char*)glGetString(GL_EXTENSIONS),
+             "GL_EXT_disjoint_timer_query") != NULL;
+  bool has_timer_query = false;
+#else
+  bool has_disjoint_timer_query =
+      SDL_GL_ExtensionSupported("GL_EXT_disjoint_timer_query");
+  bool has_timer_query = SDL_GL_ExtensionSupported("GL_ARB_timer_query");
+#endif  // USE_ANGLE
+  if (has_disjoint_timer_query) {
+    InitializeTimerQueries("EXT");
+    timer_queries_disjoint = true;
+  } else if (has_timer_query) {
+    // Core functions, same enums.
+    InitializeTimerQueries("");
+  }
+
+  // Pixel buffer objects are optional: without them texture data is read
+  // straight from the bin file.
+  const char* version = (const char*)glGetString(GL_VERSION);
+  bool has_pixel_buffer_objects =
+      atoi(version) >= 3 || strncmp(version, "OpenGL ES 3", 11) == 0;
+#if !USE_ANGLE
+  has_pixel_buffer_objects |=
+      SDL_GL_ExtensionSupported("GL_ARB_pixel_buffer_object") &&
+      SDL_GL_ExtensionSupported("GL_ARB_map_buffer_range");
+#endif  // !USE_ANGLE
+  if (has_pixel_buffer_objects) {
+    glMapBufferRangeWGL =
+        (PFNGLMAPBUFFERRANGEWGLPROC)GetGLProcAddress("glMapBufferRange");
+    glUnmapBufferWGL =
+        (PFNGLUNMAPBUFFERWGLPROC)GetGLProcAddress("glUnmapBuffer");
+    if (!glMapBufferRangeWGL || !glUnmapBufferWGL) {
+      glMapBufferRangeWGL = 0;
+    }
+  }
+}
+
+#if USE_ANGLE && BENCHMARK_ITERATIONS
+EGLSurface CreatePbufferSurface(ESContext* es, int width, int height) {
+  EGLint pbufferAttribList[] = {
+    EGL_WIDTH,  width,
+    EGL_HEIGHT, height,
+    EGL_NONE,   EGL_NONE,
+  };
+  return eglCreatePbufferSurface(es->display, es->config, pbufferAttribList);
 }
+#endif  // USE_ANGLE && BENCHMARK_ITERATIONS
 
 #include <SDL_syswm.h>
 CanvasContext::CanvasContext(
     const char* window_title, int handle) :
     window_title_(window_title), handle_(handle),
-  window_(0) {
+  window_(0), timer_count_(0) {
 
 #if USE_ANGLE
 #else
@@ -138,12 +230,19 @@ CanvasContext::CanvasContext(
 
   char title[2048];
   sprintf(title, "%s : %d", window_title_, handle_);
+#if BENCHMARK_ITERATIONS
+  // ANGLE renders to a pbuffer instead, but SDL has no offscreen contexts:
+  // there the window is hidden, which keeps compositing out of the timings.
+  Uint32 window_flags = SDL_WINDOW_HIDDEN | SDL_WINDOW_OPENGL;
+#else
+  Uint32 window_flags = SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL;
+#endif  // BENCHMARK_ITERATIONS
   window_ = SDL_CreateWindow(
       title,
       SDL_WINDOWPOS_CENTERED,
       SDL_WINDOWPOS_CENTERED,
       800, 480,
-      SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL);
+      window_flags);
   SDL_GetWindowSize(window_, &width_, &height_);
   CHECK_SDL();
 
@@ -163,6 +262,9 @@ CanvasContext::CanvasContext(
     EGL_DEPTH_SIZE,     EGL_DONT_CARE,
     EGL_STENCIL_SIZE,   EGL_DONT_CARE,
     EGL_SAMPLE_BUFFERS, 0,
+#if BENCHMARK_ITERATIONS
+    EGL_SURFACE_TYPE,   EGL_PBUFFER_BIT,
+#endif  // BENCHMARK_ITERATIONS
     EGL_NONE,
   };
   EGLint surfaceAttribList[] = {
@@ -189,19 +291,23 @@ CanvasContext::CanvasContext(
     printf("eglGetConfigs failed\n");
     exit(1);
   }
-  EGLConfig config;
-  if (!eglChooseConfig(es_.display, configAttribList, &config, 1, &num_configs)) {
+  if (!eglChooseConfig(es_.display, configAttribList, &es_.config, 1,
+                       &num_configs)) {
     printf("eglChooseConfigsfailed\n");
     exit(1);
   }
+#if BENCHMARK_ITERATIONS
+  es_.surface = CreatePbufferSurface(&es_, width_, height_);
+#else
   es_.surface = eglCreateWindowSurface(
-      es_.display, config, hWnd, surfaceAttribList);
+      es_.display, es_.config, hWnd, surfaceAttribList);
+#endif  // BENCHMARK_ITERATIONS
   if (!es_.surface) {
     printf("eglCreateWindowSurface failed\n");
     exit(1);
   }
   es_.context = eglCreateContext(
-      es_.display, config, EGL_NO_CONTEXT, contextAttribs);
+      es_.display, es_.config, EGL_NO_CONTEXT, contextAttribs);
   if (!es_.context) {
     printf("eglCreateContext failed\n");
     exit(1);
@@ -226,6 +332,11 @@ CanvasContext::CanvasContext(
 }
 
 CanvasContext::~CanvasContext() {
+  if (!timer_queries_.empty()) {
+    MakeCurrent();
+    glDeleteQueriesWGL(timer_queries_.size(), &timer_queries_[0]);
+  }
+
   // nvogl crashes when deleting the context - not sure why...
 #if 0
 #if USE_ANGLE
@@ -256,6 +367,14 @@ void CanvasContext::MakeCurrent(int width, int height) {
       height_ = height;
       SDL_SetWindowSize(window_, width_, height_);
       CHECK_SDL();
+#if USE_ANGLE && BENCHMARK_ITERATIONS
+      // Pbuffers can't be resized, so replace it.
+      eglMakeCurrent(es_.display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                     EGL_NO_CONTEXT);
+      eglDestroySurface(es_.display, es_.surface);
+      es_.surface = CreatePbufferSurface(&es_, width_, height_);
+      eglMakeCurrent(es_.display, es_.surface, es_.surface, es_.context);
+#endif  // USE_ANGLE && BENCHMARK_ITERATIONS
       glViewport(0, 0, width_, height_);
       CHECK_GL();
     }
@@ -285,12 +404,103 @@ void CanvasContext::SetObject(int handle, GLuint id) {
   object_map_[handle] = id;
 }
 
+void CanvasContext::DeleteObjects() {
+  MakeCurrent();
+  glUseProgram(0);
+  // The kind of each object isn't recorded. But every object in the context
+  // was created by the replay, and names are unique per kind, so deleting
+  // each name as every kind deletes exactly those objects. Deleting unused
+  // names is ignored, except for programs and shaders, which share names.
+  for (unordered_map<int, GLuint>::iterator it = object_map_.begin();
+       it != object_map_.end(); ++it) {
+    GLuint id = it->second;
+    if (!id) {
+      continue;
+    }
+    glDeleteTextures(1, &id);
+    glDeleteBuffers(1, &id);
+    glDeleteFramebuffers(1, &id);
+    glDeleteRenderbuffers(1, &id);
+    if (glIsProgram(id)) {
+      glDeleteProgram(id);
+    } else if (glIsShader(id)) {
+      glDeleteShader(id);
+    }
+  }
+  object_map_.clear();
+  CHECK_GL();
+}
+
+void CanvasContext::BeginTimer(int step_index) {
+  if (!glGenQueriesWGL) {
+    return;
+  }
+  MakeCurrent();
+  if (timer_count_ == timer_queries_.size()) {
+    GLuint query;
+    glGenQueriesWGL(1, &query);
+    timer_queries_.push_back(query);
+    timer_step_indices_.push_back(0);
+  }
+  timer_step_indices_[timer_count_] = step_index;
+  glBeginQueryWGL(GL_TIME_ELAPSED_EXT, timer_queries_[timer_count_]);
+}
+
+void CanvasContext::EndTimer() {
+  if (!glGenQueriesWGL) {
+    return;
+  }
+  MakeCurrent();
+  glEndQueryWGL(GL_TIME_ELAPSED_EXT);
+  timer_count_++;
+}
+
+bool CanvasContext::CollectTimers(vector<double>* step_times) {
+  if (!glGenQueriesWGL) {
+    return false;
+  }
+  MakeCurrent();
+  for (size_t n = 0; n < timer_count_; n++) {
+    uint64_t elapsed_ns = 0;
+    glGetQueryObjectui64vWGL(
+        timer_queries_[n], GL_QUERY_RESULT_EXT, &elapsed_ns);
+    (*step_times)[timer_step_indices_[n]] += elapsed_ns / 1000000.0;
+  }
+  timer_count_ = 0;
+
+  // Disjoint operations (e.g. a clock change) make all of the results
+  // unreliable. Checking also resets the flag.
+  GLint disjoint = 0;
+  if (timer_queries_disjoint) {
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+  }
+  return !disjoint;
+}
+
 
 Replay::Replay(const char* trace_name, const char* bin_name,
-               const StepFunction* steps, int step_count) :
+               const StepFunction* steps, int step_count,
+               const size_t* step_bin_offsets) :
     trace_name_(trace_name), bin_name_(bin_name),
-    bin_data_(0), bin_data_length_(0),
-    steps_(steps), step_count_(step_count), step_index_(0) {
+    steps_(steps), step_count_(step_count), step_index_(0),
+    step_bin_offsets_(step_bin_offsets), prefetched_step_index_(0),
+    bin_data_(0), bin_data_length_(0), current_context_(0),
+    staged_step_index_(0), active_slot_(0), upload_bound_(false),
+    staging_exiting_(false) {
+  for (int n = 0; n < kStagingStepCount; n++) {
+    StagingSlot& slot = staging_slots_[n];
+    slot.state = StagingSlot::kFree;
+    slot.step_index = -1;
+    slot.context = 0;
+    slot.buffer = 0;
+    slot.offset = 0;
+    slot.length = 0;
+    slot.mapping = 0;
+  }
+#if defined(WIN32)
+  bin_file_ = INVALID_HANDLE_VALUE;
+  bin_mapping_ = NULL;
+#endif  // WIN32
   SDL_Init(SDL_INIT_VIDEO);
 
   SDL_DisplayMode mode;
@@ -299,12 +509,43 @@ Replay::Replay(const char* trace_name, const char* bin_name,
 }
 
 Replay::~Replay() {
+  // The staging thread reads the bin data.
+  if (staging_thread_.joinable()) {
+    {
+      lock_guard<mutex> lock(staging_mutex_);
+      staging_exiting_ = true;
+    }
+    staging_cond_.notify_all();
+    staging_thread_.join();
+  }
+  for (int n = 0; n < kStagingStepCount; n++) {
+    StagingSlot& slot = staging_slots_[n];
+    if (slot.buffer) {
+      slot.context->MakeCurrent();
+      glDeleteBuffers(1, &slot.buffer);
+    }
+  }
+
   for (vector<CanvasContext*>::iterator it = contexts_.begin();
        it != contexts_.end(); ++it) {
     delete *it;
   }
 
-  free(bin_data_);
+#if defined(WIN32)
+  if (bin_data_) {
+    UnmapViewOfFile(bin_data_);
+  }
+  if (bin_mapping_) {
+    CloseHandle(bin_mapping_);
+  }
+  if (bin_file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(bin_file_);
+  }
+#else
+  if (bin_data_) {
+    munmap((void*)bin_data_, bin_data_length_);
+  }
+#endif  // WIN32
 
   SDL_Quit();
 }
@@ -332,37 +573,254 @@ bool Replay::LoadResources() {
   char* last_slash = strrchr(file_path, path_sep);
   last_slash++;
   *last_slash = 0;
+  base_path_ = file_path;
 
   // Required to find D3D compiler on Windows.
 #if USE_ANGLE
   SetDllDirectoryA(file_path);
 #endif  // USE_ANGLE
 
-  // Open the .bin file.
+  // Map the .bin file. Steps mostly read it front to back, once.
   strcat(file_path, bin_name_);
-  FILE* file = fopen(file_path, "r");
-  if (!file) {
+#if defined(WIN32)
+  bin_file_ = CreateFileA(
+      file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (bin_file_ == INVALID_HANDLE_VALUE) {
     printf("Unable to open bin file %s\n", bin_name_);
     return false;
   }
-
-  fseek(file, 0, SEEK_END);
-  bin_data_length_ = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  bin_data_ = (uint8_t*)malloc(bin_data_length_);
+  LARGE_INTEGER file_size;
+  GetFileSizeEx(bin_file_, &file_size);
+  bin_data_length_ = (size_t)file_size.QuadPart;
+  if (!bin_data_length_) {
+    // Nothing to map.
+    return true;
+  }
+  bin_mapping_ = CreateFileMappingA(
+      bin_file_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (bin_mapping_) {
+    bin_data_ = (const uint8_t*)MapViewOfFile(
+        bin_mapping_, FILE_MAP_READ, 0, 0, 0);
+  }
+#else
+  int fd = open(file_path, O_RDONLY);
+  if (fd == -1) {
+    printf("Unable to open bin file %s\n", bin_name_);
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) == -1) {
+    close(fd);
+    printf("Unable to stat bin file %s\n", bin_name_);
+    return false;
+  }
+  bin_data_length_ = file_stat.st_size;
+  if (!bin_data_length_) {
+    // Nothing to map.
+    close(fd);
+    return true;
+  }
+  void* mapping = mmap(NULL, bin_data_length_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file referenced.
+  close(fd);
+  if (mapping != MAP_FAILED) {
+    bin_data_ = (const uint8_t*)mapping;
+    madvise(mapping, bin_data_length_, MADV_SEQUENTIAL);
+  }
+#endif  // WIN32
   if (!bin_data_) {
-    printf("Unable to allocate bin memory\n");
+    printf("Unable to map bin file %s\n", bin_name_);
     return false;
   }
 
-  fread(bin_data_, 1, bin_data_length_, file);
-
-  fclose(file);
+  PrefetchSteps(0);
 
+  staging_thread_ = thread(&Replay::StagingThreadMain, this);
   return true;
 }
 
+void Replay::PrefetchSteps(int step_index) {
+  int end_step_index = step_index + kPrefetchStepCount;
+  if (end_step_index > step_count_) {
+    end_step_index = step_count_;
+  }
+  if (!bin_data_ || prefetched_step_index_ >= end_step_index) {
+    return;
+  }
+  size_t start = step_bin_offsets_[prefetched_step_index_];
+  size_t end = step_bin_offsets_[end_step_index];
+  prefetched_step_index_ = end_step_index;
+  if (end > bin_data_length_) {
+    end = bin_data_length_;
+  }
+  if (start >= end) {
+    return;
+  }
+
+#if defined(WIN32)
+#if _WIN32_WINNT >= 0x0602
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = (PVOID)(bin_data_ + start);
+  range.NumberOfBytes = end - start;
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif  // _WIN32_WINNT >= 0x0602
+#else
+  // madvise wants a page aligned start.
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t aligned_start = start / page_size * page_size;
+  madvise((void*)(bin_data_ + aligned_start), end - aligned_start,
+          MADV_WILLNEED);
+#endif  // WIN32
+}
+
+void Replay::StageSteps(int step_index) {
+  if (!glMapBufferRangeWGL || !current_context_ || !bin_data_) {
+    return;
+  }
+  if (staged_step_index_ < step_index) {
+    // Too late for these.
+    staged_step_index_ = step_index;
+  }
+  int end_step_index = step_index + kStagingStepCount;
+  if (end_step_index > step_count_) {
+    end_step_index = step_count_;
+  }
+  bool made_current = false;
+  for (; staged_step_index_ < end_step_index; staged_step_index_++) {
+    size_t offset = step_bin_offsets_[staged_step_index_];
+    size_t end = step_bin_offsets_[staged_step_index_ + 1];
+    if (end > bin_data_length_) {
+      end = bin_data_length_;
+    }
+    if (offset >= end || end - offset < kMinStagedLength) {
+      continue;
+    }
+
+    StagingSlot* slot = NULL;
+    {
+      lock_guard<mutex> lock(staging_mutex_);
+      for (int n = 0; n < kStagingStepCount; n++) {
+        if (staging_slots_[n].state == StagingSlot::kFree) {
+          slot = &staging_slots_[n];
+          break;
+        }
+      }
+    }
+    if (!slot) {
+      // Try again once a step is done with its slot.
+      break;
+    }
+
+    // Staged data is only used on the context it was staged on.
+    if (!made_current) {
+      current_context_->MakeCurrent();
+      made_current = true;
+    }
+    if (slot->context != current_context_) {
+      if (slot->buffer) {
+        slot->context->MakeCurrent();
+        glDeleteBuffers(1, &slot->buffer);
+        current_context_->MakeCurrent();
+      }
+      slot->context = current_context_;
+      glGenBuffers(1, &slot->buffer);
+    }
+    size_t length = end - offset;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+    // Orphans the old contents, so that mapping doesn't wait for the GPU.
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, length, NULL, GL_STREAM_DRAW);
+    void* mapping = glMapBufferRangeWGL(
+        GL_PIXEL_UNPACK_BUFFER, 0, length,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (!mapping) {
+      continue;
+    }
+
+    slot->step_index = staged_step_index_;
+    slot->offset = offset;
+    slot->length = length;
+    slot->mapping = (uint8_t*)mapping;
+    {
+      lock_guard<mutex> lock(staging_mutex_);
+      slot->state = StagingSlot::kMapped;
+    }
+    staging_cond_.notify_all();
+  }
+}
+
+void Replay::BeginStagedStep(int step_index) {
+  active_slot_ = NULL;
+  StagingSlot* slot = NULL;
+  {
+    unique_lock<mutex> lock(staging_mutex_);
+    for (int n = 0; n < kStagingStepCount; n++) {
+      if (staging_slots_[n].state != StagingSlot::kFree &&
+          staging_slots_[n].step_index == step_index) {
+        slot = &staging_slots_[n];
+        break;
+      }
+    }
+    if (!slot) {
+      return;
+    }
+    while (slot->state != StagingSlot::kCopied) {
+      staging_cond_.wait(lock);
+    }
+  }
+
+  // Uploads can only read the buffer once it is unmapped.
+  slot->context->MakeCurrent();
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+  GLboolean unmapped = glUnmapBufferWGL(GL_PIXEL_UNPACK_BUFFER);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (current_context_ != slot->context) {
+    current_context_->MakeCurrent();
+  }
+  if (unmapped) {
+    active_slot_ = slot;
+  } else {
+    // The contents were lost (e.g. to a display mode change).
+    lock_guard<mutex> lock(staging_mutex_);
+    slot->state = StagingSlot::kFree;
+  }
+}
+
+void Replay::EndStagedStep() {
+  EndUpload();
+  if (active_slot_) {
+    lock_guard<mutex> lock(staging_mutex_);
+    active_slot_->state = StagingSlot::kFree;
+    active_slot_ = NULL;
+  }
+}
+
+void Replay::StagingThreadMain() {
+  unique_lock<mutex> lock(staging_mutex_);
+  while (!staging_exiting_) {
+    // Copy for the earliest step first.
+    StagingSlot* slot = NULL;
+    for (int n = 0; n < kStagingStepCount; n++) {
+      if (staging_slots_[n].state == StagingSlot::kMapped &&
+          (!slot || staging_slots_[n].step_index < slot->step_index)) {
+        slot = &staging_slots_[n];
+      }
+    }
+    if (!slot) {
+      staging_cond_.wait(lock);
+      continue;
+    }
+
+    slot->state = StagingSlot::kCopying;
+    lock.unlock();
+    memcpy(slot->mapping, bin_data_ + slot->offset, slot->length);
+    lock.lock();
+    slot->state = StagingSlot::kCopied;
+    staging_cond_.notify_all();
+  }
+}
+
 const void* Replay::GetBinData(size_t offset, size_t length) {
   if (offset + length > bin_data_length_) {
     return NULL;
@@ -370,32 +828,59 @@ const void* Replay::GetBinData(size_t offset, size_t length) {
   return bin_data_ + offset;
 }
 
+const void* Replay::GetUploadData(size_t offset, size_t length) {
+  StagingSlot* slot = active_slot_;
+  if (!slot || slot->context != current_context_ ||
+      offset < slot->offset || offset + length > slot->offset + slot->length) {
+    return GetBinData(offset, length);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->buffer);
+  upload_bound_ = true;
+  return (const void*)(offset - slot->offset);
+}
+
+void Replay::EndUpload() {
+  if (upload_bound_) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    upload_bound_ = false;
+  }
+}
+
+bool Replay::HandleEvents() {
+  bool running = true;
+  SDL_Event event;
+  while (SDL_PollEvent(&event)) {
+    switch (event.type) {
+      case SDL_WINDOWEVENT_CLOSE:
+      case SDL_QUIT:
+        running = false;
+        break;
+      case SDL_WINDOWEVENT:
+        printf("SDL_WINDOWEVENT(%d, %d, %d)\n",
+               event.window.event, event.window.data1, event.window.data2);
+        switch (event.window.event) {
+          case 14:
+            running = false;
+            break;
+        }
+        break;
+      default:
+        printf("SDL event: %d\n", event.type);
+        break;
+    }
+  }
+  return running;
+}
+
 int Replay::Run() {
+#if BENCHMARK_ITERATIONS
+  return RunBenchmark(BENCHMARK_ITERATIONS);
+#endif  // BENCHMARK_ITERATIONS
+
   bool running = true;
   while (running) {
     // Handle all pending SDL events.
-    SDL_Event event;
-    while (SDL_PollEvent(&event)) {
-      switch (event.type) {
-        case SDL_WINDOWEVENT_CLOSE:
-        case SDL_QUIT:
-          running = false;
-          break;
-        case SDL_WINDOWEVENT:
-          printf("SDL_WINDOWEVENT(%d, %d, %d)\n",
-                 event.window.event, event.window.data1, event.window.data2);
-          switch (event.window.event) {
-            case 14:
-              running = false;
-              break;
-          }
-          break;
-        default:
-          printf("SDL event: %d\n", event.type);
-          break;
-      }
-    }
-    if (!running) {
+    if (!HandleEvents()) {
       break;
     }
 
@@ -415,11 +900,172 @@ int Replay::Run() {
   return 0;
 }
 
+int Replay::RunBenchmark(int iterations) {
+  // Times by step, one per iteration.
+  vector<vector<double> > cpu_times(step_count_);
+  vector<vector<double> > gpu_times(step_count_);
+  double ticks_per_ms = SDL_GetPerformanceFrequency() / 1000.0;
+
+  for (int iteration = 0; iteration < iterations; iteration++) {
+    if (!HandleEvents()) {
+      break;
+    }
+    printf("Benchmark iteration %d/%d\n", iteration + 1, iterations);
+
+    // The steps create their objects again, so each iteration starts from
+    // the same memory use.
+    if (iteration) {
+      DeleteObjects();
+    }
+
+    // The bin data may have been evicted since the last iteration.
+    prefetched_step_index_ = 0;
+    staged_step_index_ = 0;
+    for (step_index_ = 0; step_index_ < step_count_; step_index_++) {
+      // Only the contexts that exist before the step can time it, which
+      // misses the first step of a context.
+      for (vector<CanvasContext*>::iterator it = contexts_.begin();
+           it != contexts_.end(); ++it) {
+        (*it)->BeginTimer(step_index_);
+      }
+      size_t timed_context_count = contexts_.size();
+
+      Uint64 start_ticks = SDL_GetPerformanceCounter();
+      RunStep(step_index_);
+      Uint64 end_ticks = SDL_GetPerformanceCounter();
+      cpu_times[step_index_].push_back(
+          (end_ticks - start_ticks) / ticks_per_ms);
+
+      for (size_t n = 0; n < timed_context_count; n++) {
+        contexts_[n]->EndTimer();
+      }
+      for (vector<CanvasContext*>::iterator it = contexts_.begin();
+           it != contexts_.end(); ++it) {
+        (*it)->Swap();
+      }
+    }
+
+    // Waiting on the GPU here keeps it out of the CPU times.
+    vector<double> iteration_gpu_times(step_count_);
+    bool gpu_times_valid = !contexts_.empty();
+    for (vector<CanvasContext*>::iterator it = contexts_.begin();
+         it != contexts_.end(); ++it) {
+      gpu_times_valid &= (*it)->CollectTimers(&iteration_gpu_times);
+    }
+    if (gpu_times_valid) {
+      for (int n = 0; n < step_count_; n++) {
+        gpu_times[n].push_back(iteration_gpu_times[n]);
+      }
+    }
+  }
+
+  return WriteBenchmarkResults(cpu_times, gpu_times) ? 0 : 1;
+}
+
+namespace {
+
+// Nearest rank percentile of sorted (which must not be empty).
+double Percentile(const vector<double>& sorted, double percent) {
+  size_t rank = (size_t)ceil(percent / 100.0 * sorted.size());
+  return sorted[rank ? rank - 1 : 0];
+}
+
+void WriteTimingRow(FILE* file, const char* step, const char* timer,
+                    vector<double> times) {
+  if (times.empty()) {
+    return;
+  }
+  sort(times.begin(), times.end());
+  double sum = 0;
+  for (size_t n = 0; n < times.size(); n++) {
+    sum += times[n];
+  }
+  fprintf(file, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+          step, timer, (int)times.size(), sum / times.size(),
+          times.front(), Percentile(times, 50), Percentile(times, 90),
+          Percentile(times, 99), times.back());
+}
+
+}  // namespace
+
+bool Replay::WriteBenchmarkResults(
+    const vector<vector<double> >& cpu_times,
+    const vector<vector<double> >& gpu_times) {
+  // some_test.bin -> some_test-benchmark.csv
+  string csv_path = base_path_ + bin_name_;
+  size_t extension = csv_path.rfind('.');
+  if (extension != string::npos && extension > base_path_.size()) {
+    csv_path.erase(extension);
+  }
+  csv_path += "-benchmark.csv";
+  FILE* file = fopen(csv_path.c_str(), "w");
+  if (!file) {
+    printf("Unable to write benchmark results to %s\n", csv_path.c_str());
+    return false;
+  }
+
+  // Times are in ms.
+  fprintf(file, "step,timer,samples,mean,min,p50,p90,p99,max\n");
+  vector<double> cpu_totals;
+  vector<double> gpu_totals;
+  for (int n = 0; n < step_count_; n++) {
+    char step[16];
+    sprintf(step, "%d", n);
+    WriteTimingRow(file, step, "cpu", cpu_times[n]);
+    WriteTimingRow(file, step, "gpu", gpu_times[n]);
+
+    cpu_totals.resize(cpu_times[n].size());
+    for (size_t i = 0; i < cpu_times[n].size(); i++) {
+      cpu_totals[i] += cpu_times[n][i];
+    }
+    gpu_totals.resize(gpu_times[n].size());
+    for (size_t i = 0; i < gpu_times[n].size(); i++) {
+      gpu_totals[i] += gpu_times[n][i];
+    }
+  }
+  WriteTimingRow(file, "total", "cpu", cpu_totals);
+  WriteTimingRow(file, "total", "gpu", gpu_totals);
+  fclose(file);
+
+  printf("Wrote benchmark results to %s\n", csv_path.c_str());
+  if (gpu_totals.empty()) {
+    printf("No GPU times: timer queries are unavailable or were disjoint\n");
+  }
+  return true;
+}
+
+void Replay::DeleteObjects() {
+  // Staging buffers would be deleted along with the objects of their
+  // contexts anyway.
+  for (int n = 0; n < kStagingStepCount; n++) {
+    StagingSlot& slot = staging_slots_[n];
+    if (slot.buffer) {
+      slot.context->MakeCurrent();
+      glDeleteBuffers(1, &slot.buffer);
+      slot.buffer = 0;
+      slot.context = 0;
+    }
+  }
+  for (vector<CanvasContext*>::iterator it = contexts_.begin();
+       it != contexts_.end(); ++it) {
+    (*it)->DeleteObjects();
+  }
+}
+
+void Replay::RunStep(int step_index) {
+  // Keep the bin data of the next few steps on its way in.
+  PrefetchSteps(step_index);
+  StageSteps(step_index);
+
+  BeginStagedStep(step_index);
+  steps_[step_index](this);
+  EndStagedStep();
+}
+
 bool Replay::IssueNextStep() {
   // Issue the next step.
   //printf("STEP %d:\n", step_index_);
-  StepFunction step = steps_[step_index_];
-  step(this);
+  RunStep(step_index_);
 
   // Return true = steps remaining.
 #if REPEAT_LAST_FRAME
@@ -434,15 +1080,25 @@ bool Replay::IssueNextStep() {
 }
 
 CanvasContext* Replay::CreateContext(int handle) {
+  // Benchmark iterations create the same contexts again.
+  unordered_map<int, CanvasContext*>::iterator it = context_map_.find(handle);
+  if (it != context_map_.end()) {
+    current_context_ = it->second;
+    current_context_->MakeCurrent();
+    return current_context_;
+  }
+
   CanvasContext* context = new CanvasContext(trace_name_, handle);
   contexts_.push_back(context);
   context_map_[handle] = context;
+  current_context_ = context;
   return context;
 }
 
 CanvasContext* Replay::MakeContextCurrent(int handle, int width, int height) {
   CanvasContext* context = context_map_[handle];
   context->MakeCurrent(width, height);
+  current_context_ = context;
   return context;
 }
 
@@ -451,6 +1107,7 @@ extern const char* __trace_name;
 extern const char* __bin_name;
 extern int __step_count;
 extern StepFunction* __get_steps();
+extern size_t __step_bin_offsets[];
 
 #if defined(WIN32)
 int wmain(int argc, wchar_t *argv[]) {
@@ -468,7 +1125,8 @@ int main(int argc, char** argv) {
   }
 #endif  // USE_ANGLE
 
-  Replay replay(__trace_name, __bin_name, __get_steps(), __step_count);
+  Replay replay(__trace_name, __bin_name, __get_steps(), __step_count,
+                __step_bin_offsets);
 
   if (!replay.LoadResources()) {
     return 1;
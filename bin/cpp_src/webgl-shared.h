@@ -15,16 +15,25 @@
 #define USE_ANGLE 1
 #endif
 
+#include <algorithm>
+#include <condition_variable>
 #include <math.h>
+#include <mutex>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 #if defined(WIN32)
 #include <windows.h>
 #else
+#include <fcntl.h>          // open
+#include <sys/mman.h>       // mmap, madvise
+#include <sys/stat.h>       // fstat
 #include <unistd.h>         // readlink
 #endif  // WIN32
 
@@ -50,6 +59,7 @@ typedef struct {
    GLint       height;
    EGLNativeWindowType  hWnd;
    EGLDisplay  display;
+   EGLConfig   config;
    EGLContext  context;
    EGLSurface  surface;
 } ESContext;
@@ -76,6 +86,51 @@ extern PFNGLDRAWARRAYSINSTANCEDWGLPROC glDrawArraysInstancedWGL;
 extern PFNGLDRAWELEMENTSINSTANCEDWGLPROC glDrawElementsInstancedWGL;
 extern PFNGLVERTEXATTRIBDIVISORWGLPROC glVertexAttribDivisorWGL;
 
+// Timer queries, from EXT_disjoint_timer_query or (on desktop GL)
+// ARB_timer_query. Null if neither is available.
+typedef void (*PFNGLGENQUERIESWGLPROC)(GLsizei n, GLuint* ids);
+typedef void (*PFNGLDELETEQUERIESWGLPROC)(GLsizei n, const GLuint* ids);
+typedef void (*PFNGLBEGINQUERYWGLPROC)(GLenum target, GLuint id);
+typedef void (*PFNGLENDQUERYWGLPROC)(GLenum target);
+typedef void (*PFNGLGETQUERYOBJECTUI64VWGLPROC)(
+    GLuint id, GLenum pname, uint64_t* params);
+
+extern PFNGLGENQUERIESWGLPROC glGenQueriesWGL;
+extern PFNGLDELETEQUERIESWGLPROC glDeleteQueriesWGL;
+extern PFNGLBEGINQUERYWGLPROC glBeginQueryWGL;
+extern PFNGLENDQUERYWGLPROC glEndQueryWGL;
+extern PFNGLGETQUERYOBJECTUI64VWGLPROC glGetQueryObjectui64vWGL;
+// True if GL_GPU_DISJOINT_EXT tells when timer results are unusable.
+extern bool timer_queries_disjoint;
+
+// Buffer mapping, for staging texture data in pixel buffer objects.
+// Null unless the context has pixel buffer objects (GL 3+ or ES 3+).
+typedef void* (*PFNGLMAPBUFFERRANGEWGLPROC)(
+    GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+typedef GLboolean (*PFNGLUNMAPBUFFERWGLPROC)(GLenum target);
+
+extern PFNGLMAPBUFFERRANGEWGLPROC glMapBufferRangeWGL;
+extern PFNGLUNMAPBUFFERWGLPROC glUnmapBufferWGL;
+
+#if !defined(GL_PIXEL_UNPACK_BUFFER)
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#if !defined(GL_MAP_WRITE_BIT)
+#define GL_MAP_WRITE_BIT 0x0002
+#endif
+#if !defined(GL_MAP_INVALIDATE_BUFFER_BIT)
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#endif
+#if !defined(GL_TIME_ELAPSED_EXT)
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#if !defined(GL_QUERY_RESULT_EXT)
+#define GL_QUERY_RESULT_EXT 0x8866
+#endif
+#if !defined(GL_GPU_DISJOINT_EXT)
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
 
 class Replay;
 typedef void (*StepFunction)(Replay*);
@@ -92,6 +147,18 @@ public:
 
   GLuint GetObject(int handle);
   void SetObject(int handle, GLuint id);
+  // Deletes every object created through the replay, so that the steps can
+  // be run again from the same state.
+  void DeleteObjects();
+
+  // Measures the GPU time of the commands issued on this context for step
+  // step_index, until EndTimer. Does nothing without timer queries.
+  void BeginTimer(int step_index);
+  void EndTimer();
+  // Waits for the timers ended since the last call and adds their times (in
+  // ms) to step_times, by step index.
+  // Returns false if the times are unusable (e.g. the GPU was disjoint).
+  bool CollectTimers(vector<double>* step_times);
 
 private:
   const char*     window_title_;
@@ -108,35 +175,136 @@ private:
   int             height_;
 
   unordered_map<int, GLuint> object_map_;
+
+  // Timer queries, reused from one collection to the next, and the steps
+  // that the first timer_count_ of them are measuring.
+  vector<GLuint>  timer_queries_;
+  vector<int>     timer_step_indices_;
+  size_t          timer_count_;
 };
 
 
 class Replay {
 public:
+  // step_bin_offsets holds step_count + 1 offsets: the bin data used by step
+  // n lies between entries n and n + 1.
   Replay(const char* trace_name, const char* bin_name,
-         const StepFunction* steps, int step_count);
+         const StepFunction* steps, int step_count,
+         const size_t* step_bin_offsets);
   ~Replay();
 
+  // Maps the bin file. Pages are only read in as steps touch them (or are
+  // about to, see PrefetchSteps).
   bool LoadResources();
   const void* GetBinData(size_t offset, size_t length);
 
+  // Gets bin data for a texture upload call. If the current step's data was
+  // staged in a pixel buffer object, this binds it and returns the offset of
+  // the data in it, so call EndUpload after the upload.
+  const void* GetUploadData(size_t offset, size_t length);
+  void EndUpload();
+
   int Run();
   bool IssueNextStep();
 
+  // Runs the step list iterations times, timing each step on the CPU and,
+  // where timer queries are available, on the GPU. The timings are written
+  // as CSV next to the bin file.
+  int RunBenchmark(int iterations);
+
   CanvasContext* CreateContext(int handle);
   CanvasContext* MakeContextCurrent(
       int handle, int width = -1, int height = -1);
 
 private:
+  // Number of steps ahead of the current one whose bin data is prefetched.
+  static const int kPrefetchStepCount = 8;
+
+  // Asks the OS to read in the bin data of steps up to kPrefetchStepCount
+  // past step_index, that has not been asked for yet.
+  void PrefetchSteps(int step_index);
+
+  // Number of steps ahead of the current one whose texture data is staged,
+  // and the smallest step bin data worth staging.
+  static const int kStagingStepCount = 4;
+  static const size_t kMinStagedLength = 256 * 1024;
+
+  // Bin data of a step, being copied into a mapped pixel buffer object by the
+  // staging thread.
+  struct StagingSlot {
+    enum State {
+      kFree,
+      kMapped,    // Waiting for the staging thread.
+      kCopying,
+      kCopied,    // Ready to be unmapped and used by the step.
+    };
+    State           state;
+    int             step_index;
+    // Pixel buffer object and the context that owns it.
+    CanvasContext*  context;
+    GLuint          buffer;
+    size_t          offset;
+    size_t          length;
+    uint8_t*        mapping;
+  };
+
+  // Maps pixel buffer objects for the large steps up to kStagingStepCount
+  // past step_index that have not been staged yet, and hands them to the
+  // staging thread.
+  void StageSteps(int step_index);
+  // Waits for the staging of step_index, if it was staged, and makes its
+  // pixel buffer object usable by GetUploadData.
+  void BeginStagedStep(int step_index);
+  void EndStagedStep();
+  void StagingThreadMain();
+
+  // Deletes the objects created by the steps so far, along with the staging
+  // buffers, so that the step list can be run again from the start.
+  void DeleteObjects();
+
+  // Runs a step along with prefetching and staging.
+  void RunStep(int step_index);
+
+  // Handles all pending SDL events.
+  // Returns false if the app should quit.
+  bool HandleEvents();
+
+  bool WriteBenchmarkResults(const vector<vector<double> >& cpu_times,
+                             const vector<vector<double> >& gpu_times);
+
   const char* trace_name_;
   const char* bin_name_;
+  // Path of the executable, with a trailing separator.
+  string base_path_;
   const StepFunction* steps_;
   int   step_count_;
   int   step_index_;
+  const size_t* step_bin_offsets_;
+  // Steps before this one have had their bin data prefetched.
+  int   prefetched_step_index_;
 
-  uint8_t*  bin_data_;
-  size_t    bin_data_length_;
+  const uint8_t*  bin_data_;
+  size_t          bin_data_length_;
+#if defined(WIN32)
+  HANDLE    bin_file_;
+  HANDLE    bin_mapping_;
+#endif  // WIN32
 
   vector<CanvasContext*> contexts_;
   unordered_map<int, CanvasContext*> context_map_;
+  // Context last made current by a step.
+  CanvasContext* current_context_;
+
+  // Texture data staging. Slot states are guarded by staging_mutex_; the
+  // rest of a slot belongs to whichever thread the state says.
+  StagingSlot   staging_slots_[kStagingStepCount];
+  // Steps before this one have been considered for staging.
+  int           staged_step_index_;
+  // Slot of the running step, if it was staged.
+  StagingSlot*  active_slot_;
+  bool          upload_bound_;
+  thread        staging_thread_;
+  mutex         staging_mutex_;
+  condition_variable staging_cond_;
+  bool          staging_exiting_;
 };
@@ -54,6 +54,11 @@ function runTool(platform, args, done) {
       default: false,
       desc: 'Use ANGLE on Windows instead of native GL.'
     })
+    .options('benchmark', {
+      type: 'string',
+      default: '0',
+      desc: 'Run the steps this many times offscreen and write their timings as CSV instead of displaying them.'
+    })
     .options('vs_config', {
       type: 'string',
       default: 'Release',
@@ -138,6 +143,15 @@ BinFile.prototype.dispose = function() {
 };
 
 
+/**
+ * Gets the offset that the next write will go to.
+ * @return {number} Offset in the file.
+ */
+BinFile.prototype.getOffset = function() {
+  return this.offset_;
+};
+
+
 /**
  * Writes data to the file.
  * @param {!ArrayBufferView} data Array buffer data.
@@ -205,9 +219,14 @@ function processDatabase(argv, outputBaseFile, db, done) {
   }
 
   // Add all steps.
+  // Steps append their data to the bin file in order, so each step's data
+  // lies between its offset and the next step's. The replay uses this to
+  // prefetch the data of upcoming steps.
   var ccFiles = [];
+  var stepBinOffsets = [];
   for (var n = 0; n < steps.length; n++) {
     var step = steps[n];
+    stepBinOffsets.push(binFile.getOffset());
 
     // Prep file.
     var output = [];
@@ -241,6 +260,10 @@ function processDatabase(argv, outputBaseFile, db, done) {
   output.push(
       'int __step_count = ' + stepFnList.length + ';');
   output.push('StepFunction* __get_steps() { return __steps; }');
+  stepBinOffsets.push(binFile.getOffset());
+  output.push(
+      'size_t __step_bin_offsets[] = { ' +
+          stepBinOffsets.join(', ') + ' };');
 
   // Static info.
   output.push(
@@ -303,6 +326,7 @@ function build(argv, tempDir, outputBaseFile, ccFiles, done) {
         '-lm -lSDL2 -lpthread -lGL -ldl -lrt',
         '-I/usr/local/include/SDL2',
         '-D_REENTRANT',
+        '-DBENCHMARK_ITERATIONS=' + (parseInt(argv['benchmark'], 10) || 0),
       ].join(' ') + '"',
       'LDFLAGS="' + [
         '-o ' + outputFile,
@@ -338,6 +362,7 @@ function build(argv, tempDir, outputBaseFile, ccFiles, done) {
     var config = argv['vs_config'] || 'Debug';
     var platform = argv['vs_platform'] || 'x86';
     var useAngle = argv['use_angle'] || false;
+    var benchmarkIterations = parseInt(argv['benchmark'], 10) || 0;
     var depsPath = argv['vs_deps'] || 'C:\\Dev\\tf-deps\\';
 
     outputBaseFile = path.resolve(outputBaseFile);
@@ -369,6 +394,7 @@ function build(argv, tempDir, outputBaseFile, ccFiles, done) {
     vcxproj = vcxproj.replace(/%%TEMPLATEPATH%%/g, path.resolve(templatePath));
     vcxproj = vcxproj.replace(/%%CCFILES%%/g, ccFileIncludes.join('\n'));
     vcxproj = vcxproj.replace(/%%USEANGLE%%/g, useAngle ? 1 : 0);
+    vcxproj = vcxproj.replace(/%%BENCHMARK%%/g, benchmarkIterations);
     vcxproj = vcxproj.replace(/%%EXEOUTPUTPATH%%/g, outputBaseFile + '.exe');
 
     // Write out project.
@@ -469,7 +495,16 @@ function addStep(eventList, stepIndex, step, output, binFile) {
 
 var ENABLE_BIN_FILE = true;
 var ONLY_LARGE_BIN_DATA = false;
-function embedArray(v, binFile) {
+/**
+ * Embeds an array as a C expression, placing it in the bin file if needed.
+ * @param {!ArrayBufferView} v Array.
+ * @param {!BinFile} binFile Bin file.
+ * @param {boolean=} opt_upload True if the array is the source of a texture
+ *     upload, which may read it from a staged pixel buffer object instead.
+ *     The call must be followed by replay->EndUpload().
+ * @return {string} C expression.
+ */
+function embedArray(v, binFile, opt_upload) {
   var targetType;
   if (v instanceof Int8Array) {
     targetType = 'GLbyte';
@@ -494,7 +529,8 @@ function embedArray(v, binFile) {
       (!ONLY_LARGE_BIN_DATA || v.byteLength > 16 * 4)) {
     // Bin file.
     var offset = binFile.write(v);
-    return '(const ' + targetType + '*)' + '(replay->GetBinData(' +
+    var getter = opt_upload ? 'GetUploadData' : 'GetBinData';
+    return '(const ' + targetType + '*)' + '(replay->' + getter + '(' +
         offset + ', ' + v.byteLength + '))';
   } else {
     // Directly embed.
@@ -662,8 +698,9 @@ var CALLS = {
       args['target'], args['level'], args['internalformat'],
       args['width'], args['height'], args['border'],
       args['data'].byteLength,
-      '(const GLvoid*)' + embedArray(args['data'], binFile)
+      '(const GLvoid*)' + embedArray(args['data'], binFile, true)
     ].join(', ') + ');');
+    output.push('replay->EndUpload();');
   },
   'WebGLRenderingContext#compressedTexSubImage2D': function(
       it, args, output, binFile) {
@@ -672,8 +709,9 @@ var CALLS = {
       args['yoffset'], args['width'], args['height'],
       args['format'],
       args['data'].byteLength,
-      '(const GLvoid*)' + embedArray(args['data'], binFile)
+      '(const GLvoid*)' + embedArray(args['data'], binFile, true)
     ].join(', ') + ');');
+    output.push('replay->EndUpload();');
   },
   'WebGLRenderingContext#copyTexImage2D': function(
       it, args, output, binFile) {
@@ -1152,8 +1190,9 @@ var CALLS = {
           args['border'],
           args['format'],
           args['type'],
-          '(const GLvoid*)' + embedArray(args['pixels'], binFile)
+          '(const GLvoid*)' + embedArray(args['pixels'], binFile, true)
       ].join(', ') + ');');
+      output.push('replay->EndUpload();');
     } else if (dataType == 'null') {
       output.push('glTexImage2D(' + [
         args['target'],
@@ -1203,8 +1242,9 @@ var CALLS = {
         args['height'],
         args['format'],
         args['type'],
-        '(const GLvoid*)' + embedArray(args['pixels'], binFile)
+        '(const GLvoid*)' + embedArray(args['pixels'], binFile, true)
       ].join(', ') + ');');
+      output.push('replay->EndUpload();');
     } else if (dataType == 'null') {
       output.push('glTexSubImage2D(' + [
         args['target'],
@@ -1,9 +1,286 @@
 #include "wtf/buffer.h"
 
+#include <algorithm>
+
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "wtf/compress.h"
+#include "wtf/event.h"
+
 namespace wtf {
 
 OutputBuffer::OutputBuffer(std::ostream* out) : out_{out} {}
 
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+OutputBuffer::OutputBuffer(int fd, FdMode mode)
+    : fd_{fd}, mapped_{mode == FdMode::kMap} {}
+#endif
+
+OutputBuffer::OutputBuffer(char* memory, size_t size)
+    : mapped_{true}, mapping_{memory}, mapping_size_{size} {}
+
+OutputBuffer::~OutputBuffer() { Close(); }
+
+bool OutputBuffer::Close() {
+  bool success = Flush();
+  if (closed_) {
+    return success;
+  }
+  closed_ = true;
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+  if (mapped_ && fd_ >= 0) {
+    if (mapping_ && munmap(mapping_, mapping_size_) != 0) {
+      failed_ = true;
+    }
+    mapping_ = nullptr;
+    if (ftruncate(fd_, written_) != 0) {
+      failed_ = true;
+    }
+  }
+#endif
+  return success && !failed_;
+}
+
+void OutputBuffer::CopyToMapping(const void* m, size_t len) {
+  if (failed_) {
+    return;
+  }
+  if (!ReserveMapping(written_ + len)) {
+    if (!mapped_ && !failed_) {
+      // The file can't be mapped after all.
+      Stage(m, len);
+    }
+    return;
+  }
+  memcpy(mapping_ + written_, m, len);
+}
+
+void OutputBuffer::set_compressor(Compressor* compressor) {
+  if (capturing_) {
+    FinishChunk();
+  }
+  compressor_ = compressor;
+}
+
+void OutputBuffer::FinishChunk() {
+  static constexpr size_t kHeaderWords = 6 + 3 + 2;
+  capturing_ = false;
+  compressed_.clear();
+  if (!compressor_->Compress(chunk_.data(), chunk_.size(), &compressed_) ||
+      kHeaderWords * sizeof(uint32_t) + compressed_.size() >= chunk_.size()) {
+    Append(chunk_.data(), chunk_.size());
+    return;
+  }
+
+  // The original chunk header says what the compressed chunk holds.
+  uint32_t header[6];
+  memcpy(header, chunk_.data(), sizeof(header));
+  uint32_t part_length = 2 * sizeof(uint32_t) + compressed_.size();
+  uint32_t aligned_part_length =
+      (part_length + kAlignment - 1) / kAlignment * kAlignment;
+  uint32_t words[kHeaderWords] = {
+      header[0],  // Id.
+      header[1],  // Type.
+      static_cast<uint32_t>(6 * sizeof(uint32_t) + 3 * sizeof(uint32_t) +
+                            aligned_part_length),
+      header[3],  // Start time.
+      header[4],  // End time.
+      1,          // Part count.
+      Compressor::kPartType,
+      0,  // Offset.
+      part_length,
+      compressor_->format(),
+      static_cast<uint32_t>(chunk_.size()),
+  };
+  Append(words, sizeof(words));
+  Append(compressed_.data(), compressed_.size());
+  Align();
+}
+
+char* OutputBuffer::ReserveRange(size_t len) {
+  if (capturing_) {
+    // The capture was sized for the whole chunk, so this does not move it.
+    size_t offset = chunk_.size();
+    if (len > chunk_.capacity() - offset) {
+      return nullptr;
+    }
+    chunk_.resize(offset + len);
+    return &chunk_[offset];
+  }
+  if (!mapped_ || failed_ || !ReserveMapping(written_ + len)) {
+    return nullptr;
+  }
+  char* range = mapping_ + written_;
+  written_ += len;
+  return range;
+}
+
+bool OutputBuffer::ReserveMapping(size_t size) {
+  if (size <= mapping_size_) {
+    return true;
+  }
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+  if (fd_ < 0) {
+    // Fixed memory.
+    failed_ = true;
+    return false;
+  }
+  // Grow geometrically and in whole pages, so that only a few remaps are
+  // needed and the mapping never extends past the end of the file.
+  static constexpr size_t kMinMappingSize = 1 << 20;
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t new_size = std::max({size, mapping_size_ * 2, kMinMappingSize});
+  new_size = (new_size + page_size - 1) / page_size * page_size;
+  if (mapping_ && munmap(mapping_, mapping_size_) != 0) {
+    failed_ = true;
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  if (failed_) {
+    return false;
+  }
+  // Allocating the space up front (rather than just extending the file)
+  // keeps page faults on the mapping cheap.
+  void* mapping = MAP_FAILED;
+  int error = posix_fallocate(fd_, 0, new_size);
+  if (error && ftruncate(fd_, new_size) == 0) {
+    error = 0;
+  } else if (error) {
+    error = errno;
+  }
+  if (!error) {
+    mapping =
+        mmap(nullptr, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+      error = errno;
+    }
+  }
+  if (error) {
+    // Pipes, devices and file systems without these fail this way. Until
+    // anything went to the file, it can still be written to instead.
+    if (!written_ &&
+        (error == EINVAL || error == ESPIPE || error == ENODEV)) {
+      mapped_ = false;
+    } else {
+      failed_ = true;
+    }
+    return false;
+  }
+  mapping_ = static_cast<char*>(mapping);
+  mapping_size_ = new_size;
+  return true;
+#else
+  failed_ = true;
+  return false;
+#endif
+}
+
+void OutputBuffer::AddSegment(const char* data, size_t len) {
+  if (!len) {
+    return;
+  }
+  if (!segments_.empty()) {
+    // Coalesce with the previous segment if contiguous.
+    Segment& last = segments_.back();
+    if (last.data + last.len == data) {
+      last.len += len;
+      return;
+    }
+  }
+  if (segments_.size() == kMaxSegments) {
+    Flush();
+  }
+  segments_.push_back(Segment{data, len});
+}
+
+void OutputBuffer::Stage(const void* m, size_t len) {
+  if (len > kStagingChunkSize) {
+    // Too big to stage: write out what is pending and then this, so that
+    // it needs no copy.
+    AddSegment(static_cast<const char*>(m), len);
+    Flush();
+    return;
+  }
+  // Flushing releases staging memory, so it must not happen between the
+  // copy and adding its segment.
+  if (segments_.size() == kMaxSegments ||
+      (len > kStagingChunkSize - staging_offset_ &&
+       staging_chunk_count_ == kMaxStagingChunks)) {
+    Flush();
+  }
+  if (len > kStagingChunkSize - staging_offset_) {
+    if (staging_chunk_count_ == staging_chunks_.size()) {
+      staging_chunks_.emplace_back(new char[kStagingChunkSize]);
+    }
+    staging_chunk_count_ += 1;
+    staging_offset_ = 0;
+  }
+  char* staged =
+      staging_chunks_[staging_chunk_count_ - 1].get() + staging_offset_;
+  memcpy(staged, m, len);
+  staging_offset_ += len;
+  AddSegment(staged, len);
+}
+
+bool OutputBuffer::Flush() {
+  if (capturing_) {
+    FinishChunk();
+  }
+  if (out_) {
+    return !out_->fail();
+  } else if (mapped_) {
+    // Written back by the page cache.
+    return !failed_;
+  }
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+  static constexpr size_t kMaxIovecs = 64;
+  struct iovec iovecs[kMaxIovecs];
+  size_t next = 0;
+  while (next < segments_.size() && !failed_) {
+    size_t count = std::min(kMaxIovecs, segments_.size() - next);
+    for (size_t i = 0; i < count; i++) {
+      iovecs[i].iov_base = const_cast<char*>(segments_[next + i].data);
+      iovecs[i].iov_len = segments_[next + i].len;
+    }
+    // Write the batch, resuming after partial writes.
+    struct iovec* iov = iovecs;
+    while (count) {
+      ssize_t written = writev(fd_, iov, count);
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        failed_ = true;
+        break;
+      }
+      size_t remaining = written;
+      while (count && remaining >= iov->iov_len) {
+        remaining -= iov->iov_len;
+        iov++;
+        count--;
+        next++;
+      }
+      if (count) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+        iov->iov_len -= remaining;
+      }
+    }
+  }
+#else
+  failed_ = !segments_.empty();
+#endif
+  segments_.clear();
+  staging_chunk_count_ = 0;
+  staging_offset_ = kStagingChunkSize;
+  return !failed_;
+}
+
 void OutputBuffer::StartChunk(ChunkHeader header, PartHeader* parts,
                               size_t part_count) {
   static constexpr size_t kChunkHeaderSize = 6 * sizeof(uint32_t);
@@ -27,6 +304,19 @@ void OutputBuffer::StartChunk(ChunkHeader header, PartHeader* parts,
     part_offset += aligned_length;
   }
 
+  // The whole chunk is mapped (or captured) up front so that its parts are
+  // plain copies.
+  if (capturing_) {
+    FinishChunk();
+  }
+  if (compressor_) {
+    capturing_ = true;
+    chunk_.clear();
+    chunk_.reserve(chunk_length);
+  } else if (mapped_) {
+    ReserveMapping(written_ + chunk_length);
+  }
+
   // Write out chunk header.
   AppendUint32(header.id);
   AppendUint32(header.type);
@@ -46,81 +336,611 @@ void OutputBuffer::StartChunk(ChunkHeader header, PartHeader* parts,
 
 StringTable::StringTable() = default;
 
-int StringTable::GetStringId(const std::string& str) {
-  platform::lock_guard<platform::mutex> lock{mu_};
-  auto it = strings_to_id_.find(str);
+size_t StringTable::KeyHash::operator()(const Key& key) const {
+  // FNV-1a.
+  size_t hash = 2166136261u;
+  for (size_t i = 0; i < key.len; i++) {
+    hash = (hash ^ static_cast<uint8_t>(key.data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+int StringTable::GetStringId(const char* str, size_t len,
+                             const char** canonical) {
+  CountingLockGuard lock{&mu_, &lock_contentions_};
+  auto it = strings_to_id_.find(Key{str, len});
   if (it == strings_to_id_.end()) {
     // New string.
     int id = strings_.size();
-    strings_.push_back(str);
-    strings_to_id_[str] = id;
+    strings_.emplace_back(str, len);
+    const std::string& s = strings_.back();
+    strings_to_id_[Key{s.data(), s.size()}] = id;
+    raw_length_ += s.size() + 1;
+    if (canonical) {
+      *canonical = s.data();
+    }
     return id;
   } else {
+    if (canonical) {
+      *canonical = it->first.data;
+    }
     return it->second;
   }
 }
 
-void StringTable::PopulateHeader(OutputBuffer::PartHeader* header) {
+void StringTable::PopulateHeader(OutputBuffer::PartHeader* header,
+                                 int first_id, int* end_id) {
   platform::lock_guard<platform::mutex> lock{mu_};
 
-  // Compute size.
-  size_t raw_length = 0;
-  for (const auto& s : strings_) {
-    raw_length += s.size() + 1;
+  size_t length = raw_length_;
+  if (first_id) {
+    length = 0;
+    for (size_t i = first_id; i < strings_.size(); i++) {
+      length += strings_[i].size() + 1;
+    }
   }
-
   header->type = 0x30000;
   header->offset = 0;
-  header->length = raw_length;
+  header->length = length;
+  if (end_id) {
+    *end_id = strings_.size();
+  }
 }
 
 bool StringTable::WriteTo(OutputBuffer::PartHeader* header,
-                          OutputBuffer* output_buffer) {
+                          OutputBuffer* output_buffer, int first_id) {
   platform::lock_guard<platform::mutex> lock{mu_};
 
   // Output up to the previously noted size.
   size_t raw_length = 0;
   size_t expected_raw_length = header->length;
-  for (const auto& s : strings_) {
+  for (size_t i = first_id;
+       i < strings_.size() && raw_length < expected_raw_length; i++) {
+    const std::string& s = strings_[i];
     raw_length += s.size() + 1;
-    if (raw_length <= expected_raw_length) {
-      output_buffer->Append(s.c_str(), s.size() + 1);  // Write null term.
-      if (raw_length == expected_raw_length) {
-        // Clean end.
-        break;
-      }
-    } else {
+    if (raw_length > expected_raw_length) {
       return false;
     }
+    output_buffer->AppendSpan(s.c_str(), s.size() + 1);  // Write null term.
   }
   output_buffer->Align();
-  return true;
+  return raw_length == expected_raw_length;
 }
 
 void StringTable::Clear() {
   platform::lock_guard<platform::mutex> lock{mu_};
-  strings_.clear();
   strings_to_id_.clear();
+  strings_.clear();
+  raw_length_ = 0;
+}
+
+int StringCache::Fill(Entry* entry, uint32_t hash, const char* str,
+                      size_t len) {
+  lookups_.store(lookups_.load(platform::memory_order_relaxed) + 1,
+                 platform::memory_order_relaxed);
+  const char* canonical;
+  int id = string_table_->GetStringId(str, len, &canonical);
+  entry->canonical = canonical;
+  entry->len = len;
+  entry->hash = hash;
+  entry->id = id;
+  return id;
+}
+
+void StringCache::Clear() {
+  for (auto& entry : entries_) {
+    entry.canonical = nullptr;
+  }
+}
+
+EventBlockPool::EventBlockPool() = default;
+
+void EventBlockPool::AllocateSlab() {
+  EventBlock* slab = new EventBlock[kBlocksPerSlab];
+  slabs_.emplace_back(slab);
+  for (size_t i = 0; i < kBlocksPerSlab; i++) {
+    slab[i].next.store(free_list_);
+    free_list_ = &slab[i];
+  }
+  free_count_ += kBlocksPerSlab;
+}
+
+EventBlock* EventBlockPool::PopFreeBlock() {
+  if (!free_list_) {
+    AllocateSlab();
+  }
+  EventBlock* block = free_list_;
+  free_list_ = block->next.load();
+  free_count_ -= 1;
+  in_use_ += 1;
+  block->next.store(nullptr);
+  block->committed.store(0);
+  return block;
+}
+
+void EventBlockPool::CheckWatermark(size_t in_use) {
+  std::function<void()> callback;
+  {
+    platform::lock_guard<platform::mutex> lock{mu_};
+    if (!watermark_ || in_use < watermark_) {
+      return;
+    }
+    callback = watermark_callback_;
+  }
+  if (callback) {
+    callback();
+  }
+}
+
+EventBlock* EventBlockPool::Allocate() {
+  EventBlock* block;
+  size_t in_use;
+  {
+    platform::lock_guard<platform::mutex> lock{mu_};
+    block = PopFreeBlock();
+    in_use = in_use_;
+  }
+  CheckWatermark(in_use);
+  return block;
+}
+
+EventBlock* EventBlockPool::TryAllocate() {
+  EventBlock* block;
+  size_t in_use;
+  {
+    platform::lock_guard<platform::mutex> lock{mu_};
+    if (max_blocks_ && in_use_ >= max_blocks_) {
+      return nullptr;
+    }
+    block = PopFreeBlock();
+    in_use = in_use_;
+  }
+  CheckWatermark(in_use);
+  return block;
+}
+
+void EventBlockPool::Release(EventBlock* first) {
+  platform::lock_guard<platform::mutex> lock{mu_};
+  while (first) {
+    EventBlock* next = first->next.load();
+    first->next.store(free_list_);
+    free_list_ = first;
+    free_count_ += 1;
+    in_use_ -= 1;
+    first = next;
+  }
+}
+
+void EventBlockPool::Reserve(size_t block_count) {
+  platform::lock_guard<platform::mutex> lock{mu_};
+  while (free_count_ < block_count) {
+    AllocateSlab();
+  }
+}
+
+void EventBlockPool::set_max_blocks(size_t max_blocks) {
+  platform::lock_guard<platform::mutex> lock{mu_};
+  max_blocks_ = max_blocks;
+}
+
+void EventBlockPool::SetWatermark(size_t watermark,
+                                  std::function<void()> callback) {
+  platform::lock_guard<platform::mutex> lock{mu_};
+  watermark_ = watermark;
+  watermark_callback_ = std::move(callback);
+}
+
+size_t EventBlockPool::in_use() {
+  platform::lock_guard<platform::mutex> lock{mu_};
+  return in_use_;
+}
+
+EventBuffer::EventBuffer(StringTable* string_table,
+                         EventBlockPool* block_pool)
+    : string_table_(string_table),
+      string_cache_(string_table),
+      block_pool_(block_pool) {
+  head_ = tail_ = snapshot_block_ = block_pool_->Allocate();
+}
+
+EventBuffer::EventBuffer(StringTable* string_table,
+                         CpuEventBuffers* cpu_event_buffers)
+    : string_table_(string_table),
+      string_cache_(string_table),
+      block_pool_(nullptr),
+      tail_(nullptr),
+      cpu_event_buffers_(cpu_event_buffers),
+      head_(nullptr),
+      snapshot_block_(nullptr) {}
+
+EventBuffer::~EventBuffer() {
+  if (block_pool_) {
+    block_pool_->Release(head_);
+  }
+}
+
+uint32_t* EventBuffer::ReserveEventOnCpu(uint32_t wire_id, size_t count) {
+  EventBuffer* cpu_buffer = cpu_event_buffers_->at(
+      PlatformGetCurrentCpu() % cpu_event_buffers_->size());
+  cpu_buffer->write_mu_.lock();
+  locked_cpu_buffer_ = cpu_buffer;
+  cpu_buffer->SwitchWriterZone(zone_id_);
+  return cpu_buffer->ReserveEvent(wire_id, count);
+}
+
+void EventBuffer::SwitchWriterZone(int zone_id) {
+  // Zone creation is written before the zone is set, and belongs to none.
+  if (!zone_id ||
+      zone_id == writer_zone_.load(platform::memory_order_relaxed)) {
+    return;
+  }
+  uint32_t* entries =
+      ReserveEvent(StandardEvents::GetSetZoneEvent().wire_id(), 3);
+  if (entries == scratch_) {
+    // Dropped, so the next event tries again.
+    return;
+  }
+  writer_zone_.store(zone_id, platform::memory_order_release);
+  entries[2] = zone_id;
+  CommitEntries();
+}
+
+void EventBuffer::SetZone(int zone_id, const char* name, const char* type,
+                          const char* location) {
+  zone_id_ = zone_id;
+  zone_name_ = name ? name : "";
+  const char* strings[] = {name, type, location};
+  zone_create_[0] = StandardEvents::GetCreateZoneEvent().wire_id();
+  zone_create_[1] = 0;
+  zone_create_[2] = zone_id;
+  for (size_t i = 0; i < 3; i++) {
+    zone_create_[3 + i] =
+        strings[i] ? GetStringId(strings[i]) : StringTable::kEmptyStringId;
+  }
+}
+
+EventBlock* EventBuffer::EvictHeadBlock() {
+  EventBlock* block = head_;
+  head_entries_ +=
+      block->committed.load(platform::memory_order_relaxed) - head_offset_;
+  head_ = block->next.load(platform::memory_order_relaxed);
+  head_offset_ = 0;
+  evicted_ = true;
+#if defined(WTF_64BIT_TIMESTAMPS)
+  // The new head starts with its own epoch event.
+  head_epoch_ = kNoEpoch;
+#endif
+  block->next.store(nullptr);
+  block->committed.store(0);
+  return block;
+}
+
+bool EventBuffer::AddBlock() {
+  EventBlock* block = nullptr;
+  if (ring_blocks_ &&
+      block_count_.load(platform::memory_order_relaxed) >= ring_blocks_ &&
+      read_mu_.try_lock()) {
+    // Reuse the oldest block, and give back any that were added while a
+    // reader held off overwrites.
+    EventBlock* extra = nullptr;
+    while (block_count_.load(platform::memory_order_relaxed) > ring_blocks_) {
+      EventBlock* evicted = EvictHeadBlock();
+      evicted->next.store(extra);
+      extra = evicted;
+      block_count_.fetch_add(static_cast<size_t>(-1));
+    }
+    block = EvictHeadBlock();
+    read_mu_.unlock();
+    block_pool_->Release(extra);
+  } else {
+    block = bounded_ ? block_pool_->TryAllocate() : block_pool_->Allocate();
+    if (!block) {
+      return false;
+    }
+    block_count_.fetch_add(1);
+    block_allocations_.store(
+        block_allocations_.load(platform::memory_order_relaxed) + 1,
+        platform::memory_order_relaxed);
+  }
+#if defined(WTF_64BIT_TIMESTAMPS)
+  // Start every block with the epoch so that blocks are self contained.
+  uint32_t epoch = epoch_.load(platform::memory_order_relaxed);
+  if (epoch != kNoEpoch) {
+    WriteEpochEvent(block->entries, epoch);
+    tail_size_ = kEpochEntryCount;
+    block->committed.store(tail_size_);
+  } else {
+    tail_size_ = 0;
+  }
+#else
+  tail_size_ = 0;
+#endif
+  // The tail's committed size is final at this point, so publishing the link
+  // tells readers that they may consume all of it.
+  tail_->next.store(block, platform::memory_order_release);
+  tail_ = block;
+  return true;
+}
+
+#if defined(WTF_64BIT_TIMESTAMPS)
+void EventBuffer::WriteEpochEvent(uint32_t* entries, uint32_t epoch) {
+  entries[0] = StandardEvents::kTimeEpochEventId;
+  entries[1] = 0;
+  entries[2] = epoch;
 }
 
-EventBuffer::EventBuffer(StringTable* string_table)
-    : string_table_(string_table) {
-  entries_.clear();
+bool EventBuffer::GetFirstTimestamp(uint64_t* timestamp) {
+  platform::lock_guard<platform::mutex> lock{read_mu_};
+
+  // Find the first unconsumed entry.
+  EventBlock* block = head_;
+  size_t offset = head_offset_;
+  size_t committed;
+  while (true) {
+    EventBlock* next = block->next.load(platform::memory_order_acquire);
+    committed = block->committed.load(platform::memory_order_acquire);
+    if (offset < committed) {
+      break;
+    }
+    if (!next) {
+      return false;
+    }
+    block = next;
+    offset = 0;
+  }
+
+  // Blocks and epoch changes start with an epoch event. Otherwise the epoch
+  // is the one in effect at the cursor.
+  uint32_t epoch = head_epoch_;
+  if (block->entries[offset] == StandardEvents::kTimeEpochEventId) {
+    epoch = block->entries[offset + 2];
+    offset += kEpochEntryCount;
+  }
+  if (offset + 2 > committed || epoch == kNoEpoch) {
+    return false;
+  }
+  *timestamp = (static_cast<uint64_t>(epoch) << 32) |
+               block->entries[offset + 1];
+  return true;
+}
+#endif
+
+void EventBuffer::clear() {
+  if (!block_pool_) {
+    // Forwarding buffers hold no data.
+    return;
+  }
+  block_pool_->Release(head_->next.load());
+  head_->next.store(nullptr);
+  head_->committed.store(0);
+  tail_ = snapshot_block_ = head_;
+  tail_size_ = 0;
+  head_offset_ = 0;
+  head_entries_ = 0;
+  snapshot_offset_ = 0;
+  evicted_ = false;
+  block_count_.store(1);
+  writer_zone_.store(0);
+  head_zone_ = 0;
+#if defined(WTF_64BIT_TIMESTAMPS)
+  epoch_.store(kNoEpoch);
+  head_epoch_ = kNoEpoch;
+#endif
+}
+
+void EventBuffer::Reset() {
+  clear();
+  zone_id_ = 0;
+  ring_blocks_ = 0;
+  prefix_size_ = 0;
+  dropped_events_.store(0);
+  events_written_.store(0);
+  block_allocations_.store(0);
+  zone_name_.clear();
+  set_rate_limit(0, 0);
+  rate_limited_events_.store(0);
+  if (scope_aggregator_) {
+    scope_aggregator_->ResetStack();
+  }
+  out_of_scope_.store(false);
+}
+
+void EventBuffer::set_rate_limit(uint32_t events_per_second, uint32_t burst) {
+  rate_per_second_ = events_per_second;
+  rate_burst_ = burst ? burst : 1;
+  rate_tokens_ = events_per_second ? rate_burst_ : kUnlimitedRateTokens;
+  rate_refill_time_ = PlatformGetTimestampMicros64();
+}
+
+void EventBuffer::ReserveFlowIds() {
+  // Batches start after id 0, which is no flow. Once ids wrap around, the
+  // batch holding 0 starts past it.
+  static platform::atomic<uint32_t> next_batch{kFlowIdBatchSize};
+  next_flow_id_ = next_batch.fetch_add(kFlowIdBatchSize);
+  flow_id_batch_end_ = next_flow_id_ + kFlowIdBatchSize;
+  if (!next_flow_id_) {
+    next_flow_id_ = 1;
+  }
+}
+
+bool EventBuffer::RefillRateTokens() {
+  if (!rate_per_second_) {
+    rate_tokens_ = kUnlimitedRateTokens;
+    return true;
+  }
+  uint64_t now = PlatformGetTimestampMicros64();
+  // Capped so that the product below cannot overflow.
+  uint64_t elapsed = std::min<uint64_t>(now - rate_refill_time_, 1000000000);
+  uint64_t tokens = elapsed * rate_per_second_ / 1000000;
+  if (!tokens) {
+    rate_limited_events_.store(
+        rate_limited_events_.load(platform::memory_order_relaxed) + 1,
+        platform::memory_order_relaxed);
+    return false;
+  }
+  if (tokens >= rate_burst_) {
+    tokens = rate_burst_;
+    rate_refill_time_ = now;
+  } else {
+    // Keep the remainder of the elapsed time for the next refill.
+    rate_refill_time_ += tokens * 1000000 / rate_per_second_;
+  }
+  rate_tokens_ = static_cast<uint32_t>(tokens - 1);
+  return true;
 }
 
-void EventBuffer::PopulateHeader(OutputBuffer::PartHeader* header) {
+void EventBuffer::PopulateHeader(OutputBuffer::PartHeader* header,
+                                 const Position* from, Position* end) {
+  EventBlock* block = head_;
+  size_t offset = head_offset_;
+  uint64_t start_entries = head_entries_;
+  int start_zone = head_zone_;
+#if defined(WTF_64BIT_TIMESTAMPS)
+  uint32_t start_epoch = head_epoch_;
+#endif
+  bool resumed = from && from->entries > head_entries_;
+  if (resumed) {
+    // Skip what the earlier part covered.
+    uint64_t skip = from->entries - head_entries_;
+    while (true) {
+      EventBlock* next = block->next.load(platform::memory_order_acquire);
+      size_t available =
+          block->committed.load(platform::memory_order_acquire) - offset;
+      if (skip <= available || !next) {
+        offset += std::min<uint64_t>(skip, available);
+        break;
+      }
+      skip -= available;
+      block = next;
+      offset = 0;
+    }
+    start_entries = from->entries;
+    start_zone = from->zone_id;
+#if defined(WTF_64BIT_TIMESTAMPS)
+    start_epoch = from->epoch;
+#endif
+  }
+  snapshot_block_ = block;
+  snapshot_offset_ = offset;
+
+  // Loading next before committed guarantees that any block with a successor
+  // is seen in full, and only the last block seen may be partial (ending on
+  // an event boundary).
+  size_t count = 0;
+  while (block) {
+    EventBlock* next = block->next.load(platform::memory_order_acquire);
+    count += block->committed.load(platform::memory_order_acquire) - offset;
+    offset = 0;
+    block = next;
+  }
+  // Read after the data. The epoch and writer zone are stored ahead of the
+  // events announcing them, so these are either the ones in effect at the
+  // end of the data or ones that are about to be announced by the first
+  // event after it.
+  snapshot_zone_ = writer_zone_.load(platform::memory_order_acquire);
+#if defined(WTF_64BIT_TIMESTAMPS)
+  snapshot_epoch_ = epoch_.load(platform::memory_order_acquire);
+#endif
+
+  // A part that resumes a buffer needs the state that was in effect: the
+  // epoch and the zone. The zone is created again only if its creation has
+  // been overwritten and no earlier part carried it. In a CPU buffer, the
+  // zone is that of the last writer.
+  int zone_id = cpu_index_ < 0 ? zone_id_ : start_zone;
+  prefix_size_ = 0;
+  if (count) {
+#if defined(WTF_64BIT_TIMESTAMPS)
+    if (start_epoch != kNoEpoch) {
+      WriteEpochEvent(prefix_, start_epoch);
+      prefix_size_ += kEpochEntryCount;
+    }
+#endif
+    if (zone_id_ && evicted_ && !(from && from->entries)) {
+      memcpy(prefix_ + prefix_size_, zone_create_, sizeof(zone_create_));
+      prefix_size_ += kZoneCreateEntryCount;
+    }
+    if (zone_id) {
+      prefix_[prefix_size_++] = StandardEvents::GetSetZoneEvent().wire_id();
+      prefix_[prefix_size_++] = 0;
+      prefix_[prefix_size_++] = zone_id;
+    }
+  }
+
   header->type = 0x20002;
   header->offset = 0;
-  header->length = entries_.size() * sizeof(uint32_t);
+  header->length = (prefix_size_ + count) * sizeof(uint32_t);
+  if (end) {
+    end->entries = start_entries + count;
+    end->zone_id = snapshot_zone_;
+#if defined(WTF_64BIT_TIMESTAMPS)
+    end->epoch = snapshot_epoch_;
+#endif
+  }
 }
 
 bool EventBuffer::WriteTo(OutputBuffer::PartHeader* header,
                           OutputBuffer* output_buffer) {
-  size_t count = header->length / sizeof(uint32_t);
-  for (size_t i = 0; i < count; i++) {
-    output_buffer->AppendUint32(entries_[i]);
+  size_t remaining = header->length / sizeof(uint32_t);
+  if (remaining < prefix_size_) {
+    return false;
+  }
+  if (remaining) {
+    output_buffer->Append(prefix_, prefix_size_ * sizeof(uint32_t));
+    remaining -= prefix_size_;
+  }
+
+  // Blocks are written whole until the noted length is reached.
+  size_t offset = snapshot_offset_;
+  for (EventBlock* block = snapshot_block_; block && remaining;
+       block = block->next.load(platform::memory_order_acquire)) {
+    size_t count = std::min(
+        block->committed.load(platform::memory_order_acquire) - offset,
+        remaining);
+    // TODO(laurenzo): Byte swap BE.
+    output_buffer->AppendSpan(block->entries + offset,
+                              count * sizeof(uint32_t));
+    remaining -= count;
+    offset = 0;
+  }
+  return remaining == 0;
+}
+
+void EventBuffer::Consume(const OutputBuffer::PartHeader& header) {
+  size_t total = header.length / sizeof(uint32_t);
+  if (total <= prefix_size_) {
+    return;
+  }
+  size_t remaining = total - prefix_size_;
+  while (true) {
+    EventBlock* next = head_->next.load(platform::memory_order_acquire);
+    size_t committed = head_->committed.load(platform::memory_order_acquire);
+    size_t count = std::min(committed - head_offset_, remaining);
+    head_offset_ += count;
+    head_entries_ += count;
+    remaining -= count;
+    if (!next || head_offset_ < committed) {
+      break;
+    }
+    // Fully consumed and the producer has moved on.
+    head_->next.store(nullptr);
+    block_pool_->Release(head_);
+    block_count_.fetch_add(static_cast<size_t>(-1));
+    head_ = next;
+    head_offset_ = 0;
+  }
+  head_zone_ = snapshot_zone_;
+#if defined(WTF_64BIT_TIMESTAMPS)
+  head_epoch_ = snapshot_epoch_;
+#endif
+}
+
+CpuEventBuffers::CpuEventBuffers(StringTable* string_table,
+                                 EventBlockPool* block_pool,
+                                 size_t cpu_count) {
+  for (size_t i = 0; i < std::max<size_t>(cpu_count, 1); i++) {
+    event_buffers_.emplace_back(new EventBuffer(string_table, block_pool));
+    event_buffers_.back()->cpu_index_ = static_cast<int>(i);
   }
-  return true;
 }
 
 }  // namespace wtf
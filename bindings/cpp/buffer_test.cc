@@ -0,0 +1,477 @@
+#include "wtf/buffer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+#include <unistd.h>
+#endif
+
+#include "gtest/gtest.h"
+#include "wtf/event.h"
+
+namespace wtf {
+namespace {
+
+class BufferTest : public ::testing::Test {
+ protected:
+  StringTable string_table_;
+  EventBlockPool block_pool_;
+};
+
+TEST_F(BufferTest, EventsDoNotStraddleBlocks) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  EXPECT_TRUE(event_buffer.empty());
+
+  // Fill so that the next 3 entry reservation does not fit.
+  const size_t kFill = EventBlock::kCapacity - 2;
+  for (size_t i = 0; i < kFill; i++) {
+    event_buffer.AddEntry(i);
+  }
+  uint32_t* entries = event_buffer.ReserveEntries(3);
+  entries[0] = 1;
+  entries[1] = 2;
+  entries[2] = 3;
+  event_buffer.CommitEntries();
+  EXPECT_FALSE(event_buffer.empty());
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  EXPECT_EQ(0x20002u, header.type);
+  EXPECT_EQ((kFill + 3) * sizeof(uint32_t), header.length);
+
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  std::string data = out.str();
+  ASSERT_EQ(header.length, data.size());
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+  EXPECT_EQ(kFill - 1, words[kFill - 1]);
+  EXPECT_EQ(1u, words[kFill]);
+  EXPECT_EQ(3u, words[kFill + 2]);
+
+  event_buffer.clear();
+  EXPECT_TRUE(event_buffer.empty());
+}
+
+TEST_F(BufferTest, WriteToHonorsSnapshotLength) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  event_buffer.AddEntry(1);
+  event_buffer.AddEntry(2);
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  event_buffer.AddEntry(3);
+
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  EXPECT_EQ(2 * sizeof(uint32_t), out.str().size());
+}
+
+TEST_F(BufferTest, UncommittedEntriesAreNotWritten) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  event_buffer.AddEntry(1);
+  uint32_t* entries = event_buffer.ReserveEntries(2);
+  entries[0] = 2;
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  EXPECT_EQ(sizeof(uint32_t), header.length);
+
+  entries[1] = 3;
+  event_buffer.CommitEntries();
+  event_buffer.PopulateHeader(&header);
+  EXPECT_EQ(3 * sizeof(uint32_t), header.length);
+}
+
+#if defined(WTF_64BIT_TIMESTAMPS)
+TEST_F(BufferTest, EpochEventsPrecedeEpochChanges) {
+  static const uint64_t kEpoch = 1ull << 32;
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  uint64_t first_timestamp;
+  EXPECT_FALSE(event_buffer.GetFirstTimestamp(&first_timestamp));
+
+  event_buffer.ReserveEventAt(10, 2, kEpoch - 1);
+  event_buffer.CommitEntries();
+  event_buffer.ReserveEventAt(11, 2, kEpoch + 5);
+  event_buffer.CommitEntries();
+  event_buffer.ReserveEventAt(12, 2, kEpoch + 6);
+  event_buffer.CommitEntries();
+  ASSERT_TRUE(event_buffer.GetFirstTimestamp(&first_timestamp));
+  EXPECT_EQ(kEpoch - 1, first_timestamp);
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  std::string data = out.str();
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+  std::vector<uint32_t> expected = {
+      3, 0, 0, 10, 0xffffffff, 3, 0, 1, 11, 5, 12, 6,
+  };
+  ASSERT_EQ(expected.size() * sizeof(uint32_t), data.size());
+  EXPECT_EQ(expected, std::vector<uint32_t>(words, words + expected.size()));
+}
+
+TEST_F(BufferTest, BlocksStartWithEpochEvent) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  size_t count = (EventBlock::kCapacity / 2) + 1;
+  for (size_t i = 0; i < count; i++) {
+    event_buffer.ReserveEventAt(10, 2, (7ull << 32) + i);
+    event_buffer.CommitEntries();
+  }
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  std::string data = out.str();
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+
+  // The first block holds an epoch event and as many events as fit.
+  size_t first_block = 3 + ((EventBlock::kCapacity - 3) / 2) * 2;
+  EXPECT_EQ(3u, words[first_block]);
+  EXPECT_EQ(7u, words[first_block + 2]);
+  EXPECT_EQ(10u, words[first_block + 3]);
+}
+#endif  // WTF_64BIT_TIMESTAMPS
+
+TEST_F(BufferTest, StringCacheMatchesTable) {
+  StringCache cache{&string_table_};
+  int foo_id = string_table_.GetStringId("foo");
+  char foo[] = "foo";
+  EXPECT_EQ(foo_id, cache.GetStringId(foo));
+  EXPECT_EQ(foo_id, cache.GetStringId("foo"));
+
+  // Same contents, different storage and a prefix must be distinct.
+  int bar_id = cache.GetStringId("bar");
+  EXPECT_NE(foo_id, bar_id);
+  EXPECT_NE(foo_id, cache.GetStringId("fo"));
+  EXPECT_EQ(bar_id, string_table_.GetStringId(std::string("bar")));
+
+  // Many strings will collide in the cache but still resolve correctly.
+  for (int i = 0; i < 1000; i++) {
+    std::string s = "string" + std::to_string(i);
+    EXPECT_EQ(string_table_.GetStringId(s), cache.GetStringId(s.c_str()));
+  }
+  EXPECT_EQ(foo_id, cache.GetStringId(foo));
+
+  OutputBuffer::PartHeader header;
+  string_table_.PopulateHeader(&header);
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(string_table_.WriteTo(&header, &output_buffer));
+  static const char kExpectedPrefix[] = "foo\0bar\0fo\0string0";
+  EXPECT_EQ(std::string(kExpectedPrefix, sizeof(kExpectedPrefix)),
+            out.str().substr(0, sizeof(kExpectedPrefix)));
+}
+
+TEST_F(BufferTest, BlocksAreRecycled) {
+  block_pool_.Reserve(1);
+  EventBlock* block = block_pool_.Allocate();
+  EXPECT_EQ(0u, block->committed.load());
+  EXPECT_EQ(nullptr, block->next.load());
+  block_pool_.Release(block);
+  EXPECT_EQ(block, block_pool_.Allocate());
+  block_pool_.Release(block);
+}
+
+TEST_F(BufferTest, ConsumeReleasesBlocksAndResumesZone) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  event_buffer.SetZone(7, "zone", nullptr, nullptr);
+  const size_t kCount = EventBlock::kCapacity + 10;
+  for (size_t i = 0; i < kCount; i++) {
+    event_buffer.AddEntry(i);
+  }
+  EXPECT_EQ(2u, block_pool_.in_use());
+
+  // Parts lead with the zone so that they can be decoded on their own.
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  EXPECT_EQ((3 + kCount) * sizeof(uint32_t), header.length);
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  event_buffer.Consume(header);
+  EXPECT_EQ(1u, block_pool_.in_use());
+  EXPECT_TRUE(event_buffer.empty());
+  EXPECT_TRUE(event_buffer.consumed());
+
+  // Nothing left to write.
+  event_buffer.PopulateHeader(&header);
+  EXPECT_EQ(0u, header.length);
+
+  event_buffer.AddEntry(42);
+  EXPECT_FALSE(event_buffer.consumed());
+  event_buffer.PopulateHeader(&header);
+  std::ostringstream resumed_out;
+  OutputBuffer resumed_output_buffer{&resumed_out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &resumed_output_buffer));
+  std::string data = resumed_out.str();
+  ASSERT_EQ(4 * sizeof(uint32_t), data.size());
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+  EXPECT_EQ(static_cast<uint32_t>(StandardEvents::GetSetZoneEvent().wire_id()),
+            words[0]);
+  EXPECT_EQ(7u, words[2]);
+  EXPECT_EQ(42u, words[3]);
+}
+
+TEST_F(BufferTest, EventsOverBudgetAreDropped) {
+  int watermark_count = 0;
+  block_pool_.set_max_blocks(2);
+  block_pool_.SetWatermark(2, [&watermark_count]() { watermark_count++; });
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+
+  const size_t kEventCount = EventBlock::kCapacity;
+  for (size_t i = 0; i < kEventCount; i++) {
+    uint32_t* entries = event_buffer.ReserveEntries(4);
+    for (size_t j = 0; j < 4; j++) {
+      entries[j] = i;
+    }
+    event_buffer.CommitEntries();
+  }
+  EXPECT_EQ(2u, block_pool_.in_use());
+  EXPECT_EQ(1, watermark_count);
+  EXPECT_EQ(kEventCount / 2, event_buffer.dropped_events());
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  EXPECT_EQ(2 * EventBlock::kCapacity * sizeof(uint32_t), header.length);
+
+  // Consuming frees up room again.
+  event_buffer.Consume(header);
+  EXPECT_EQ(1u, block_pool_.in_use());
+  uint32_t* entries = event_buffer.ReserveEntries(4);
+  memset(entries, 0, 4 * sizeof(uint32_t));
+  event_buffer.CommitEntries();
+  EXPECT_EQ(kEventCount / 2, event_buffer.dropped_events());
+  EXPECT_EQ(2u, block_pool_.in_use());
+}
+
+TEST_F(BufferTest, RingModeOverwritesOldestBlocks) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  event_buffer.SetZone(5, "ring", nullptr, nullptr);
+  event_buffer.set_ring_blocks(2);
+  const size_t kEventsPerBlock = EventBlock::kCapacity / 4;
+  for (size_t i = 0; i < 3 * kEventsPerBlock + 1; i++) {
+    uint32_t* entries = event_buffer.ReserveEntries(4);
+    for (size_t j = 0; j < 4; j++) {
+      entries[j] = i;
+    }
+    event_buffer.CommitEntries();
+  }
+  EXPECT_EQ(2u, block_pool_.in_use());
+
+  // The window starts at the oldest surviving block, after recreating the
+  // zone.
+  OutputBuffer::PartHeader header;
+  event_buffer.LockReader();
+  event_buffer.PopulateHeader(&header);
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  std::string data = out.str();
+  ASSERT_EQ((9 + EventBlock::kCapacity + 4) * sizeof(uint32_t), data.size());
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+  EXPECT_EQ(
+      static_cast<uint32_t>(StandardEvents::GetCreateZoneEvent().wire_id()),
+      words[0]);
+  EXPECT_EQ(5u, words[2]);
+  EXPECT_EQ(static_cast<uint32_t>(string_table_.GetStringId("ring")),
+            words[3]);
+  EXPECT_EQ(static_cast<uint32_t>(StandardEvents::GetSetZoneEvent().wire_id()),
+            words[6]);
+  EXPECT_EQ(2 * kEventsPerBlock, words[9]);
+  EXPECT_EQ(3 * kEventsPerBlock, words[9 + EventBlock::kCapacity]);
+
+  // Readers hold off overwrites: the buffer grows instead, and shrinks back
+  // once they are done.
+#if !defined(WTF_SINGLE_THREADED)
+  for (size_t i = 0; i < kEventsPerBlock; i++) {
+    uint32_t* entries = event_buffer.ReserveEntries(4);
+    memset(entries, 0, 4 * sizeof(uint32_t));
+    event_buffer.CommitEntries();
+  }
+  EXPECT_EQ(3u, block_pool_.in_use());
+  event_buffer.UnlockReader();
+  for (size_t i = 0; i < kEventsPerBlock; i++) {
+    uint32_t* entries = event_buffer.ReserveEntries(4);
+    memset(entries, 0, 4 * sizeof(uint32_t));
+    event_buffer.CommitEntries();
+  }
+  EXPECT_EQ(2u, block_pool_.in_use());
+#else
+  event_buffer.UnlockReader();
+#endif
+}
+
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+// Writes a mix of staged copies and spans, small and larger than a staging
+// chunk, to a temporary file and checks what lands in it.
+void CheckFileDescriptorOutput(OutputBuffer::FdMode mode) {
+  FILE* file = tmpfile();
+  ASSERT_NE(nullptr, file);
+  std::string expected;
+  {
+    OutputBuffer output_buffer{fileno(file), mode};
+    std::vector<std::string> spans;
+    for (int i = 0; i < 3000; i++) {
+      std::string copied = std::to_string(i);
+      output_buffer.Append(copied.data(), copied.size());
+      expected += copied;
+      spans.emplace_back(i % 1000 ? 7 : 100000, 'a' + i % 26);
+    }
+    for (auto& span : spans) {
+      output_buffer.AppendSpan(span.data(), span.size());
+      expected += span;
+      output_buffer.AppendUint32(0x64636261);
+      expected += "abcd";
+    }
+    output_buffer.Append(expected.data(), 3);
+    expected.append(expected, 0, 3);
+    output_buffer.Align();
+    expected.append((4 - expected.size() % 4) % 4, '\0');
+    EXPECT_TRUE(output_buffer.Flush());
+    EXPECT_TRUE(output_buffer.Close());
+  }
+
+  std::string data(expected.size() + 1, '\0');
+  rewind(file);
+  data.resize(fread(&data[0], 1, data.size(), file));
+  fclose(file);
+  EXPECT_TRUE(expected == data);
+}
+
+TEST_F(BufferTest, FlowIdsComeFromPerBufferBatches) {
+  EventBuffer first{&string_table_, &block_pool_};
+  EventBuffer second{&string_table_, &block_pool_};
+  std::vector<uint32_t> first_ids;
+  std::vector<uint32_t> second_ids;
+  for (uint32_t i = 0; i < EventBuffer::kFlowIdBatchSize + 1; i++) {
+    first_ids.push_back(first.NextFlowId());
+    second_ids.push_back(second.NextFlowId());
+  }
+  // Consecutive within a batch, and never shared between buffers.
+  for (uint32_t i = 1; i < EventBuffer::kFlowIdBatchSize; i++) {
+    EXPECT_EQ(first_ids[0] + i, first_ids[i]);
+    EXPECT_EQ(second_ids[0] + i, second_ids[i]);
+  }
+  std::vector<uint32_t> ids = first_ids;
+  ids.insert(ids.end(), second_ids.begin(), second_ids.end());
+  std::sort(ids.begin(), ids.end());
+  EXPECT_EQ(ids.end(), std::unique(ids.begin(), ids.end()));
+  EXPECT_NE(0u, ids[0]);
+}
+
+TEST_F(BufferTest, CpuBuffersTagEventsWithTheirZone) {
+  CpuEventBuffers cpu_event_buffers{&string_table_, &block_pool_, 1};
+  EventBuffer* cpu_buffer = cpu_event_buffers.at(0);
+  EXPECT_EQ(0, cpu_buffer->cpu_index());
+  EventBuffer first{&string_table_, &cpu_event_buffers};
+  EventBuffer second{&string_table_, &cpu_event_buffers};
+  first.SetZone(5, "first", nullptr, nullptr);
+  second.SetZone(6, "second", nullptr, nullptr);
+  for (EventBuffer* event_buffer : {&first, &first, &second, &first}) {
+    event_buffer->ReserveEvent(100 + event_buffer->zone_id(), 2);
+    event_buffer->CommitEntries();
+  }
+  EXPECT_TRUE(first.empty());
+
+  // Reads the buffer as pairs of wire id and zone (0 for other events),
+  // leaving out epoch events.
+  const uint32_t set_zone = StandardEvents::GetSetZoneEvent().wire_id();
+  auto read_events = [cpu_buffer, set_zone](bool consume) {
+    OutputBuffer::PartHeader header;
+    cpu_buffer->PopulateHeader(&header);
+    std::ostringstream out;
+    OutputBuffer output_buffer{&out};
+    EXPECT_TRUE(cpu_buffer->WriteTo(&header, &output_buffer));
+    if (consume) {
+      cpu_buffer->Consume(header);
+    }
+    std::string data = out.str();
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+    std::vector<uint32_t> events;
+    for (size_t i = 0; i < data.size() / sizeof(uint32_t);) {
+      if (words[i] == StandardEvents::kTimeEpochEventId) {
+        i += 3;
+      } else if (words[i] == set_zone) {
+        events.insert(events.end(), {set_zone, words[i + 2]});
+        i += 3;
+      } else {
+        events.insert(events.end(), {words[i], 0});
+        i += 2;
+      }
+    }
+    return events;
+  };
+  EXPECT_EQ((std::vector<uint32_t>{set_zone, 5, 105, 0, 105, 0, set_zone, 6,
+                                   106, 0, set_zone, 5, 105, 0}),
+            read_events(true));
+
+  // A later part starts in the zone of the last writer.
+  first.ReserveEvent(105, 2);
+  first.CommitEntries();
+  EXPECT_EQ((std::vector<uint32_t>{set_zone, 5, 105, 0}), read_events(false));
+}
+
+TEST_F(BufferTest, FileDescriptorOutputGathersSpans) {
+  CheckFileDescriptorOutput(OutputBuffer::FdMode::kWrite);
+}
+
+TEST_F(BufferTest, FileDescriptorOutputMapsFile) {
+  CheckFileDescriptorOutput(OutputBuffer::FdMode::kMap);
+}
+
+TEST_F(BufferTest, MappedFileDescriptorOutputFallsBackOnPipes) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  {
+    OutputBuffer output_buffer{fds[1], OutputBuffer::FdMode::kMap};
+    output_buffer.Append("abcd", 4);
+    EXPECT_EQ(nullptr, output_buffer.ReserveRange(4));
+    output_buffer.AppendSpan("efgh", 4);
+    EXPECT_TRUE(output_buffer.Close());
+  }
+  close(fds[1]);
+  char data[16];
+  EXPECT_EQ(8, read(fds[0], data, sizeof(data)));
+  EXPECT_EQ("abcdefgh", std::string(data, 8));
+  close(fds[0]);
+}
+#endif
+
+TEST_F(BufferTest, IncrementalStringTables) {
+  string_table_.GetStringId("a");
+  string_table_.GetStringId("b");
+  OutputBuffer::PartHeader header;
+  int end_id;
+  string_table_.PopulateHeader(&header, 0, &end_id);
+  EXPECT_EQ(4u, header.length);
+  EXPECT_EQ(2, end_id);
+
+  string_table_.GetStringId("cd");
+  int first_id = end_id;
+  string_table_.PopulateHeader(&header, first_id, &end_id);
+  EXPECT_EQ(3u, header.length);
+  EXPECT_EQ(3, end_id);
+
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  EXPECT_TRUE(string_table_.WriteTo(&header, &output_buffer, first_id));
+  EXPECT_EQ(std::string("cd\0\0", 4), out.str());
+}
+
+}  // namespace
+}  // namespace wtf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,321 @@
+#include "wtf/compact.h"
+
+#include <cstring>
+#include <sstream>
+
+#include "wtf/buffer.h"
+
+namespace wtf {
+
+namespace {
+
+constexpr uint32_t kStandardEventsPartType = 0x20002;
+constexpr uint32_t kNullArrayLength = 0xffffffff;
+
+uint32_t ZigZag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+uint32_t UnZigZag(uint32_t value) { return (value >> 1) ^ (0u - (value & 1)); }
+
+void AppendWord(std::string* output, uint32_t value) {
+  // TODO(laurenzo): Byte swap BE.
+  output->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+uint32_t LoadWord(const char* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Reads varints and bytes from a range, failing past its end.
+class CompactReader {
+ public:
+  CompactReader(const char* data, size_t size)
+      : data_(data), end_(data + size) {}
+
+  bool done() const { return data_ == end_; }
+
+  bool ReadVarint(uint32_t* value) {
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35 && data_ != end_; shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(*data_++);
+      result |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        *value = result;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool ReadBytes(size_t size, const char** bytes) {
+    if (static_cast<size_t>(end_ - data_) < size) {
+      return false;
+    }
+    *bytes = data_;
+    data_ += size;
+    return true;
+  }
+
+ private:
+  const char* data_;
+  const char* end_;
+};
+
+}  // namespace
+
+constexpr uint32_t CompactEventEncoder::kPartType;
+
+CompactEventEncoder::Layout CompactEventEncoder::GetLayout(
+    const std::string& arguments) {
+  Layout layout;
+  std::istringstream in{arguments};
+  std::string type;
+  std::string name;
+  while (in >> type >> name) {
+    if (type.find("[]") != std::string::npos) {
+      layout.push_back(kArray);
+    } else if (type == "int16") {
+      layout.push_back(kSigned16);
+    } else if (type == "int32") {
+      layout.push_back(kSigned);
+    } else if (type == "int64") {
+      // Zigzag keeps the low word of small negative values short too.
+      layout.insert(layout.end(), {kSigned, kSigned});
+    } else if (type == "uint64") {
+      layout.insert(layout.end(), {kWord, kWord});
+    } else if (type == "float32") {
+      layout.push_back(kRaw);
+    } else if (type == "float64") {
+      layout.insert(layout.end(), {kRaw, kRaw});
+    } else {
+      layout.push_back(kWord);
+    }
+  }
+  return layout;
+}
+
+void CompactEventEncoder::AppendVarint(uint32_t value) {
+  while (value >= 0x80) {
+    output_->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  output_->push_back(static_cast<char>(value));
+}
+
+bool CompactEventEncoder::Encode(const uint32_t* words, size_t count) {
+  const uint32_t* end = words + count;
+  while (words != end) {
+    if (end - words < 2) {
+      return false;
+    }
+    uint32_t wire_id = words[0];
+    auto it = layouts_->find(wire_id);
+    if (it == layouts_->end()) {
+      return false;
+    }
+    const Layout& layout = it->second;
+    AppendVarint(wire_id);
+    if (described_.insert(wire_id).second) {
+      AppendVarint(static_cast<uint32_t>(layout.size()));
+      output_->append(reinterpret_cast<const char*>(layout.data()),
+                      layout.size());
+    }
+    AppendVarint(ZigZag(static_cast<int32_t>(words[1] - previous_timestamp_)));
+    previous_timestamp_ = words[1];
+    words += 2;
+
+    for (uint8_t kind : layout) {
+      if (words == end) {
+        return false;
+      }
+      uint32_t entry = *words++;
+      switch (kind) {
+        case kSigned:
+          AppendVarint(ZigZag(static_cast<int32_t>(entry)));
+          break;
+        case kSigned16:
+          AppendVarint(ZigZag(static_cast<int16_t>(entry)));
+          break;
+        case kRaw:
+          output_->append(reinterpret_cast<const char*>(&entry),
+                          sizeof(entry));
+          break;
+        case kArray: {
+          AppendVarint(entry);
+          size_t size = entry == kNullArrayLength ? 0 : entry;
+          size_t words_left = end - words;
+          if ((size + 3) / 4 > words_left) {
+            return false;
+          }
+          output_->append(reinterpret_cast<const char*>(words), size);
+          words += (size + 3) / 4;
+          break;
+        }
+        default:
+          AppendVarint(entry);
+          break;
+      }
+    }
+  }
+  return true;
+}
+
+bool ExpandCompactEvents(const char* data, size_t size, std::string* output) {
+  static const char kNulls[OutputBuffer::kAlignment] = {0};
+  CompactReader reader{data, size};
+  std::unordered_map<uint32_t, CompactEventEncoder::Layout> layouts;
+  uint32_t timestamp = 0;
+  while (!reader.done()) {
+    uint32_t wire_id;
+    if (!reader.ReadVarint(&wire_id)) {
+      return false;
+    }
+    auto it = layouts.find(wire_id);
+    if (it == layouts.end()) {
+      uint32_t entry_count;
+      const char* kinds;
+      if (!reader.ReadVarint(&entry_count) ||
+          !reader.ReadBytes(entry_count, &kinds)) {
+        return false;
+      }
+      it = layouts
+               .emplace(wire_id,
+                        CompactEventEncoder::Layout{kinds, kinds + entry_count})
+               .first;
+    }
+    uint32_t delta;
+    if (!reader.ReadVarint(&delta)) {
+      return false;
+    }
+    timestamp += UnZigZag(delta);
+    AppendWord(output, wire_id);
+    AppendWord(output, timestamp);
+
+    for (uint8_t kind : it->second) {
+      uint32_t entry;
+      if (kind == CompactEventEncoder::kRaw) {
+        const char* bytes;
+        if (!reader.ReadBytes(sizeof(entry), &bytes)) {
+          return false;
+        }
+        output->append(bytes, sizeof(entry));
+        continue;
+      }
+      if (!reader.ReadVarint(&entry)) {
+        return false;
+      }
+      switch (kind) {
+        case CompactEventEncoder::kWord:
+          AppendWord(output, entry);
+          break;
+        case CompactEventEncoder::kSigned:
+          AppendWord(output, UnZigZag(entry));
+          break;
+        case CompactEventEncoder::kSigned16:
+          AppendWord(output, static_cast<uint16_t>(UnZigZag(entry)));
+          break;
+        case CompactEventEncoder::kArray: {
+          AppendWord(output, entry);
+          size_t length = entry == kNullArrayLength ? 0 : entry;
+          const char* bytes;
+          if (!reader.ReadBytes(length, &bytes)) {
+            return false;
+          }
+          output->append(bytes, length);
+          output->append(kNulls, (4 - length % 4) % 4);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool ExpandCompactTrace(const std::string& trace, std::string* output) {
+  static constexpr size_t kFileHeaderSize = 3 * sizeof(uint32_t);
+  static constexpr size_t kChunkHeaderSize = 6 * sizeof(uint32_t);
+  static constexpr size_t kPartHeaderSize = 3 * sizeof(uint32_t);
+  if (trace.size() < kFileHeaderSize) {
+    return false;
+  }
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  output_buffer.Append(trace.data(), kFileHeaderSize);
+
+  const char* data = trace.data();
+  size_t pos = kFileHeaderSize;
+  while (pos < trace.size()) {
+    if (trace.size() - pos < kChunkHeaderSize) {
+      return false;
+    }
+    const char* chunk = data + pos;
+    uint32_t chunk_length = LoadWord(chunk + 8);
+    uint32_t part_count = LoadWord(chunk + 20);
+    size_t parts_start = kChunkHeaderSize + part_count * kPartHeaderSize;
+    if (chunk_length > trace.size() - pos || parts_start > chunk_length) {
+      return false;
+    }
+
+    // Event parts are merged into one at the place of the first of them.
+    std::vector<OutputBuffer::PartHeader> part_headers;
+    std::vector<const char*> part_data;
+    std::string events;
+    size_t events_index = part_count;
+    for (uint32_t i = 0; i < part_count; i++) {
+      const char* part_header = chunk + kChunkHeaderSize + i * kPartHeaderSize;
+      uint32_t type = LoadWord(part_header);
+      size_t offset = parts_start + LoadWord(part_header + 4);
+      uint32_t length = LoadWord(part_header + 8);
+      if (offset > chunk_length || length > chunk_length - offset) {
+        return false;
+      }
+      if (type == kStandardEventsPartType ||
+          type == CompactEventEncoder::kPartType) {
+        if (events_index == part_count) {
+          events_index = part_headers.size();
+          part_headers.push_back({kStandardEventsPartType, 0, 0});
+          part_data.push_back(nullptr);
+        }
+        if (type == kStandardEventsPartType) {
+          events.append(chunk + offset, length);
+        } else if (!ExpandCompactEvents(chunk + offset, length, &events)) {
+          return false;
+        }
+      } else {
+        part_headers.push_back({type, 0, length});
+        part_data.push_back(chunk + offset);
+      }
+    }
+    if (events_index != part_count) {
+      part_headers[events_index].length = static_cast<uint32_t>(events.size());
+      part_data[events_index] = events.data();
+    }
+
+    OutputBuffer::ChunkHeader chunk_header{
+        LoadWord(chunk),       // Id.
+        LoadWord(chunk + 4),   // Type.
+        LoadWord(chunk + 12),  // Start time.
+        LoadWord(chunk + 16),  // End time.
+    };
+    output_buffer.StartChunk(chunk_header, part_headers.data(),
+                             part_headers.size());
+    for (size_t i = 0; i < part_headers.size(); i++) {
+      output_buffer.Append(part_data[i], part_headers[i].length);
+      output_buffer.Align();
+    }
+    pos += chunk_length;
+  }
+  if (!output_buffer.Close()) {
+    return false;
+  }
+  *output = out.str();
+  return true;
+}
+
+}  // namespace wtf
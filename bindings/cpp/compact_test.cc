@@ -0,0 +1,86 @@
+#include "wtf/compact.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wtf {
+namespace {
+
+class CompactTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    layouts_[1] = CompactEventEncoder::GetLayout("");
+    layouts_[7] = CompactEventEncoder::GetLayout(
+        "int16 a, int32 b, uint32 c, float32 d, uint8[] e");
+  }
+
+  std::string Encode(const std::vector<uint32_t>& words) {
+    std::string compact;
+    CompactEventEncoder encoder{&layouts_, &compact};
+    EXPECT_TRUE(encoder.Encode(words.data(), words.size()));
+    return compact;
+  }
+
+  std::unordered_map<uint32_t, CompactEventEncoder::Layout> layouts_;
+};
+
+TEST_F(CompactTest, LayoutFollowsArgumentTypes) {
+  EXPECT_EQ((CompactEventEncoder::Layout{
+                CompactEventEncoder::kSigned16, CompactEventEncoder::kSigned,
+                CompactEventEncoder::kWord, CompactEventEncoder::kRaw,
+                CompactEventEncoder::kArray}),
+            layouts_[7]);
+  EXPECT_EQ((CompactEventEncoder::Layout{
+                CompactEventEncoder::kSigned, CompactEventEncoder::kSigned,
+                CompactEventEncoder::kRaw, CompactEventEncoder::kRaw,
+                CompactEventEncoder::kWord}),
+            CompactEventEncoder::GetLayout(
+                "int64 a, float64 b, ascii c"));
+  EXPECT_TRUE(CompactEventEncoder::GetLayout("").empty());
+}
+
+TEST_F(CompactTest, ExpandsToTheSameWords) {
+  std::vector<uint32_t> words = {
+      // Timestamps may go back a little between threads.
+      1, 1000,
+      7, 1010, 0xffff, static_cast<uint32_t>(-5), 300, 0x3f800000,
+          5, 0x04030201, 0x05,
+      1, 1005,
+      7, 1020, 2, 0x7fffffff, 0xffffffff, 0, 0xffffffff,
+  };
+  std::string compact = Encode(words);
+  EXPECT_LT(compact.size(), words.size() * sizeof(uint32_t));
+
+  std::string expanded;
+  ASSERT_TRUE(
+      ExpandCompactEvents(compact.data(), compact.size(), &expanded));
+  ASSERT_EQ(words.size() * sizeof(uint32_t), expanded.size());
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(words.data()),
+                        expanded.size()),
+            expanded);
+}
+
+TEST_F(CompactTest, RejectsMalformedInput) {
+  std::string compact;
+  CompactEventEncoder encoder{&layouts_, &compact};
+  std::vector<uint32_t> unknown = {2, 1000};
+  EXPECT_FALSE(encoder.Encode(unknown.data(), unknown.size()));
+  std::vector<uint32_t> partial = {7, 1000, 1};
+  EXPECT_FALSE(encoder.Encode(partial.data(), partial.size()));
+
+  compact = Encode({7, 1000, 1, 2, 3, 4, 0});
+  std::string expanded;
+  EXPECT_FALSE(
+      ExpandCompactEvents(compact.data(), compact.size() - 1, &expanded));
+  EXPECT_FALSE(ExpandCompactTrace(compact, &expanded));
+}
+
+}  // namespace
+}  // namespace wtf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
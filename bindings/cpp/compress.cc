@@ -0,0 +1,193 @@
+#include "wtf/compress.h"
+
+#include <cstring>
+
+namespace wtf {
+
+namespace {
+
+// Limits of the LZ4 block format: matches are at least 4 bytes, the last 5
+// bytes are always literals and the last match starts at least 12 bytes
+// before the end.
+constexpr size_t kMinMatch = 4;
+constexpr size_t kLastLiterals = 5;
+constexpr size_t kMatchStartLimit = 12;
+constexpr size_t kMaxOffset = 65535;
+
+uint32_t Load32(const uint8_t* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Appends what is left of a length past its 4 bits in the token.
+void AppendLength(size_t length, std::string* output) {
+  for (; length >= 255; length -= 255) {
+    output->push_back(static_cast<char>(255));
+  }
+  output->push_back(static_cast<char>(length));
+}
+
+void AppendLiterals(const uint8_t* literals, size_t length, uint8_t token,
+                    std::string* output) {
+  output->push_back(static_cast<char>(token | (length < 15 ? length : 15) << 4));
+  if (length >= 15) {
+    AppendLength(length - 15, output);
+  }
+  output->append(reinterpret_cast<const char*>(literals), length);
+}
+
+bool ReadLength(const uint8_t** data, const uint8_t* end, size_t* length) {
+  for (uint8_t byte = 255; byte == 255; *length += byte) {
+    if (*data == end) {
+      return false;
+    }
+    byte = *(*data)++;
+  }
+  return true;
+}
+
+}  // namespace
+
+constexpr uint32_t Compressor::kPartType;
+
+bool Lz4Compressor::Compress(const char* data, size_t size,
+                             std::string* output) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+  size_t anchor = 0;
+  if (size > kMatchStartLimit) {
+    table_.assign(size_t{1} << kHashBits, 0);
+    const size_t match_start_limit = size - kMatchStartLimit;
+    const size_t match_end_limit = size - kLastLiterals;
+    size_t pos = 0;
+    while (pos < match_start_limit) {
+      uint32_t sequence = Load32(in + pos);
+      uint32_t hash = (sequence * 2654435761u) >> (32 - kHashBits);
+      size_t candidate = table_[hash];
+      table_[hash] = static_cast<uint32_t>(pos + 1);
+      if (!candidate || pos + 1 - candidate > kMaxOffset ||
+          Load32(in + candidate - 1) != sequence) {
+        // Skip ahead faster the longer nothing matches.
+        pos += 1 + ((pos - anchor) >> 6);
+        continue;
+      }
+      candidate -= 1;
+      size_t match_length = kMinMatch;
+      while (pos + match_length < match_end_limit &&
+             in[candidate + match_length] == in[pos + match_length]) {
+        match_length++;
+      }
+
+      size_t extra_length = match_length - kMinMatch;
+      AppendLiterals(in + anchor, pos - anchor,
+                     static_cast<uint8_t>(extra_length < 15 ? extra_length : 15),
+                     output);
+      size_t offset = pos - candidate;
+      output->push_back(static_cast<char>(offset & 0xff));
+      output->push_back(static_cast<char>(offset >> 8));
+      if (extra_length >= 15) {
+        AppendLength(extra_length - 15, output);
+      }
+      pos += match_length;
+      anchor = pos;
+    }
+  }
+  AppendLiterals(in + anchor, size - anchor, 0, output);
+  return true;
+}
+
+bool Lz4Decompress(const char* data, size_t data_size, size_t size,
+                   std::string* output) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = in + data_size;
+  const size_t start = output->size();
+  output->reserve(start + size);
+  while (in != end) {
+    uint8_t token = *in++;
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !ReadLength(&in, end, &literal_length)) {
+      return false;
+    }
+    if (literal_length > static_cast<size_t>(end - in) ||
+        literal_length > size - (output->size() - start)) {
+      return false;
+    }
+    output->append(reinterpret_cast<const char*>(in), literal_length);
+    in += literal_length;
+    if (in == end) {
+      // The last sequence has no match.
+      break;
+    }
+
+    if (end - in < 2) {
+      return false;
+    }
+    size_t offset = in[0] | in[1] << 8;
+    in += 2;
+    size_t match_length = token & 15;
+    if (match_length == 15 && !ReadLength(&in, end, &match_length)) {
+      return false;
+    }
+    match_length += kMinMatch;
+    size_t produced = output->size() - start;
+    if (!offset || offset > produced || match_length > size - produced) {
+      return false;
+    }
+    // Matches may overlap what they produce, so copy forwards.
+    size_t to = output->size();
+    output->resize(to + match_length);
+    char* bytes = &(*output)[0];
+    for (size_t i = 0; i < match_length; i++) {
+      bytes[to + i] = bytes[to - offset + i];
+    }
+  }
+  return output->size() - start == size;
+}
+
+bool DecompressTrace(const std::string& trace, std::string* output) {
+  static constexpr size_t kFileHeaderSize = 3 * sizeof(uint32_t);
+  static constexpr size_t kChunkHeaderSize = 6 * sizeof(uint32_t);
+  static constexpr size_t kCompressedHeaderSize =
+      kChunkHeaderSize + 5 * sizeof(uint32_t);
+  auto load = [&trace](size_t offset) {
+    uint32_t value;
+    memcpy(&value, trace.data() + offset, sizeof(value));
+    return value;
+  };
+  if (trace.size() < kFileHeaderSize) {
+    return false;
+  }
+  std::string result{trace, 0, kFileHeaderSize};
+  size_t pos = kFileHeaderSize;
+  while (pos < trace.size()) {
+    if (trace.size() - pos < kChunkHeaderSize) {
+      return false;
+    }
+    uint32_t chunk_length = load(pos + 8);
+    if (chunk_length < kChunkHeaderSize || chunk_length > trace.size() - pos) {
+      return false;
+    }
+    if (load(pos + 20) != 1 || chunk_length < kCompressedHeaderSize ||
+        load(pos + kChunkHeaderSize) != Compressor::kPartType) {
+      result.append(trace, pos, chunk_length);
+      pos += chunk_length;
+      continue;
+    }
+    // Part header and then the format word and original length.
+    uint32_t part_length = load(pos + kChunkHeaderSize + 8);
+    uint32_t format = load(pos + kChunkHeaderSize + 12);
+    uint32_t length = load(pos + kChunkHeaderSize + 16);
+    if (format != Compressor::kLz4 || part_length < 2 * sizeof(uint32_t) ||
+        part_length - 2 * sizeof(uint32_t) >
+            chunk_length - kCompressedHeaderSize ||
+        !Lz4Decompress(trace.data() + pos + kCompressedHeaderSize,
+                       part_length - 2 * sizeof(uint32_t), length, &result)) {
+      return false;
+    }
+    pos += chunk_length;
+  }
+  output->swap(result);
+  return true;
+}
+
+}  // namespace wtf
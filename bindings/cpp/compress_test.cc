@@ -0,0 +1,135 @@
+#include "wtf/compress.h"
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "wtf/buffer.h"
+
+namespace wtf {
+
+namespace {
+
+std::string Compress(const std::string& data) {
+  Lz4Compressor compressor;
+  std::string compressed;
+  EXPECT_TRUE(compressor.Compress(data.data(), data.size(), &compressed));
+  return compressed;
+}
+
+std::string Decompress(const std::string& compressed, size_t size) {
+  std::string data;
+  EXPECT_TRUE(Lz4Decompress(compressed.data(), compressed.size(), size, &data));
+  return data;
+}
+
+TEST(CompressTest, Lz4RoundTrips) {
+  std::string repetitive;
+  for (uint32_t i = 0; i < 10000; i++) {
+    uint32_t words[] = {7, i * 3, i % 10, 42};
+    repetitive.append(reinterpret_cast<const char*>(words), sizeof(words));
+  }
+  std::string compressed = Compress(repetitive);
+  EXPECT_LT(compressed.size(), repetitive.size() / 3);
+  EXPECT_EQ(repetitive, Decompress(compressed, repetitive.size()));
+
+  std::mt19937 random{1};
+  std::string noise;
+  for (int i = 0; i < 100000; i++) {
+    noise.push_back(static_cast<char>(random()));
+  }
+  EXPECT_EQ(noise, Decompress(Compress(noise), noise.size()));
+
+  // Short inputs are all literals, and runs make long overlapping matches.
+  for (const std::string& data :
+       {std::string(), std::string("abc"), std::string(1000, 'x')}) {
+    EXPECT_EQ(data, Decompress(Compress(data), data.size()));
+  }
+}
+
+TEST(CompressTest, Lz4RejectsMalformedBlocks) {
+  std::string data(1000, 'x');
+  std::string compressed = Compress(data);
+  std::string output;
+  EXPECT_FALSE(Lz4Decompress(compressed.data(), compressed.size(),
+                             data.size() - 1, &output));
+  output.clear();
+  EXPECT_FALSE(Lz4Decompress(compressed.data(), compressed.size() - 1,
+                             data.size(), &output));
+  // A match reaching back before the start.
+  const char kBadOffset[] = {0x10, 'a', 0x02, 0x00};
+  output.clear();
+  EXPECT_FALSE(Lz4Decompress(kBadOffset, sizeof(kBadOffset), 5, &output));
+}
+
+// Writes a file header and two chunks, the second with a part from
+// ReserveRange().
+void WriteTrace(OutputBuffer* output_buffer, Compressor* compressor) {
+  static const uint32_t kFileHeader[] = {0xdeadbeef, 1, 10};
+  output_buffer->Append(kFileHeader, sizeof(kFileHeader));
+  output_buffer->set_compressor(compressor);
+  std::string data(4096, 'a');
+  for (uint32_t id = 2; id < 4; id++) {
+    OutputBuffer::PartHeader part{0x40000, 0,
+                                  static_cast<uint32_t>(data.size() + 1)};
+    output_buffer->StartChunk(OutputBuffer::ChunkHeader{id, 2, 10, 20}, &part,
+                              1);
+    if (id == 2) {
+      output_buffer->Append(data.data(), data.size());
+      output_buffer->Append("b", 1);
+      output_buffer->Align();
+    } else {
+      char* range = output_buffer->ReserveRange(data.size() + 4);
+      ASSERT_NE(nullptr, range);
+      memcpy(range, data.data(), data.size());
+      memcpy(range + data.size(), "b\0\0\0", 4);
+    }
+  }
+  output_buffer->set_compressor(nullptr);
+  EXPECT_TRUE(output_buffer->Flush());
+}
+
+TEST(CompressTest, CompressedChunksExpandToTheOriginals) {
+  static constexpr size_t kSize = 12 + 2 * (24 + 12 + 4100);
+  std::vector<char> memory(kSize);
+  {
+    OutputBuffer output_buffer{memory.data(), memory.size()};
+    WriteTrace(&output_buffer, nullptr);
+    EXPECT_TRUE(output_buffer.Close());
+  }
+  std::string expected{memory.data(), memory.size()};
+
+  memory.assign(kSize, 0);
+  Lz4Compressor compressor;
+  OutputBuffer output_buffer{memory.data(), memory.size()};
+  WriteTrace(&output_buffer, &compressor);
+  std::string data{memory.data(), memory.size()};
+  // Each chunk now has a single compressed part.
+  uint32_t part_type;
+  memcpy(&part_type, data.data() + 12 + 24, sizeof(part_type));
+  EXPECT_EQ(Compressor::kPartType, part_type);
+
+  size_t end = 12;
+  for (int i = 0; i < 2; i++) {
+    uint32_t chunk_length;
+    memcpy(&chunk_length, data.data() + end + 8, sizeof(chunk_length));
+    end += chunk_length;
+  }
+  ASSERT_LT(end, kSize / 10);
+  std::string decompressed;
+  ASSERT_TRUE(DecompressTrace(data.substr(0, end), &decompressed));
+  EXPECT_EQ(expected, decompressed);
+
+  std::string truncated = data.substr(0, end - 4);
+  EXPECT_FALSE(DecompressTrace(truncated, &decompressed));
+}
+
+}  // namespace
+}  // namespace wtf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,19 +2,28 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
 namespace wtf {
 
 // Definitions for static type names.
-const char* ArgTypeDef<const char*>::name = "ascii";
-const char* ArgTypeDef<uint16_t>::name = "uint16";
-const char* ArgTypeDef<uint32_t>::name = "uint32";
-const char* ArgTypeDef<int16_t>::name = "int16";
-const char* ArgTypeDef<int32_t>::name = "int32";
+constexpr const char* ArgTypeDef<const char*>::name;
+constexpr const char* ArgTypeDef<StaticString>::name;
+constexpr const char* ArgTypeDef<uint16_t>::name;
+constexpr const char* ArgTypeDef<uint32_t>::name;
+constexpr const char* ArgTypeDef<int16_t>::name;
+constexpr const char* ArgTypeDef<int32_t>::name;
+constexpr const char* ArgTypeDef<FlowId>::name;
+constexpr const char* ArgTypeDef<bool>::name;
+constexpr const char* ArgTypeDef<uint64_t>::name;
+constexpr const char* ArgTypeDef<int64_t>::name;
+constexpr const char* ArgTypeDef<float>::name;
+constexpr const char* ArgTypeDef<double>::name;
+constexpr const char* ArgTypeDef<Uint8Array>::name;
 
 platform::atomic<int> EventDefinition::next_event_id_{
-    StandardEvents::kScopeLeaveEventId + 1};
+    StandardEvents::kTimeEpochEventId + 1};
 
 namespace {
 bool IsSepCharOrNull(char c) {
@@ -57,11 +66,19 @@ bool PeelArgName(const char** arg_names, const char** out_arg_name,
 }  // namespace
 
 void EventDefinition::AppendName(std::string* output) const {
+  if (signature_) {
+    output->append(signature_->name);
+    return;
+  }
   const char* colon = strchrnul(name_spec_, ':');
   output->append(name_spec_, 0, (colon - name_spec_));
 }
 
 void EventDefinition::AppendArguments(std::string* output) const {
+  if (signature_) {
+    output->append(signature_->arguments);
+    return;
+  }
   if (argument_zipper_ && name_spec_) {
     const char* arg_names = strchr(name_spec_, ':');
     if (arg_names) {
@@ -95,6 +112,88 @@ void EventDefinition::ZipArgument(std::string* output, size_t index,
   }
 }
 
+namespace {
+// Categories created so far, and the spec set with Configure().
+struct CategoryRegistry {
+  platform::mutex mu;
+  EventCategory* categories[EventCategory::kMaxCategories];
+  size_t count = 0;
+  bool configured = false;
+  std::string spec;
+
+  static CategoryRegistry* GetInstance() {
+    static CategoryRegistry* instance = new CategoryRegistry();
+    return instance;
+  }
+};
+
+// Gets whether a category is enabled after applying a spec to it.
+bool ApplyCategorySpec(const char* spec, const char* name, bool enabled) {
+  size_t name_len = strlen(name);
+  while (spec && *spec) {
+    const char* end = strchr(spec, ',');
+    size_t len = end ? end - spec : strlen(spec);
+    const char* token = spec;
+    spec = end ? end + 1 : nullptr;
+    bool enable = true;
+    if (len && *token == '-') {
+      enable = false;
+      token += 1;
+      len -= 1;
+    }
+    if ((len == 1 && *token == '*') ||
+        (len == name_len && !strncmp(token, name, len))) {
+      enabled = enable;
+    }
+  }
+  return enabled;
+}
+}  // namespace
+
+EventCategory::EnabledBits EventCategory::enabled_bits_;
+
+EventCategory::EventCategory(const char* name, bool enabled_by_default)
+    : name_(name), enabled_by_default_(enabled_by_default) {
+  CategoryRegistry* registry = CategoryRegistry::GetInstance();
+  platform::lock_guard<platform::mutex> lock{registry->mu};
+  if (registry->count == kMaxCategories) {
+    return;
+  }
+  mask_ = uint64_t(1) << registry->count;
+  registry->categories[registry->count++] = this;
+  const char* spec = registry->configured ? registry->spec.c_str()
+                                          : getenv("WTF_CATEGORIES");
+  StoreEnabled(ApplyCategorySpec(spec, name_, enabled_by_default_));
+}
+
+void EventCategory::set_enabled(bool enabled) {
+  CategoryRegistry* registry = CategoryRegistry::GetInstance();
+  platform::lock_guard<platform::mutex> lock{registry->mu};
+  StoreEnabled(enabled);
+}
+
+void EventCategory::StoreEnabled(bool enabled) {
+  uint64_t bits = enabled_bits_.bits.load(platform::memory_order_relaxed);
+  enabled_bits_.bits.store(enabled ? bits | mask_ : bits & ~mask_,
+                           platform::memory_order_relaxed);
+}
+
+void EventCategory::Configure(const char* spec) {
+  CategoryRegistry* registry = CategoryRegistry::GetInstance();
+  platform::lock_guard<platform::mutex> lock{registry->mu};
+  registry->configured = true;
+  registry->spec = spec ? spec : "";
+  uint64_t bits = 0;
+  for (size_t i = 0; i < registry->count; i++) {
+    EventCategory* category = registry->categories[i];
+    if (ApplyCategorySpec(spec, category->name_,
+                          category->enabled_by_default_)) {
+      bits |= category->mask_;
+    }
+  }
+  enabled_bits_.bits.store(bits, platform::memory_order_relaxed);
+}
+
 EventRegistry::EventRegistry() = default;
 
 EventRegistry* EventRegistry::GetInstance() {
@@ -104,16 +203,20 @@ EventRegistry* EventRegistry::GetInstance() {
 
 void EventRegistry::AddEventDefinition(EventDefinition event_definition) {
   EventRegistry* instance = GetInstance();
-  platform::lock_guard<platform::mutex> lock{instance->mu_};
-  instance->event_definitions_.push_back(event_definition);
+  Node* node = new Node{event_definition, 0, instance->head_.load()};
+  do {
+    node->index = node->next ? node->next->index + 1 : 0;
+  } while (!instance->head_.compare_exchange_strong(node->next, node));
 }
 
-std::vector<EventDefinition> EventRegistry::GetEventDefinitions() {
-  platform::lock_guard<platform::mutex> lock{mu_};
+std::vector<EventDefinition> EventRegistry::GetEventDefinitions(
+    size_t first_index) {
   std::vector<EventDefinition> r;
-  r.reserve(event_definitions_.size());
-  std::copy(event_definitions_.begin(), event_definitions_.end(),
-            std::back_inserter(r));
+  for (Node* node = head_.load(); node && node->index >= first_index;
+       node = node->next) {
+    r.push_back(node->definition);
+  }
+  std::reverse(r.begin(), r.end());
   return r;
 }
 
@@ -124,6 +227,13 @@ EventEnabled<>& StandardEvents::GetScopeLeaveEvent() {
   return event;
 }
 
+EventEnabled<uint32_t>& StandardEvents::GetTimeEpochEvent() {
+  static EventEnabled<uint32_t> event{
+      kTimeEpochEventId, EventClass::kInstance,
+      EventFlags::kBuiltin | EventFlags::kInternal, "wtf.timing#epoch:epoch"};
+  return event;
+}
+
 void StandardEvents::DefineEvent(EventBuffer* event_buffer, uint16_t wire_id,
                                  uint16_t event_class, uint32_t flags,
                                  const char* name, const char* args) {
@@ -138,22 +248,81 @@ void StandardEvents::ScopeLeave(EventBuffer* event_buffer) {
   GetScopeLeaveEvent().InvokeSpecific(event_buffer);
 }
 
-int StandardEvents::CreateZone(EventBuffer* event_buffer, const char* name,
-                               const char* type, const char* location) {
-  static platform::atomic<int> next_zone_id{1};
+EventEnabled<uint16_t, const char*, const char*, const char*>&
+StandardEvents::GetCreateZoneEvent() {
   static EventEnabled<uint16_t, const char*, const char*, const char*> event{
       EventClass::kInstance, EventFlags::kBuiltin | EventFlags::kInternal,
       "wtf.zone#create:zoneId,name,type,location"};
+  return event;
+}
+
+int StandardEvents::CreateZone(EventBuffer* event_buffer, const char* name,
+                               const char* type, const char* location) {
+  static platform::atomic<int> next_zone_id{1};
   int zone_id = next_zone_id.fetch_add(1);
-  event.InvokeSpecific(event_buffer, zone_id, name, type, location);
+  GetCreateZoneEvent().InvokeSpecific(event_buffer, zone_id, name, type,
+                                      location);
   return zone_id;
 }
 
-void StandardEvents::SetZone(EventBuffer* event_buffer, int zone_id) {
+EventEnabled<uint16_t>& StandardEvents::GetSetZoneEvent() {
   static EventEnabled<uint16_t> event{
       EventClass::kInstance, EventFlags::kBuiltin | EventFlags::kInternal,
       "wtf.zone#set:zoneId"};
-  event.InvokeSpecific(event_buffer, zone_id);
+  return event;
+}
+
+void StandardEvents::SetZone(EventBuffer* event_buffer, int zone_id) {
+  GetSetZoneEvent().InvokeSpecific(event_buffer, zone_id);
+}
+
+uint32_t StandardEvents::BranchFlow(EventBuffer* event_buffer,
+                                    const char* name, uint32_t parent_id) {
+  static EventEnabled<FlowId, FlowId, const char*> event{
+      EventClass::kInstance, EventFlags::kBuiltin | EventFlags::kInternal,
+      "wtf.flow#branch:id,parentId,name"};
+  uint32_t id = event_buffer->NextFlowId();
+  event.InvokeSpecific(event_buffer, FlowId{id}, FlowId{parent_id}, name);
+  return id;
+}
+
+void StandardEvents::ExtendFlow(EventBuffer* event_buffer, uint32_t id,
+                                const char* name) {
+  static EventEnabled<FlowId, const char*> event{
+      EventClass::kInstance, EventFlags::kBuiltin | EventFlags::kInternal,
+      "wtf.flow#extend:id,name"};
+  event.InvokeSpecific(event_buffer, FlowId{id}, name);
+}
+
+void StandardEvents::TerminateFlow(EventBuffer* event_buffer, uint32_t id) {
+  static EventEnabled<FlowId> event{
+      EventClass::kInstance, EventFlags::kBuiltin | EventFlags::kInternal,
+      "wtf.flow#terminate:id"};
+  event.InvokeSpecific(event_buffer, FlowId{id});
+}
+
+FlowHandle FlowHandle::Branch(const char* name, const FlowHandle& parent) {
+  EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+  if (!event_buffer) {
+    return FlowHandle();
+  }
+  return FlowHandle{
+      StandardEvents::BranchFlow(event_buffer, name, parent.id_)};
+}
+
+void FlowHandle::Extend(const char* name) {
+  EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+  if (id_ && event_buffer) {
+    StandardEvents::ExtendFlow(event_buffer, id_, name);
+  }
+}
+
+void FlowHandle::Terminate() {
+  EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+  if (id_ && event_buffer) {
+    StandardEvents::TerminateFlow(event_buffer, id_);
+  }
+  id_ = 0;
 }
 
 void StandardEvents::FrameStart(EventBuffer* event_buffer, uint32_t number) {
@@ -0,0 +1,104 @@
+#include "wtf/histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace wtf {
+
+constexpr size_t DurationHistogram::kBucketCount;
+constexpr size_t ScopeAggregator::kMaxDepth;
+
+uint32_t DurationHistogram::BucketLowerBound(size_t index) {
+  if (index < kSubBucketCount) {
+    return static_cast<uint32_t>(index);
+  }
+  int shift = static_cast<int>(index >> kSubBucketBits) - 1;
+  return static_cast<uint32_t>((kSubBucketCount + (index & (kSubBucketCount - 1)))
+                               << shift);
+}
+
+uint32_t DurationHistogram::BucketUpperBound(size_t index) {
+  if (index < kSubBucketCount) {
+    return static_cast<uint32_t>(index);
+  }
+  int shift = static_cast<int>(index >> kSubBucketBits) - 1;
+  return BucketLowerBound(index) + ((uint32_t{1} << shift) - 1);
+}
+
+void DurationHistogram::Add(uint32_t value, uint64_t count) {
+  if (count) {
+    AddToBucket(BucketIndex(value), count);
+    AddTotals(value * count, value);
+  }
+}
+
+void DurationHistogram::AddToBucket(size_t index, uint64_t count) {
+  buckets_[index] += count;
+  count_ += count;
+}
+
+void DurationHistogram::AddTotals(uint64_t sum, uint32_t max) {
+  sum_ += sum;
+  max_ = std::max(max_, max);
+}
+
+void DurationHistogram::Merge(const DurationHistogram& other) {
+  for (size_t i = 0; i < kBucketCount; i++) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+}
+
+uint32_t DurationHistogram::ValueAtQuantile(double fraction) const {
+  if (!count_) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(
+      std::ceil(std::min(std::max(fraction, 0.0), 1.0) * count_));
+  rank = std::max<uint64_t>(rank, 1);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBucketCount; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(BucketUpperBound(i), max_);
+    }
+  }
+  return max_;
+}
+
+ScopeAggregator::ScopeAggregator(size_t max_scopes) {
+  size_t capacity = 1;
+  while (capacity < max_scopes) {
+    capacity <<= 1;
+  }
+  // Value initialized, so all counts start at zero.
+  histograms_.reset(new Histogram[capacity]());
+  mask_ = capacity - 1;
+}
+
+void ScopeAggregator::MergeInto(
+    std::unordered_map<uint32_t, DurationHistogram>* histograms) const {
+  for (size_t i = 0; i <= mask_; i++) {
+    const Histogram& histogram = histograms_[i];
+    uint32_t wire_id = histogram.wire_id.load(platform::memory_order_acquire);
+    if (!wire_id) {
+      continue;
+    }
+    // If the owner is mid update, the totals may be a duration ahead of or
+    // behind the buckets.
+    DurationHistogram& merged = (*histograms)[wire_id];
+    for (size_t index = 0; index < DurationHistogram::kBucketCount; index++) {
+      uint32_t count =
+          histogram.buckets[index].load(platform::memory_order_relaxed);
+      if (count) {
+        merged.AddToBucket(index, count);
+      }
+    }
+    merged.AddTotals(histogram.sum.load(platform::memory_order_relaxed),
+                     histogram.max.load(platform::memory_order_relaxed));
+  }
+}
+
+}  // namespace wtf
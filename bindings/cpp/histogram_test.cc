@@ -0,0 +1,122 @@
+#include "wtf/histogram.h"
+
+#include <unordered_map>
+
+#include "gtest/gtest.h"
+
+namespace wtf {
+
+namespace {
+
+TEST(HistogramTest, BucketsAreLogLinear) {
+  size_t last_index = 0;
+  for (uint64_t value = 0; value <= UINT32_MAX; value = value * 9 / 8 + 1) {
+    size_t index = DurationHistogram::BucketIndex(static_cast<uint32_t>(value));
+    ASSERT_LT(index, DurationHistogram::kBucketCount);
+    EXPECT_GE(index, last_index);
+    last_index = index;
+    uint32_t lower = DurationHistogram::BucketLowerBound(index);
+    uint32_t upper = DurationHistogram::BucketUpperBound(index);
+    EXPECT_LE(lower, value);
+    EXPECT_GE(upper, value);
+    EXPECT_LE(upper - lower, value / DurationHistogram::kSubBucketCount);
+  }
+  EXPECT_EQ(DurationHistogram::kBucketCount - 1,
+            DurationHistogram::BucketIndex(UINT32_MAX));
+  for (size_t index = 1; index < DurationHistogram::kBucketCount; index++) {
+    EXPECT_EQ(DurationHistogram::BucketUpperBound(index - 1) + 1,
+              DurationHistogram::BucketLowerBound(index));
+  }
+}
+
+TEST(HistogramTest, QuantilesAreWithinABucket) {
+  DurationHistogram histogram;
+  EXPECT_EQ(0u, histogram.ValueAtQuantile(0.5));
+  for (uint32_t value = 1; value <= 1000; value++) {
+    histogram.Add(value);
+  }
+  EXPECT_EQ(1000u, histogram.count());
+  EXPECT_EQ(500500u, histogram.sum());
+  EXPECT_EQ(1000u, histogram.max());
+  EXPECT_EQ(1u, histogram.ValueAtQuantile(0));
+  EXPECT_EQ(1000u, histogram.ValueAtQuantile(1));
+  uint32_t median = histogram.ValueAtQuantile(0.5);
+  EXPECT_GE(median, 500u);
+  EXPECT_LE(median, 500u + 500 / DurationHistogram::kSubBucketCount);
+
+  DurationHistogram merged;
+  merged.Add(2000, 1000);
+  merged.Merge(histogram);
+  EXPECT_EQ(2000u, merged.count());
+  EXPECT_EQ(2000u, merged.max());
+  EXPECT_EQ(DurationHistogram::BucketUpperBound(
+                DurationHistogram::BucketIndex(1000)),
+            merged.ValueAtQuantile(0.5));
+}
+
+TEST(HistogramTest, AggregatorRecordsScopesByWireId) {
+  ScopeAggregator scope_aggregator{3};
+  for (int i = 0; i < 10; i++) {
+    scope_aggregator.Enter(10);
+    scope_aggregator.Enter(11);
+    scope_aggregator.Leave();
+    scope_aggregator.Leave();
+  }
+  // Wire ids that collide with those above.
+  scope_aggregator.Enter(14);
+  scope_aggregator.Enter(15);
+  scope_aggregator.Leave();
+  scope_aggregator.Leave();
+  EXPECT_EQ(0u, scope_aggregator.dropped_scopes());
+
+  std::unordered_map<uint32_t, DurationHistogram> histograms;
+  scope_aggregator.MergeInto(&histograms);
+  ASSERT_EQ(4u, histograms.size());
+  EXPECT_EQ(10u, histograms[10].count());
+  EXPECT_EQ(10u, histograms[11].count());
+  EXPECT_EQ(1u, histograms[14].count());
+  EXPECT_EQ(1u, histograms[15].count());
+  EXPECT_GE(histograms[10].sum(), histograms[11].sum());
+
+  // Merging again adds up.
+  scope_aggregator.MergeInto(&histograms);
+  EXPECT_EQ(20u, histograms[10].count());
+}
+
+TEST(HistogramTest, AggregatorDropsWhatDoesNotFit) {
+  ScopeAggregator scope_aggregator{2};
+  for (uint32_t wire_id = 10; wire_id < 13; wire_id++) {
+    scope_aggregator.Enter(wire_id);
+    scope_aggregator.Leave();
+  }
+  EXPECT_EQ(1u, scope_aggregator.dropped_scopes());
+
+  // Too deep, and then unbalanced.
+  for (size_t i = 0; i < ScopeAggregator::kMaxDepth + 5; i++) {
+    scope_aggregator.Enter(10);
+  }
+  for (size_t i = 0; i < ScopeAggregator::kMaxDepth + 5; i++) {
+    scope_aggregator.Leave();
+  }
+  EXPECT_EQ(6u, scope_aggregator.dropped_scopes());
+  scope_aggregator.Leave();
+  EXPECT_EQ(7u, scope_aggregator.dropped_scopes());
+
+  std::unordered_map<uint32_t, DurationHistogram> histograms;
+  scope_aggregator.MergeInto(&histograms);
+  EXPECT_EQ(1u + ScopeAggregator::kMaxDepth, histograms[10].count());
+
+  // A new owner starts with no open scopes.
+  scope_aggregator.Enter(10);
+  scope_aggregator.ResetStack();
+  scope_aggregator.Leave();
+  EXPECT_EQ(8u, scope_aggregator.dropped_scopes());
+}
+
+}  // namespace
+}  // namespace wtf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,17 +1,35 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_BUFFER_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_BUFFER_H_
 
+#include <cstring>
 #include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+#include "wtf/histogram.h"
 #include "wtf/platform.h"
 
 namespace wtf {
 
-// Wraps an ostream with facilities needed for generating WTF output.
+class Compressor;
+class CpuEventBuffers;
+
+// Wraps an output sink with facilities needed for generating WTF output.
+//
+// The sink is either an ostream or, on platforms with file descriptors, an
+// fd. With an fd, data is either gathered and written with writev() (spans
+// added via AppendSpan() are referenced rather than copied, and only small
+// pieces such as headers are staged), or copied straight into a shared
+// mapping of the file, which StartChunk() sizes for the whole chunk ahead of
+// its parts. Finally, the sink may be a fixed range of memory, such as a
+// range obtained from ReserveRange() for writing a part from another thread.
+//
+// Chunks may also be compressed on their way to the sink, by capturing each
+// one whole and handing it to a Compressor.
 class OutputBuffer {
  public:
   static constexpr size_t kAlignment = 4;
@@ -39,8 +57,60 @@ class OutputBuffer {
   void operator=(const OutputBuffer&) = delete;
 
   explicit OutputBuffer(std::ostream* out);
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+  enum class FdMode {
+    kWrite,
+    // fd should be a regular file opened for reading and writing. It is
+    // written from its start and truncated to the output by Close(). If
+    // the file can't be sized or mapped (e.g. a pipe), it is written as
+    // with kWrite instead.
+    kMap,
+  };
+
+  // Writes to fd, which remains owned by the caller.
+  explicit OutputBuffer(int fd, FdMode mode = FdMode::kWrite);
+#endif
+  // Writes to the size bytes at memory. Writing past them fails.
+  OutputBuffer(char* memory, size_t size);
+  // Closes the OutputBuffer.
+  ~OutputBuffer();
+
+  // Compresses each chunk started from now on with compressor (nullptr to
+  // stop), which is used by this thread only. A captured chunk is complete,
+  // and written out, at the next StartChunk(), Flush() or Close().
+  void set_compressor(Compressor* compressor);
+
+  // Appends a copy of len bytes.
   void Append(const void* m, size_t len) {
-    out_->write(static_cast<const char*>(m), len);
+    if (capturing_) {
+      Capture(m, len);
+      return;
+    }
+    if (out_) {
+      out_->write(static_cast<const char*>(m), len);
+    } else if (mapped_) {
+      CopyToMapping(m, len);
+    } else {
+      Stage(m, len);
+    }
+    written_ += len;
+  }
+
+  // Appends len bytes which must remain valid and unchanged until the next
+  // Flush(). This is the way to write large regions (whole blocks, string
+  // data) without copying them.
+  void AppendSpan(const void* m, size_t len) {
+    if (capturing_) {
+      Capture(m, len);
+      return;
+    }
+    if (out_) {
+      out_->write(static_cast<const char*>(m), len);
+    } else if (mapped_) {
+      CopyToMapping(m, len);
+    } else {
+      AddSegment(static_cast<const char*>(m), len);
+    }
     written_ += len;
   }
 
@@ -51,11 +121,9 @@ class OutputBuffer {
 
   void Align() {
     static const char kNulls[kAlignment] = {0};
-    size_t rem = written_ % kAlignment;
+    size_t rem = (capturing_ ? chunk_.size() : written_) % kAlignment;
     if (rem) {
-      rem = kAlignment - rem;
-      out_->write(kNulls, rem);
-      written_ += rem;
+      Append(kNulls, kAlignment - rem);
     }
   }
 
@@ -65,9 +133,96 @@ class OutputBuffer {
   // with proper alignment.
   void StartChunk(ChunkHeader header, PartHeader* parts, size_t part_count);
 
+  // Skips over the next len bytes of mapped or captured output, leaving them
+  // to be written separately (e.g. by another thread via an OutputBuffer over
+  // the range), and returns where they start. The range stays valid until the
+  // mapping next grows, which cannot happen within a chunk that was started
+  // via StartChunk().
+  // Returns: nullptr if the output is neither mapped nor captured, or has
+  // failed.
+  char* ReserveRange(size_t len);
+
+  // Writes out everything appended so far, after which spans passed to
+  // AppendSpan() are no longer referenced.
+  // Returns: false if the sink has failed (now or earlier).
+  bool Flush();
+
+  // Flushes and finishes up: a mapped file is unmapped and truncated to the
+  // size written. Nothing may be appended afterwards.
+  // Returns: false if the sink has failed (now or earlier).
+  bool Close();
+
  private:
+  // Gathered output is written once this many segments or staging chunks
+  // accumulate.
+  static constexpr size_t kMaxSegments = 1024;
+  static constexpr size_t kMaxStagingChunks = 16;
+  static constexpr size_t kStagingChunkSize = 64 * 1024;
+
+  struct Segment {
+    const char* data;
+    size_t len;
+  };
+
+  // Adds a span to the chunk being captured.
+  void Capture(const void* m, size_t len) {
+    chunk_.append(static_cast<const char*>(m), len);
+  }
+
+  // Compresses the captured chunk and writes it out.
+  void FinishChunk();
+
+  // Adds a span to the list of segments to write.
+  void AddSegment(const char* data, size_t len);
+
+  // Copies data into staging memory and adds it as a segment.
+  void Stage(const void* m, size_t len);
+
+  // Copies data to the mapping at the current position.
+  void CopyToMapping(const void* m, size_t len);
+
+  // Grows the mapped file to hold at least size bytes.
+  bool ReserveMapping(size_t size);
+
   size_t written_ = 0;
-  std::ostream* out_;
+  std::ostream* out_ = nullptr;
+  int fd_ = -1;
+  bool failed_ = false;
+  bool closed_ = false;
+  bool mapped_ = false;
+  char* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+  std::vector<Segment> segments_;
+  // Staging memory, in chunks so that segments can point at it.
+  std::vector<std::unique_ptr<char[]>> staging_chunks_;
+  size_t staging_chunk_count_ = 0;
+  size_t staging_offset_ = kStagingChunkSize;
+  // Chunk compression state.
+  Compressor* compressor_ = nullptr;
+  bool capturing_ = false;
+  std::string chunk_;
+  std::string compressed_;
+};
+
+// Locks a mutex for its scope, like lock_guard, and counts the times that
+// it had to wait for another thread.
+class CountingLockGuard {
+ public:
+  CountingLockGuard(const CountingLockGuard&) = delete;
+  void operator=(const CountingLockGuard&) = delete;
+
+  CountingLockGuard(platform::mutex* mu,
+                    platform::atomic<uint64_t>* contentions)
+      : mu_(mu) {
+    if (!mu_->try_lock()) {
+      contentions->fetch_add(1);
+      mu_->lock();
+    }
+  }
+  ~CountingLockGuard() { mu_->unlock(); }
+
+ private:
+  platform::mutex* mu_;
 };
 
 // Maintains canonical strings.
@@ -76,7 +231,8 @@ class OutputBuffer {
 // safe.
 //
 // Strings in WTF are common in metadata and are technically allowed in
-// regular events. Their use, however, is not optimized for the latter case.
+// regular events. Repeated strings in regular events are best looked up via
+// EventBuffer::GetStringId(), which avoids locking this table on a hit.
 class StringTable {
  public:
   // Disallow copy/assignment.
@@ -87,82 +243,620 @@ class StringTable {
   StringTable();
 
   // Get the id for a string.
-  int GetStringId(const std::string& str);
+  int GetStringId(const std::string& str) {
+    return GetStringId(str.data(), str.size(), nullptr);
+  }
 
-  // Populate the part header for this part.
+  // Get the id for a string of len bytes (which need not be nul terminated).
+  // If canonical is not null, it is set to the table's own copy of the
+  // string, which remains valid until Clear().
+  int GetStringId(const char* str, size_t len, const char** canonical);
+
+  // Populate the part header for this part, covering the strings with ids
+  // from first_id up. If end_id is not null, it is set to one past the last
+  // id covered, which is where the next incremental part should start.
   // Note that this should be called *after* any bits that may have contributed
   // to the table so that it includes at least as many strings as have been
   // referenced.
-  void PopulateHeader(OutputBuffer::PartHeader* header);
+  void PopulateHeader(OutputBuffer::PartHeader* header, int first_id = 0,
+                      int* end_id = nullptr);
 
   // Writes the string table to the OutputBuffer using a header previously
-  // computed via PopulateHeader. Note that the table may have grown since
-  // then and only the amount noted will be written.
+  // computed via PopulateHeader (with the same first_id). Note that the table
+  // may have grown since then and only the amount noted will be written.
   // Returns: Whether the table was serialized properly.
-  bool WriteTo(OutputBuffer::PartHeader* header, OutputBuffer* output_buffer);
+  bool WriteTo(OutputBuffer::PartHeader* header, OutputBuffer* output_buffer,
+               int first_id = 0);
 
-  // Clears the string table. Intended for testing.
+  // Clears the string table. Intended for testing. Any outstanding
+  // canonical pointers (and StringCaches) are invalidated.
   void Clear();
 
+  // Number of GetStringId() calls that had to wait for the lock.
+  uint64_t lock_contentions() { return lock_contentions_.load(); }
+
  private:
+  // Map key that refers to string data without owning it.
+  struct Key {
+    const char* data;
+    size_t len;
+    bool operator==(const Key& other) const {
+      return len == other.len && memcmp(data, other.data, len) == 0;
+    }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
   platform::mutex mu_;
-  std::vector<std::string> strings_;
-  std::unordered_map<std::string, int> strings_to_id_;
+  platform::atomic<uint64_t> lock_contentions_{0};
+  // Strings are held in a deque so that their data never moves, which allows
+  // map keys and canonical pointers to refer to it.
+  std::deque<std::string> strings_;
+  std::unordered_map<Key, int, KeyHash> strings_to_id_;
+  // Serialized length of all strings, including nul terminators.
+  size_t raw_length_ = 0;
+};
+
+// Small direct mapped cache of string ids in front of a StringTable. Hits
+// take no locks and make no allocations. Entries point at the table's
+// canonical copy of each string, so the cache stays valid as long as the
+// table is not cleared.
+//
+// This class is not thread safe: there is one per EventBuffer.
+class StringCache {
+ public:
+  // Disallow copy/assignment.
+  StringCache(const StringCache&) = delete;
+  void operator=(const StringCache&) = delete;
+
+  explicit StringCache(StringTable* string_table)
+      : string_table_(string_table) {}
+
+  // Gets the id of a nul terminated string.
+  int GetStringId(const char* str) {
+    // FNV-1a, computed in the same pass that finds the length.
+    uint32_t hash = 2166136261u;
+    size_t len = 0;
+    for (; str[len]; len++) {
+      hash = (hash ^ static_cast<uint8_t>(str[len])) * 16777619u;
+    }
+    Entry& entry = entries_[hash & (kSize - 1)];
+    if (entry.canonical && entry.hash == hash && entry.len == len &&
+        memcmp(entry.canonical, str, len) == 0) {
+      return entry.id;
+    }
+    return Fill(&entry, hash, str, len);
+  }
+
+  // Drops all entries.
+  void Clear();
+
+  // Number of misses, which were looked up in the table. Safe to read from
+  // any thread.
+  uint64_t lookups() {
+    return lookups_.load(platform::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr size_t kSize = 64;
+  struct Entry {
+    const char* canonical;
+    size_t len;
+    uint32_t hash;
+    int id;
+  };
+
+  // Looks up a missed string in the table and caches it.
+  int Fill(Entry* entry, uint32_t hash, const char* str, size_t len);
+
+  StringTable* string_table_;
+  Entry entries_[kSize] = {};
+  platform::atomic<uint64_t> lookups_{0};
+};
+
+// Fixed size block of raw event data. EventBuffers are a linked list of
+// these. Events never straddle a block boundary.
+//
+// A block is written by a single producer (the owning thread) and may be
+// read concurrently by a single consumer (Save or the streaming writer). The
+// producer publishes whole events by storing the committed size with release
+// semantics, and links a new block only after the previous one has received
+// its final committed size. A consumer that loads next and then committed
+// (both with acquire semantics) therefore always sees a prefix of whole
+// events.
+struct EventBlock {
+  static constexpr size_t kCapacity = 4096;
+
+  // Largest number of entries that a single event may occupy.
+  static constexpr size_t kMaxEventEntries = 256;
+
+  platform::atomic<EventBlock*> next;
+  platform::atomic<size_t> committed;
+  uint32_t entries[kCapacity];
+};
+
+// Arena of EventBlocks shared by all EventBuffers of a Runtime. Blocks are
+// carved out of large slabs and recycled when released, so that steady state
+// logging does not touch the global allocator.
+//
+// This class is thread safe.
+class EventBlockPool {
+ public:
+  // Disallow copy/assignment.
+  EventBlockPool(const EventBlockPool&) = delete;
+  void operator=(const EventBlockPool&) = delete;
+
+  EventBlockPool();
+
+  // Gets an empty block. This always succeeds, even if over budget.
+  EventBlock* Allocate();
+
+  // Gets an empty block, or nullptr if that would exceed the budget set via
+  // set_max_blocks().
+  EventBlock* TryAllocate();
+
+  // Returns a chain of blocks (linked via next) to the pool.
+  void Release(EventBlock* first);
+
+  // Ensures that at least block_count blocks are available without further
+  // slab allocation.
+  void Reserve(size_t block_count);
+
+  // Limits the number of blocks that may be in use at once via TryAllocate()
+  // (0 for no limit).
+  void set_max_blocks(size_t max_blocks);
+
+  // Sets a callback that is made, without any locks held, by every
+  // allocation that leaves at least watermark blocks in use (0 to disable).
+  void SetWatermark(size_t watermark, std::function<void()> callback);
+
+  // Number of blocks currently handed out.
+  size_t in_use();
+
+ private:
+  static constexpr size_t kBlocksPerSlab = 16;
+
+  // Allocates a new slab and adds its blocks to the free list.
+  void AllocateSlab();
+
+  // Pops a block from the free list. mu_ must be held.
+  EventBlock* PopFreeBlock();
+
+  // Makes the watermark callback if needed. mu_ must not be held.
+  void CheckWatermark(size_t in_use);
+
+  platform::mutex mu_;
+  EventBlock* free_list_ = nullptr;
+  size_t free_count_ = 0;
+  size_t in_use_ = 0;
+  size_t max_blocks_ = 0;
+  size_t watermark_ = 0;
+  std::function<void()> watermark_callback_;
+  std::vector<std::unique_ptr<EventBlock[]>> slabs_;
 };
 
 // Buffer for raw event data.
 // These buffers are not thread safe: It is expected that there will be one
-// per thread.
+// per thread, which is the only producer. The consumer side
+// (PopulateHeader(), WriteTo() and Consume()) may run on one other thread at a
+// time. The exception are the buffers of CpuEventBuffers, which any thread
+// may write whole events to through its forwarding buffer.
 class EventBuffer {
  public:
   // Disallow copy/assignment.
   EventBuffer(const EventBuffer&) = delete;
   void operator=(const EventBuffer&) = delete;
 
-  // Initialize the EventBuffer with a shared string table (must remain valid
-  // through the life of the instance).
-  explicit EventBuffer(StringTable* string_table);
+  // Initialize the EventBuffer with a shared string table and block pool
+  // (both must remain valid through the life of the instance).
+  EventBuffer(StringTable* string_table, EventBlockPool* block_pool);
+
+  // Initializes a forwarding EventBuffer, which holds no data of its own:
+  // each event reserved via ReserveEvent() goes to the buffer of the CPU
+  // that the calling thread runs on, tagged with this buffer's zone. Other
+  // per thread state (string cache, rate limit, flow ids and scope
+  // aggregator) is kept here. Only whole events may be written, and the
+  // consumer side must not be used.
+  EventBuffer(StringTable* string_table, CpuEventBuffers* cpu_event_buffers);
+  ~EventBuffer();
+
+  // Reserves count contiguous entries at the end of the buffer and returns
+  // a pointer to them. The caller must fill in all of them and then call
+  // CommitEntries() before they become visible to Save. This is the primary
+  // way that events are written: a whole event is reserved at once.
+  // If the pool is out of budget, the entries are scratch space that will
+  // never be committed, and the event is counted as dropped.
+  uint32_t* ReserveEntries(size_t count) {
+    if (tail_size_ + count > EventBlock::kCapacity && !AddBlock()) {
+      dropped_events_.store(
+          dropped_events_.load(platform::memory_order_relaxed) + 1,
+          platform::memory_order_relaxed);
+      return scratch_;
+    }
+    uint32_t* entries = tail_->entries + tail_size_;
+    tail_size_ += count;
+    return entries;
+  }
+
+  // Reserves count entries for an event and fills in the first two with the
+  // wire id and the current timestamp. The remaining entries are for the
+  // arguments. As with ReserveEntries(), CommitEntries() must follow.
+  uint32_t* ReserveEvent(uint32_t wire_id, size_t count) {
+    // Counted only by the CPU buffer that stores it.
+    if (cpu_event_buffers_) {
+      return ReserveEventOnCpu(wire_id, count);
+    }
+    events_written_.store(
+        events_written_.load(platform::memory_order_relaxed) + 1,
+        platform::memory_order_relaxed);
+#if defined(WTF_64BIT_TIMESTAMPS)
+    return ReserveEventAt(wire_id, count, PlatformGetTimestampMicros64());
+#else
+    uint32_t* entries = ReserveEntries(count);
+    entries[0] = wire_id;
+    entries[1] = PlatformGetTimestampMicros32();
+    return entries;
+#endif
+  }
+
+#if defined(WTF_64BIT_TIMESTAMPS)
+  // In 64bit timestamp mode, events still carry the low 32 bits of their
+  // timestamp. The high 32 bits (the epoch) are carried by wtf.timing#epoch
+  // events, which are emitted whenever the epoch changes and at the start
+  // of every block, so that each block can be decoded on its own.
+  uint32_t* ReserveEventAt(uint32_t wire_id, size_t count,
+                           uint64_t timestamp) {
+    uint32_t epoch = static_cast<uint32_t>(timestamp >> 32);
+    if (epoch != epoch_.load(platform::memory_order_relaxed)) {
+      // Stored ahead of the epoch event so that a consumer reading it after
+      // the data never sees an epoch older than that data.
+      epoch_.store(epoch, platform::memory_order_relaxed);
+      uint32_t* entries = ReserveEntries(kEpochEntryCount);
+      WriteEpochEvent(entries, epoch);
+      CommitEntries();
+    }
+    uint32_t* entries = ReserveEntries(count);
+    entries[0] = wire_id;
+    entries[1] = static_cast<uint32_t>(timestamp);
+    return entries;
+  }
+
+  // Gets the full timestamp of the earliest event in the buffer. It is safe
+  // to call this concurrently with the owning thread.
+  // Returns: false if the buffer holds no events.
+  bool GetFirstTimestamp(uint64_t* timestamp);
+#endif
+
+  // Publishes all entries reserved so far. This should be called once per
+  // event so that readers only ever observe whole events.
+  void CommitEntries() {
+    if (locked_cpu_buffer_) {
+      // Forwarding: publish the event and let other threads of the CPU in.
+      EventBuffer* cpu_buffer = locked_cpu_buffer_;
+      locked_cpu_buffer_ = nullptr;
+      cpu_buffer->CommitEntries();
+      cpu_buffer->write_mu_.unlock();
+      return;
+    }
+    tail_->committed.store(tail_size_, platform::memory_order_release);
+  }
 
-  // Adds an entry to the end of the deque.
-  // TODO(laurenzo): This will need to change to an atomic operation/data
-  // structure before it is useful for any level of concurrency without
-  // hazzards trying to dump the data.
-  void AddEntry(uint32_t entry) { entries_.push_back(entry); }
+  // Adds and commits a single entry to the end of the buffer.
+  void AddEntry(uint32_t entry) {
+    *ReserveEntries(1) = entry;
+    CommitEntries();
+  }
 
   // Gets the string table for this buffer.
   StringTable* string_table() { return string_table_; }
 
+  // Gets the id of a string via this buffer's cache of the string table.
+  int GetStringId(const char* str) { return string_cache_.GetStringId(str); }
+
+  // Overhead accounting, which may be read from any thread: events reserved
+  // via ReserveEvent() and stored in this buffer (none for a forwarding
+  // buffer), blocks taken from the pool, memory held in blocks and strings
+  // that missed the string cache.
+  uint64_t events_written() {
+    return events_written_.load(platform::memory_order_relaxed);
+  }
+  uint64_t block_allocations() {
+    return block_allocations_.load(platform::memory_order_relaxed);
+  }
+  size_t bytes_held() {
+    return block_pool_ ? block_count_.load() * sizeof(EventBlock) : 0;
+  }
+  uint64_t string_table_lookups() { return string_cache_.lookups(); }
+
+  // The CPU buffers that a forwarding buffer writes to (nullptr if this is
+  // not a forwarding buffer).
+  CpuEventBuffers* cpu_event_buffers() { return cpu_event_buffers_; }
+
+  // The index of this buffer within CpuEventBuffers, or -1 if it is not a
+  // CPU buffer.
+  int cpu_index() { return cpu_index_; }
+
+  // The zone that this buffer's events belong to (0 if none). When set, each
+  // part written via WriteTo() starts by setting the zone, so that the
+  // buffer's data may be split across chunks. If the event creating the zone
+  // has been overwritten in ring mode, it is repeated as well.
+  int zone_id() { return zone_id_; }
+  const std::string& zone_name() { return zone_name_; }
+  void SetZone(int zone_id, const char* name, const char* type,
+               const char* location);
+
+  // Puts the buffer in ring (flight recorder) mode, where it holds at most
+  // max_blocks blocks (at least 2) and overwrites the oldest block once
+  // full. Whole blocks are dropped, so the remaining data still starts on an
+  // event boundary. Must be called from the owning thread.
+  void set_ring_blocks(size_t max_blocks) {
+    ring_blocks_ = max_blocks < 2 ? 2 : max_blocks;
+  }
+
+  // Holds off ring mode overwrites while locked, so that data covered by a
+  // header from PopulateHeader() is still intact for WriteTo(). The owning
+  // thread never waits on this: it grows the buffer past its ring size
+  // instead. Consumers must hold it from PopulateHeader() through WriteTo()
+  // and Consume().
+  void LockReader() { read_mu_.lock(); }
+  void UnlockReader() { read_mu_.unlock(); }
+
+  // Whether the buffer is subject to the block pool's budget (the default).
+  void set_bounded(bool bounded) { bounded_ = bounded; }
+
+  // Number of events dropped because the block pool was out of budget.
+  uint32_t dropped_events() {
+    return dropped_events_.load(platform::memory_order_relaxed);
+  }
+
+  // Limits sampled events (see EventSampler) to events_per_second, allowing
+  // bursts of up to burst events. 0 removes the limit (the default). Must be
+  // called from the owning thread.
+  void set_rate_limit(uint32_t events_per_second, uint32_t burst);
+
+  // Takes a token from the rate limit's bucket. While tokens remain, this
+  // is a single counter check.
+  // Returns: false if the event should be dropped.
+  bool TakeRateToken() {
+    if (rate_tokens_) {
+      rate_tokens_ -= 1;
+      return true;
+    }
+    return RefillRateTokens();
+  }
+
+  // Number of sampled events dropped by the rate limit.
+  uint32_t rate_limited_events() {
+    return rate_limited_events_.load(platform::memory_order_relaxed);
+  }
+
+  // Allocates a flow id (see FlowHandle), never 0. Each buffer takes ids
+  // from a batch of kFlowIdBatchSize that it reserves from a shared counter,
+  // so that threads only touch the counter's cache line once per batch.
+  // Must be called from the owning thread.
+  static constexpr uint32_t kFlowIdBatchSize = 256;
+  uint32_t NextFlowId() {
+    if (next_flow_id_ == flow_id_batch_end_) {
+      ReserveFlowIds();
+    }
+    return next_flow_id_++;
+  }
+
+  // The aggregator that scopes record their durations in instead of
+  // emitting enter and leave events (nullptr, the default, to emit them).
+  // It is kept by Reset(), so that the durations recorded by exited threads
+  // still count. The setter must be called before the buffer is handed to
+  // its thread.
+  ScopeAggregator* scope_aggregator() { return scope_aggregator_.get(); }
+  void set_scope_aggregator(std::unique_ptr<ScopeAggregator> scope_aggregator) {
+    scope_aggregator_ = std::move(scope_aggregator);
+  }
+  std::unique_ptr<ScopeAggregator> ReleaseScopeAggregator() {
+    return std::move(scope_aggregator_);
+  }
+
   // When the thread owning an EventBuffer dies, it may call this method,
-  // which will allow the system to release the EventBuffer.
+  // which will allow the system to release the EventBuffer. It must not log
+  // to the buffer afterwards.
   void MarkOutOfScope() { out_of_scope_.store(true); }
+  bool out_of_scope() { return out_of_scope_.load(); }
+
+  // Whether everything committed has been consumed. Like Consume(), this is
+  // for the consumer side.
+  bool consumed() {
+    return !head_->next.load(platform::memory_order_acquire) &&
+           head_->committed.load(platform::memory_order_acquire) ==
+               head_offset_;
+  }
 
-  // Populate the part header for this part.
-  void PopulateHeader(OutputBuffer::PartHeader* header);
+  // Readies a buffer whose thread is out of scope, and whose data has been
+  // consumed, for use by another thread: the zone, ring mode, rate limit,
+  // drop, event and block allocation counts, open aggregated scopes and out
+  // of scope mark are cleared, while the head block, string cache and scope
+  // aggregator are kept. The consumer side must hold the reader lock.
+  void Reset();
+
+  // A point in the buffer's data: the number of entries committed before
+  // it, the epoch in effect there (with WTF_64BIT_TIMESTAMPS) and, in a CPU
+  // buffer, the zone of the last writer.
+  struct Position {
+    uint64_t entries = 0;
+    uint32_t epoch = 0xffffffff;
+    int zone_id = 0;
+  };
+
+  // Populate the part header for this part, covering everything that has
+  // not been consumed. This may be called from any thread while the owning
+  // thread continues to log and snapshots a length that ends on an event
+  // boundary.
+  // If from is given, the part resumes from where an earlier one ended
+  // instead (or from the first unconsumed entry, if that has since been
+  // consumed or overwritten). If end is given, it is set to where the part
+  // ends (from and end may be the same).
+  void PopulateHeader(OutputBuffer::PartHeader* header,
+                      const Position* from = nullptr,
+                      Position* end = nullptr);
 
   // Writes the EventBuffer to the OutputBuffer using a header previously
   // populated via PopulateHeader(). Note that the buffer may have grown
   // since the time of PopulateHeader() and only the amount noted there will
-  // be written.
-  // NOTE: No verification is done to ensure that the buffer is in a
-  // consistent state. In general, it should be assumed that full transactions
-  // are present but there may be unbalanced enter/leaves.
+  // be written. Like PopulateHeader(), this is safe to call concurrently
+  // with the owning thread and takes no locks.
+  // NOTE: Whole events are always written, but there may be unbalanced
+  // enter/leaves.
   // Returns: Whether the buffer was serialized properly.
   bool WriteTo(OutputBuffer::PartHeader* header, OutputBuffer* output_buffer);
 
+  // Marks the data covered by a header previously populated via
+  // PopulateHeader() (without a from position) as consumed, so that it is
+  // not written again. Blocks that have been entirely consumed are returned
+  // to the pool.
+  void Consume(const OutputBuffer::PartHeader& header);
+
   // Whether the event buffer is empty. It is only valid to call this from the
   // hosting thread. Mainly for testing.
-  bool empty() { return entries_.empty(); }
+  bool empty() { return head_ == tail_ && tail_size_ == head_offset_; }
 
   // Clears the event buffer. This will most likely corrupt the WTF output
   // but can be useful for testing. It is only valid to call this from the
   // hosting thread.
-  void clear() { entries_.clear(); }
+  void clear();
 
  private:
-  static constexpr size_t kInitialSize = 1024;
+  friend class CpuEventBuffers;
+
+  // Maximum size of the prefix written ahead of the data by WriteTo():
+  // epoch, zone creation and zone set events.
+  static constexpr size_t kMaxPrefixEntries = 12;
+  static constexpr size_t kZoneCreateEntryCount = 6;
+
+  // Appends a fresh block and makes it the tail. In ring mode, this reuses
+  // the oldest block once the buffer is full.
+  // Returns: false if the pool is out of budget.
+  bool AddBlock();
+
+  // Detaches and returns the oldest block. read_mu_ must be held.
+  EventBlock* EvictHeadBlock();
+
+  // Starts a new batch of flow ids.
+  void ReserveFlowIds();
+
+  // Locks the buffer of the current CPU and reserves an event in it, after
+  // switching it to this buffer's zone. CommitEntries() unlocks it.
+  uint32_t* ReserveEventOnCpu(uint32_t wire_id, size_t count);
+
+  // Emits a wtf.zone#set event if the last event written to this CPU buffer
+  // was from another zone. write_mu_ must be held.
+  void SwitchWriterZone(int zone_id);
+
+  // Adds the tokens accrued since the last refill and takes one.
+  // Returns: false if there were none.
+  bool RefillRateTokens();
+
   StringTable* string_table_;
-  std::deque<uint32_t> entries_{kInitialSize};
+  StringCache string_cache_;
+  EventBlockPool* block_pool_;
+  EventBlock* tail_;
+  // Reserved size of the tail block. Only accessed by the owning thread.
+  size_t tail_size_ = 0;
+  int zone_id_ = 0;
+  std::string zone_name_;
+  uint32_t zone_create_[kZoneCreateEntryCount];
+  bool bounded_ = true;
+  size_t ring_blocks_ = 0;
+  platform::atomic<size_t> block_count_{1};
+  platform::atomic<uint32_t> dropped_events_{0};
+  platform::atomic<uint64_t> events_written_{0};
+  platform::atomic<uint64_t> block_allocations_{0};
   platform::atomic<bool> out_of_scope_{false};
+  uint32_t scratch_[EventBlock::kMaxEventEntries];
+
+  // Rate limit token bucket. Only accessed by the owning thread.
+  static constexpr uint32_t kUnlimitedRateTokens = 0xffffffff;
+  uint32_t rate_tokens_ = kUnlimitedRateTokens;
+  uint32_t rate_per_second_ = 0;
+  uint32_t rate_burst_ = 0;
+  uint64_t rate_refill_time_ = 0;
+  platform::atomic<uint32_t> rate_limited_events_{0};
+
+  std::unique_ptr<ScopeAggregator> scope_aggregator_;
+
+  // Forwarding state: the CPU buffers, and the one locked by the event
+  // being written. Only accessed by the owning thread.
+  CpuEventBuffers* cpu_event_buffers_ = nullptr;
+  EventBuffer* locked_cpu_buffer_ = nullptr;
+
+  // CPU buffer state. Writers hold write_mu_ from reserving an event until
+  // committing it. writer_zone_ is stored ahead of the wtf.zone#set event
+  // announcing it, like epoch_.
+  int cpu_index_ = -1;
+  platform::mutex write_mu_;
+  platform::atomic<int> writer_zone_{0};
+  // Zone in effect at head_offset_ and as of the last PopulateHeader().
+  int head_zone_ = 0;
+  int snapshot_zone_ = 0;
+
+  // Flow ids left in the current batch. Only accessed by the owning thread.
+  uint32_t next_flow_id_ = 0;
+  uint32_t flow_id_batch_end_ = 0;
+
+  // Consumer state: the first unconsumed entry, and the prefix computed by
+  // the last PopulateHeader(). In ring mode, the owning thread also moves
+  // the head, with read_mu_ held.
+  platform::mutex read_mu_;
+  EventBlock* head_;
+  size_t head_offset_ = 0;
+  // Position of the head, counting consumed and overwritten entries.
+  uint64_t head_entries_ = 0;
+  // Where the data covered by the last PopulateHeader() starts.
+  EventBlock* snapshot_block_;
+  size_t snapshot_offset_ = 0;
+  // Whether the head of the data has been overwritten in ring mode.
+  bool evicted_ = false;
+  uint32_t prefix_[kMaxPrefixEntries];
+  size_t prefix_size_ = 0;
+
+#if defined(WTF_64BIT_TIMESTAMPS)
+  static constexpr size_t kEpochEntryCount = 3;
+  static constexpr uint32_t kNoEpoch = 0xffffffff;
+
+  // Writes a wtf.timing#epoch event.
+  static void WriteEpochEvent(uint32_t* entries, uint32_t epoch);
+
+  platform::atomic<uint32_t> epoch_{kNoEpoch};
+  // Epoch in effect at head_offset_ and as of the last PopulateHeader().
+  uint32_t head_epoch_ = kNoEpoch;
+  uint32_t snapshot_epoch_ = kNoEpoch;
+#endif
+};
+
+// EventBuffers shared by the threads that run on each CPU, so that the
+// number of buffers (and the memory and save time that they take) follows
+// the core count rather than the thread count. Threads write to them through
+// forwarding EventBuffers, which lock the buffer of the CPU that they run on
+// for the duration of each event. A thread that migrates in between simply
+// takes the lock from its new CPU. Whenever a thread writes to a buffer
+// after a thread of another zone, a wtf.zone#set event is emitted first, so
+// that every event stays attributed to its thread.
+//
+// This class is thread safe.
+class CpuEventBuffers {
+ public:
+  // Disallow copy/assignment.
+  CpuEventBuffers(const CpuEventBuffers&) = delete;
+  void operator=(const CpuEventBuffers&) = delete;
+
+  // Creates a buffer for each of cpu_count CPUs. Threads running on CPUs with
+  // higher indices share the buffers modulo cpu_count.
+  CpuEventBuffers(StringTable* string_table, EventBlockPool* block_pool,
+                  size_t cpu_count);
+
+  size_t size() { return event_buffers_.size(); }
+  EventBuffer* at(size_t index) { return event_buffers_[index].get(); }
+
+ private:
+  std::vector<std::unique_ptr<EventBuffer>> event_buffers_;
 };
 
 }  // namespace wtf
@@ -0,0 +1,80 @@
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_COMPACT_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_COMPACT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace wtf {
+
+// Encodes events into compact event parts.
+//
+// Standard event parts (type 0x20002) hold each event as words: its wire id,
+// its timestamp and then its argument entries (an array being a length word
+// followed by its elements, padded to a word). A compact event part holds
+// the same events as a byte stream, each made up of:
+//   - The wire id as an unsigned LEB128 varint. The first time a wire id
+//     appears in a part, it is followed by the event's layout: the varint
+//     count of its argument entries and one ArgKind byte per entry.
+//   - The zigzag varint of the (wrapping) difference between the timestamp
+//     and that of the previous event in the part.
+//   - Each argument entry, encoded as its ArgKind says.
+// A part thus decodes on its own, without the event definitions. Tools that
+// only know standard parts can be given the output of ExpandCompactTrace().
+class CompactEventEncoder {
+ public:
+  static constexpr uint32_t kPartType = 0x20003;
+
+  enum ArgKind : uint8_t {
+    // Unsigned varint.
+    kWord = 0,
+    // Zigzag varint of the entry as an int32_t.
+    kSigned = 1,
+    // Zigzag varint of the entry as an int16_t.
+    kSigned16 = 2,
+    // The 4 bytes of the entry, as is (floats gain nothing from varints).
+    kRaw = 3,
+    // Varint length (0xffffffff for null) followed by the unpadded bytes.
+    kArray = 4,
+  };
+  using Layout = std::vector<uint8_t>;
+
+  // Gets the layout of events with the given argument signature, as written
+  // by EventDefinition::AppendArguments().
+  static Layout GetLayout(const std::string& arguments);
+
+  // Appends to output, using the layouts of events by wire id.
+  CompactEventEncoder(const std::unordered_map<uint32_t, Layout>* layouts,
+                      std::string* output)
+      : layouts_(layouts), output_(output) {}
+
+  // Encodes count words of whole events.
+  // Returns: false if an event has no layout or is cut short.
+  bool Encode(const uint32_t* words, size_t count);
+
+ private:
+  void AppendVarint(uint32_t value);
+
+  const std::unordered_map<uint32_t, Layout>* layouts_;
+  std::string* output_;
+  uint32_t previous_timestamp_ = 0;
+  // Wire ids whose layout has been written.
+  std::unordered_set<uint32_t> described_;
+};
+
+// Decodes a compact event part, appending the standard event words to output.
+// Returns: false if the part is malformed.
+bool ExpandCompactEvents(const char* data, size_t size, std::string* output);
+
+// Rewrites a trace so that each chunk's event parts, compact or not, are
+// merged into one standard event part, which is how Runtime writes chunks
+// without compact encoding. Other parts are kept as they are.
+// Returns: false if the trace is malformed.
+bool ExpandCompactTrace(const std::string& trace, std::string* output);
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_COMPACT_H_
@@ -0,0 +1,66 @@
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_COMPRESS_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_COMPRESS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wtf {
+
+// Compresses whole chunks on their way out of an OutputBuffer (see
+// OutputBuffer::set_compressor()).
+//
+// A compressed chunk keeps the id, type and times of the original chunk and
+// has a single part of type kPartType, made up of the format word, the
+// length of the original chunk, and the compressed original chunk (its
+// header included). Chunks that do not shrink are written as they are.
+class Compressor {
+ public:
+  static constexpr uint32_t kPartType = 0x50000;
+
+  // Formats known to readers. Other implementations should pick values
+  // from kFirstCustomFormat up.
+  enum Format : uint32_t {
+    // The LZ4 block format.
+    kLz4 = 1,
+    kFirstCustomFormat = 0x100,
+  };
+
+  virtual ~Compressor() = default;
+
+  // The format word of chunks from this compressor.
+  virtual uint32_t format() const = 0;
+
+  // Appends size bytes at data to output, compressed.
+  // Returns: false if the data could not be compressed.
+  virtual bool Compress(const char* data, size_t size, std::string* output) = 0;
+};
+
+// Greedy LZ4 block compressor: fast, and matching repeated wire ids and
+// arguments makes up most of the gain on event data. Not thread safe.
+class Lz4Compressor : public Compressor {
+ public:
+  uint32_t format() const override { return kLz4; }
+  bool Compress(const char* data, size_t size, std::string* output) override;
+
+ private:
+  static constexpr int kHashBits = 14;
+
+  // Positions (plus one) of recently seen 4 byte sequences, by hash.
+  std::vector<uint32_t> table_;
+};
+
+// Decompresses an LZ4 block that expands to size bytes, appending them to
+// output.
+// Returns: false if the block is malformed.
+bool Lz4Decompress(const char* data, size_t data_size, size_t size,
+                   std::string* output);
+
+// Rewrites a trace with each LZ4 compressed chunk replaced by the original.
+// Returns: false if the trace is malformed or uses another format.
+bool DecompressTrace(const std::string& trace, std::string* output);
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_COMPRESS_H_
@@ -14,6 +14,14 @@ constexpr bool kMasterEnable = false;
 
 }  // namespace wtf
 
+// Define WTF_CONSTEXPR_SIGNATURES (C++17 only) for the tracing macros to
+// build event names and argument signatures at compile time, rejecting
+// malformed name specs (see StaticSignature). Name specs must then be string
+// literals.
+#if defined(WTF_CONSTEXPR_SIGNATURES) && __cplusplus < 201703L
+#error "WTF_CONSTEXPR_SIGNATURES requires C++17"
+#endif
+
 // Whether WTF is enabled for a namespace. Macros condition based on this,
 // which if undefined for a namespace, defaults to this global.
 constexpr bool kWtfEnabledForNamespace = ::wtf::kMasterEnable;
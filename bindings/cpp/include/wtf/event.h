@@ -1,8 +1,12 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_EVENT_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_EVENT_H_
 
+#include <array>
+#include <cstring>
 #include <functional>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "wtf/buffer.h"
 #include "wtf/config.h"
@@ -22,47 +26,463 @@ enum class EventClass {
 // Flags that can be passed to events.
 struct EventFlags {
   // Flags passed to built-in events. Omitted the ones we don't use.
+  static constexpr int kHighFrequency = 1 << 1;
   static constexpr int kInternal = 1 << 3;
   static constexpr int kBuiltin = 1 << 5;
+
+  // Sampled events carry their sample period (one in that many invocations
+  // is recorded) in the upper bits, so that counts can be scaled back up.
+  static constexpr int kSamplePeriodShift = 16;
+  static constexpr uint32_t kMaxSamplePeriod = 0x7fff;
+
+  // Flags of an event sampled once every sample_period invocations.
+  static constexpr int Sampled(uint32_t sample_period) {
+    return kHighFrequency |
+           static_cast<int>((sample_period > kMaxSamplePeriod
+                                 ? kMaxSamplePeriod
+                                 : sample_period ? sample_period : 1)
+                            << kSamplePeriodShift);
+  }
+};
+
+// String argument with static storage duration (typically a string literal),
+// which is interned by address rather than by content. Each event caches the
+// id of the last StaticString it saw in each such argument position, so a
+// repeat invocation with the same literal resolves with a pointer compare.
+// It is serialized exactly like a const char* argument.
+//
+// Example:
+//   WTF_EVENT("Worker#state: name", wtf::StaticString)("running");
+struct StaticString {
+  constexpr StaticString(const char* value) : value(value) {}  // NOLINT
+  const char* value;
+};
+
+// Per-event cache of the id for a StaticString argument. A sequence lock
+// keeps concurrent invocations from ever observing a torn pointer/id pair:
+// the slot is only updated by a writer that wins the sequence, and readers
+// that race with an update simply miss.
+class StaticStringSlot {
+ public:
+  bool Lookup(const char* value, int* id) {
+    uint32_t sequence = sequence_.load(platform::memory_order_acquire);
+    if (sequence & 1) {
+      return false;
+    }
+    const char* cached_value = value_.load(platform::memory_order_relaxed);
+    int cached_id = id_.load(platform::memory_order_relaxed);
+    platform::atomic_thread_fence(platform::memory_order_acquire);
+    if (cached_value != value ||
+        sequence_.load(platform::memory_order_relaxed) != sequence) {
+      return false;
+    }
+    *id = cached_id;
+    return true;
+  }
+
+  void Store(const char* value, int id) {
+    uint32_t sequence = sequence_.load(platform::memory_order_relaxed);
+    if ((sequence & 1) ||
+        !sequence_.compare_exchange_strong(sequence, sequence + 1,
+                                           platform::memory_order_acquire)) {
+      return;  // Another thread is updating the slot.
+    }
+    value_.store(value, platform::memory_order_relaxed);
+    id_.store(id, platform::memory_order_relaxed);
+    sequence_.store(sequence + 2, platform::memory_order_release);
+  }
+
+ private:
+  platform::atomic<uint32_t> sequence_{0};
+  platform::atomic<const char*> value_{nullptr};
+  platform::atomic<int> id_{0};
 };
 
-// ArgTypeDef for each supported type provides the WTF type name and a
-// function for emitting values of the type.
+// Counts the StaticString arguments in a list of argument types.
+template <typename... ArgTypes>
+struct StaticStringCount {
+  static constexpr size_t value = 0;
+};
+template <typename FirstType, typename... ArgTypes>
+struct StaticStringCount<FirstType, ArgTypes...> {
+  static constexpr size_t value =
+      (std::is_same<FirstType, StaticString>::value ? 1 : 0) +
+      StaticStringCount<ArgTypes...>::value;
+};
+
+// Byte string argument, emitted inline as a length followed by the bytes
+// zero padded to a whole number of entries. A null data pointer is written
+// as a null array. Values longer than the event has room for are truncated
+// (see EventIf::kMaxVariableBytes).
+//
+// Example:
+//   WTF_EVENT("Net#packet: bytes", wtf::Uint8Array)({data, size});
+struct Uint8Array {
+  Uint8Array(const void* data, size_t size)
+      : data(static_cast<const uint8_t*>(data)), size(size) {}
+  const uint8_t* data;
+  size_t size;
+};
+
+// Flow id argument, see FlowHandle. 0 is no flow.
+struct FlowId {
+  uint32_t value;
+};
+
+// ArgTypeDef for each supported type provides the WTF type name, the number
+// of entries occupied by a value (kEntries), and a function for emitting
+// values of the type into entries which have already been reserved in the
+// EventBuffer by the time Emit is called. Variable sized types occupy
+// kEntries plus however many more EntryCount() reports for a value.
 template <typename ArgType>
 struct ArgTypeDef {};
+
+// Base of the ArgTypeDefs of types occupying a fixed number of entries.
+template <size_t kEntryCount>
+struct FixedSizeArgTypeDef {
+  static constexpr size_t kEntries = kEntryCount;
+  static constexpr bool kVariableSize = false;
+  template <typename T>
+  static constexpr size_t EntryCount(const T&, size_t max_size) {
+    return kEntries;
+  }
+};
+
+template <>
+struct ArgTypeDef<const char*> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "ascii";
+  static void Emit(EventBuffer* b, uint32_t* entry, const char* value) {
+    *entry = value ? b->GetStringId(value) : StringTable::kEmptyStringId;
+  }
+};
 template <>
-struct ArgTypeDef<const char*> {
-  static const char* name;
-  static void Emit(EventBuffer* b, const char* value) {
-    int string_id = value ? b->string_table()->GetStringId(value)
-                          : StringTable::kEmptyStringId;
-    b->AddEntry(string_id);
+struct ArgTypeDef<StaticString> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "ascii";
+  static void Emit(EventBuffer* b, uint32_t* entry, StaticStringSlot* slot,
+                   StaticString value) {
+    int string_id;
+    if (!value.value) {
+      string_id = StringTable::kEmptyStringId;
+    } else if (!slot->Lookup(value.value, &string_id)) {
+      string_id = b->GetStringId(value.value);
+      slot->Store(value.value, string_id);
+    }
+    *entry = string_id;
+  }
+};
+template <>
+struct ArgTypeDef<FlowId> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "flowId";
+  static void Emit(EventBuffer*, uint32_t* entry, FlowId value) {
+    *entry = value.value;
+  }
+};
+template <>
+struct ArgTypeDef<bool> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "bool";
+  static void Emit(EventBuffer*, uint32_t* entry, bool value) {
+    *entry = value ? 1 : 0;
+  }
+};
+template <>
+struct ArgTypeDef<uint16_t> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "uint16";
+  static void Emit(EventBuffer*, uint32_t* entry, uint16_t value) {
+    *entry = value;
+  }
+};
+template <>
+struct ArgTypeDef<uint32_t> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "uint32";
+  static void Emit(EventBuffer*, uint32_t* entry, uint32_t value) {
+    *entry = value;
+  }
+};
+template <>
+struct ArgTypeDef<int16_t> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "int16";
+  static void Emit(EventBuffer*, uint32_t* entry, uint16_t value) {
+    *entry = value;
   }
 };
 template <>
-struct ArgTypeDef<uint16_t> {
-  static const char* name;
-  static void Emit(EventBuffer* b, uint16_t value) { b->AddEntry(value); }
+struct ArgTypeDef<int32_t> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "int32";
+  static void Emit(EventBuffer*, uint32_t* entry, uint32_t value) {
+    *entry = value;
+  }
+};
+// 64 bit values occupy two entries, low word first.
+template <>
+struct ArgTypeDef<uint64_t> : FixedSizeArgTypeDef<2> {
+  static constexpr const char* name = "uint64";
+  static void Emit(EventBuffer*, uint32_t* entry, uint64_t value) {
+    entry[0] = static_cast<uint32_t>(value);
+    entry[1] = static_cast<uint32_t>(value >> 32);
+  }
 };
 template <>
-struct ArgTypeDef<uint32_t> {
-  static const char* name;
-  static void Emit(EventBuffer* b, uint32_t value) { b->AddEntry(value); }
+struct ArgTypeDef<int64_t> : FixedSizeArgTypeDef<2> {
+  static constexpr const char* name = "int64";
+  static void Emit(EventBuffer*, uint32_t* entry, uint64_t value) {
+    ArgTypeDef<uint64_t>::Emit(nullptr, entry, value);
+  }
+};
+template <>
+struct ArgTypeDef<float> : FixedSizeArgTypeDef<1> {
+  static constexpr const char* name = "float32";
+  static void Emit(EventBuffer*, uint32_t* entry, float value) {
+    static_assert(sizeof(value) == sizeof(*entry), "Unexpected float size");
+    memcpy(entry, &value, sizeof(value));
+  }
 };
 template <>
-struct ArgTypeDef<int16_t> {
-  static const char* name;
-  static void Emit(EventBuffer* b, uint16_t value) { b->AddEntry(value); }
+struct ArgTypeDef<double> : FixedSizeArgTypeDef<2> {
+  static constexpr const char* name = "float64";
+  static void Emit(EventBuffer*, uint32_t* entry, double value) {
+    static_assert(sizeof(value) == 2 * sizeof(*entry),
+                  "Unexpected double size");
+    memcpy(entry, &value, sizeof(value));
+  }
 };
 template <>
-struct ArgTypeDef<int32_t> {
-  static const char* name;
-  static void Emit(EventBuffer* b, uint32_t value) { b->AddEntry(value); }
+struct ArgTypeDef<Uint8Array> {
+  static constexpr const char* name = "uint8[]";
+  static constexpr uint32_t kNullLength = 0xffffffff;
+  static constexpr size_t kEntries = 1;
+  static constexpr bool kVariableSize = true;
+
+  // Number of bytes emitted for a value: at most max_size.
+  static size_t EmittedSize(Uint8Array value, size_t max_size) {
+    return value.size < max_size ? value.size : max_size;
+  }
+  static size_t EntryCount(Uint8Array value, size_t max_size) {
+    return kEntries + (value.data ? (EmittedSize(value, max_size) + 3) / 4 : 0);
+  }
+  static void Emit(EventBuffer*, uint32_t* entry, Uint8Array value,
+                   size_t max_size) {
+    if (!value.data) {
+      *entry = kNullLength;
+      return;
+    }
+    size_t size = EmittedSize(value, max_size);
+    entry[0] = static_cast<uint32_t>(size);
+    if (size % 4) {
+      entry[size / 4 + 1] = 0;  // Zero the padding.
+    }
+    memcpy(entry + 1, value.data, size);
+  }
+};
+
+// Counts the entries occupied by a list of argument types, not including
+// the variable part of variable sized ones.
+template <typename... ArgTypes>
+struct ArgEntryCount {
+  static constexpr size_t value = 0;
+};
+template <typename FirstType, typename... ArgTypes>
+struct ArgEntryCount<FirstType, ArgTypes...> {
+  static constexpr size_t value =
+      ArgTypeDef<FirstType>::kEntries + ArgEntryCount<ArgTypes...>::value;
+};
+
+// Counts the variable sized arguments in a list of argument types.
+template <typename... ArgTypes>
+struct VariableSizeArgCount {
+  static constexpr size_t value = 0;
+};
+template <typename FirstType, typename... ArgTypes>
+struct VariableSizeArgCount<FirstType, ArgTypes...> {
+  static constexpr size_t value =
+      (ArgTypeDef<FirstType>::kVariableSize ? 1 : 0) +
+      VariableSizeArgCount<ArgTypes...>::value;
+};
+
+// Name and argument signature (as in "uint32 a, ascii b") of an event,
+// built ahead of time. Both strings must have static storage duration.
+struct EventSignature {
+  const char* name;
+  const char* arguments;
+};
+
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+namespace internal {
+// Compile time equivalents of the name spec parsing done by EventDefinition.
+constexpr bool IsNameSpecSeparator(char c) { return c <= ' ' || c == ','; }
+
+constexpr size_t ConstexprStrlen(const char* s) {
+  size_t len = 0;
+  while (s[len]) {
+    len += 1;
+  }
+  return len;
+}
+
+// Length of the event name: everything before the colon.
+constexpr size_t NameSpecNameLength(const char* name_spec) {
+  size_t len = 0;
+  while (name_spec[len] && name_spec[len] != ':') {
+    len += 1;
+  }
+  return len;
+}
+
+// Finds the argument name at index in the list after the colon.
+// Returns: false if there are not that many names.
+constexpr bool FindNameSpecArgName(const char* name_spec, size_t index,
+                                   size_t* start, size_t* len) {
+  size_t pos = NameSpecNameLength(name_spec);
+  if (!name_spec[pos]) {
+    return false;
+  }
+  pos += 1;
+  for (size_t i = 0;; i++) {
+    while (name_spec[pos] && IsNameSpecSeparator(name_spec[pos])) {
+      pos += 1;
+    }
+    if (!name_spec[pos]) {
+      return false;
+    }
+    size_t name_len = 0;
+    while (!IsNameSpecSeparator(name_spec[pos + name_len])) {
+      name_len += 1;
+    }
+    if (i == index) {
+      *start = pos;
+      *len = name_len;
+      return true;
+    }
+    pos += name_len;
+  }
+}
+
+constexpr size_t CountNameSpecArgNames(const char* name_spec) {
+  size_t count = 0;
+  size_t start = 0;
+  size_t len = 0;
+  while (FindNameSpecArgName(name_spec, count, &start, &len)) {
+    count += 1;
+  }
+  return count;
+}
+
+constexpr size_t DecimalLength(size_t value) {
+  size_t len = 1;
+  for (; value >= 10; value /= 10) {
+    len += 1;
+  }
+  return len;
+}
+
+// Visits the pieces of the argument signature for the given type names.
+template <typename Visitor>
+constexpr void VisitArguments(const char* name_spec,
+                              const char* const* type_names, size_t count,
+                              Visitor* visitor) {
+  for (size_t i = 0; i < count; i++) {
+    if (i) {
+      visitor->Append(", ", 2);
+    }
+    visitor->Append(type_names[i], ConstexprStrlen(type_names[i]));
+    visitor->Append(" ", 1);
+    size_t start = 0;
+    size_t len = 0;
+    if (FindNameSpecArgName(name_spec, i, &start, &len)) {
+      visitor->Append(name_spec + start, len);
+    } else {
+      // Generate one, like EventDefinition.
+      visitor->Append("a", 1);
+      visitor->AppendDecimal(i);
+    }
+  }
+}
+
+struct LengthVisitor {
+  constexpr void Append(const char*, size_t len) { length += len; }
+  constexpr void AppendDecimal(size_t value) { length += DecimalLength(value); }
+  size_t length = 0;
+};
+
+template <size_t kSize>
+struct BuildVisitor {
+  constexpr void Append(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+      chars[pos++] = s[i];
+    }
+  }
+  constexpr void AppendDecimal(size_t value) {
+    size_t len = DecimalLength(value);
+    for (size_t i = len; i > 0; i--, value /= 10) {
+      chars[pos + i - 1] = static_cast<char>('0' + value % 10);
+    }
+    pos += len;
+  }
+  std::array<char, kSize> chars{};
+  size_t pos = 0;
 };
+}  // namespace internal
+
+// Base of the StaticSignature types, for overload selection.
+struct StaticSignatureBase {};
+
+// Signature of an event built at compile time from a name spec and the
+// argument types. NameSpec is a type with a static constexpr value() that
+// returns the name spec (a string literal), as generated by the tracing
+// macros. Name specs with an empty name or with more argument names than
+// arguments are rejected.
+template <typename NameSpec, typename... ArgTypes>
+struct StaticSignature : StaticSignatureBase {
+  static constexpr const char* kNameSpec = NameSpec::value();
+  static constexpr size_t kNameLength =
+      internal::NameSpecNameLength(kNameSpec);
+  static_assert(kNameLength > 0, "Event name spec has an empty name");
+  static_assert(internal::CountNameSpecArgNames(kNameSpec) <=
+                    sizeof...(ArgTypes),
+                "Event name spec has more argument names than arguments");
+
+  static constexpr std::array<const char*, sizeof...(ArgTypes)> kTypeNames{
+      {ArgTypeDef<ArgTypes>::name...}};
+
+  static constexpr size_t ArgumentsLength() {
+    internal::LengthVisitor visitor;
+    internal::VisitArguments(kNameSpec, kTypeNames.data(), kTypeNames.size(),
+                             &visitor);
+    return visitor.length;
+  }
+
+  static constexpr size_t kArgumentsLength = ArgumentsLength();
+
+  static constexpr std::array<char, kNameLength + 1> BuildName() {
+    std::array<char, kNameLength + 1> name{};
+    for (size_t i = 0; i < kNameLength; i++) {
+      name[i] = kNameSpec[i];
+    }
+    return name;
+  }
+
+  static constexpr std::array<char, kArgumentsLength + 1> BuildArguments() {
+    internal::BuildVisitor<kArgumentsLength + 1> visitor;
+    internal::VisitArguments(kNameSpec, kTypeNames.data(), kTypeNames.size(),
+                             &visitor);
+    return visitor.chars;
+  }
+
+  static constexpr std::array<char, kNameLength + 1> kName = BuildName();
+  static constexpr std::array<char, kArgumentsLength + 1> kArguments =
+      BuildArguments();
+  static constexpr EventSignature value{kName.data(), kArguments.data()};
+};
+
+// Enables a constructor for StaticSignature types only.
+template <typename Signature>
+using EnableIfStaticSignature = typename std::enable_if<
+    std::is_base_of<StaticSignatureBase, Signature>::value>::type;
+#endif  // WTF_CONSTEXPR_SIGNATURES
 
 // Value type that can be used to generate an event argument signature. This
 // defers the entire cost of generating the signature until it is needed and
-// uses template code generation to handle arbitrary types.
+// uses template code generation to handle arbitrary types. Alternatively, it
+// refers to an EventSignature built ahead of time.
 class EventDefinition {
  public:
   // Callback function that will be invoked to append a typed arg list
@@ -81,6 +501,14 @@ class EventDefinition {
                            &EventDefinition::ArgumentZipper<ArgTypes...>};
   }
 
+  // Create an EventDefinition with a prebuilt signature.
+  static EventDefinition Create(int wire_id, EventClass event_class, int flags,
+                                const EventSignature* signature) {
+    EventDefinition definition{wire_id, event_class, flags, nullptr, nullptr};
+    definition.signature_ = signature;
+    return definition;
+  }
+
   // Appends the argument name to the given string.
   void AppendName(std::string* output) const;
 
@@ -169,10 +597,12 @@ class EventDefinition {
   int flags_ = 0;
   const char* name_spec_ = nullptr;
   ArgumentZipperCallback argument_zipper_ = nullptr;
+  const EventSignature* signature_ = nullptr;
 };
 
 // Singleton registry of all EventDefinitions.
-// The registry is thread safe.
+// The registry is thread safe and lock free: definitions are only ever
+// appended, as nodes pushed onto a list that is never trimmed.
 class EventRegistry {
  public:
   // Gets the lone singleton instance.
@@ -184,18 +614,78 @@ class EventRegistry {
   // function call.
   static void AddEventDefinition(EventDefinition event_definition);
 
-  // Makes a copy of all event definitions. This is potentially expensive but
-  // is not deadlock or iteration invalidation prone.
-  std::vector<EventDefinition> GetEventDefinitions();
+  // Makes a copy of the event definitions from first_index on, in the order
+  // that they were added. This only visits the definitions copied.
+  std::vector<EventDefinition> GetEventDefinitions(size_t first_index = 0);
 
  private:
-  platform::mutex mu_;
-  std::deque<EventDefinition> event_definitions_;
+  struct Node {
+    EventDefinition definition;
+    // Nodes are numbered in the order added.
+    size_t index;
+    Node* next;
+  };
+
+  // The most recently added definition.
+  platform::atomic<Node*> head_{nullptr};
   EventRegistry();
   EventRegistry(const EventRegistry&) = delete;
   void operator=(const EventRegistry&) = delete;
 };
 
+// Category of events whose recording is switched on and off at runtime, for
+// subsystems whose events are compiled in but only wanted some of the time.
+// Categories must have static storage duration (typically globals) and at
+// most kMaxCategories may exist; any beyond that are never enabled. The
+// enabled state of all categories lives in one cache line aligned bitmask,
+// so that checking a category is one load and branch off a hot global.
+//
+// Categories are configured with a spec: a comma separated list of names to
+// enable, applied left to right, where "*" matches every category and a
+// leading "-" disables instead. Categories not matched keep their default.
+// The spec comes from the WTF_CATEGORIES environment variable unless one has
+// been set with Configure().
+//
+// Example:
+//   wtf::EventCategory gpu_category{"gpu"};
+//   WTF_EVENT_IN(gpu_category, "Gpu#submit: count", uint32_t)(count);
+//
+//   $ WTF_CATEGORIES="*,-net" ./app
+class EventCategory {
+ public:
+  static constexpr size_t kMaxCategories = 64;
+
+  explicit EventCategory(const char* name, bool enabled_by_default = false);
+
+  // Disallow copy and assign.
+  EventCategory(const EventCategory&) = delete;
+  void operator=(const EventCategory&) = delete;
+
+  const char* name() const { return name_; }
+
+  bool enabled() const {
+    return enabled_bits_.bits.load(platform::memory_order_relaxed) & mask_;
+  }
+  void set_enabled(bool enabled);
+
+  // Applies a spec to all categories, now and as they are created. This
+  // replaces the spec from the environment.
+  static void Configure(const char* spec);
+
+ private:
+  struct alignas(64) EnabledBits {
+    platform::atomic<uint64_t> bits;
+  };
+  static EnabledBits enabled_bits_;
+
+  // Sets the category's bit. The registry lock must be held.
+  void StoreEnabled(bool enabled);
+
+  const char* name_;
+  uint64_t mask_ = 0;
+  bool enabled_by_default_;
+};
+
 // An Event that can be invoked with arbitrary arguments.
 //
 // There are a number of constructors for events, but most are only used
@@ -219,6 +709,21 @@ class EventIf {
  public:
   static constexpr int kArgCount = sizeof...(ArgTypes);
 
+  // Number of entries occupied by an invocation: wire id, timestamp and
+  // the entries of each argument. Variable sized arguments add to this.
+  static constexpr size_t kEntryCount = 2 + ArgEntryCount<ArgTypes...>::value;
+  static_assert(kEntryCount <= EventBlock::kMaxEventEntries,
+                "Event has too many arguments");
+
+  // Most bytes emitted for each variable sized argument, so that an
+  // invocation always fits in a block. Longer values are truncated.
+  static constexpr size_t kVariableSizeArgCount =
+      VariableSizeArgCount<ArgTypes...>::value;
+  static constexpr size_t kMaxVariableBytes =
+      kVariableSizeArgCount ? (EventBlock::kMaxEventEntries - kEntryCount) /
+                                  kVariableSizeArgCount * 4
+                            : 0;
+
   // Disallow copy and assign.
   EventIf(const EventIf&) = delete;
   void operator=(const EventIf&) = delete;
@@ -240,11 +745,31 @@ class EventIf {
       : EventIf(EventDefinition::NextEventId(), event_class, flags, name_spec) {
   }
 
+  // Creates an event with an auto-assigned id and a prebuilt signature.
+  EventIf(EventClass event_class, int flags, const EventSignature* signature)
+      : wire_id_(EventDefinition::NextEventId()) {
+    EventRegistry::AddEventDefinition(
+        EventDefinition::Create(wire_id_, event_class, flags, signature));
+  }
+
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  // Creates a standard instance event with a signature built at compile
+  // time (see the tracing macros).
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  explicit EventIf(Signature)
+      : EventIf(EventClass::kInstance, 0, &Signature::value) {}
+#endif
+
+  // Gets the wire id that the event is serialized with.
+  int wire_id() const { return wire_id_; }
+
   // Invokes the event with a specific EventBuffer.
   void InvokeSpecific(EventBuffer* event_buffer, ArgTypes... args) {
-    event_buffer->AddEntry(wire_id_);
-    event_buffer->AddEntry(PlatformGetTimestampMicros32());
-    EmitArguments(event_buffer, args...);
+    uint32_t* entries =
+        event_buffer->ReserveEvent(wire_id_, 2 + EntryCount(args...));
+    EmitArguments(event_buffer, entries + 2, static_string_slots_.data(),
+                  args...);
+    event_buffer->CommitEntries();
   }
 
   // Invokes the event against the current thread (if it has been enabled).
@@ -256,16 +781,54 @@ class EventIf {
   }
 
  private:
+  // Counts the entries occupied by a list of argument values. This folds to
+  // kEntryCount - 2 unless some are variable sized.
+  static constexpr size_t EntryCount() { return 0; }
+
+  template <typename T, typename... RestArgTypes>
+  static size_t EntryCount(T first, RestArgTypes... rest) {
+    return ArgTypeDef<T>::EntryCount(first, kMaxVariableBytes) +
+           EntryCount(rest...);
+  }
+
   // Emitters for a variable list of arguments.
-  void EmitArguments(EventBuffer* event_buffer) {}
+  void EmitArguments(EventBuffer* event_buffer, uint32_t* entry,
+                     StaticStringSlot* slot) {}
 
   template <typename T, typename... RestArgTypes>
-  void EmitArguments(EventBuffer* event_buffer, T first, RestArgTypes... rest) {
-    ArgTypeDef<T>::Emit(event_buffer, first);
-    EmitArguments(event_buffer, rest...);
+  void EmitArguments(EventBuffer* event_buffer, uint32_t* entry,
+                     StaticStringSlot* slot, T first, RestArgTypes... rest) {
+    slot = EmitArgument(event_buffer, entry, slot, first);
+    EmitArguments(event_buffer,
+                  entry + ArgTypeDef<T>::EntryCount(first, kMaxVariableBytes),
+                  slot, rest...);
+  }
+
+  // Emits a single argument, returning the slot for the next StaticString.
+  template <typename T>
+  static StaticStringSlot* EmitArgument(EventBuffer* event_buffer,
+                                        uint32_t* entry, StaticStringSlot* slot,
+                                        T value) {
+    ArgTypeDef<T>::Emit(event_buffer, entry, value);
+    return slot;
+  }
+  static StaticStringSlot* EmitArgument(EventBuffer* event_buffer,
+                                        uint32_t* entry, StaticStringSlot* slot,
+                                        StaticString value) {
+    ArgTypeDef<StaticString>::Emit(event_buffer, entry, slot, value);
+    return slot + 1;
+  }
+  static StaticStringSlot* EmitArgument(EventBuffer* event_buffer,
+                                        uint32_t* entry, StaticStringSlot* slot,
+                                        Uint8Array value) {
+    ArgTypeDef<Uint8Array>::Emit(event_buffer, entry, value,
+                                 kMaxVariableBytes);
+    return slot;
   }
 
   int wire_id_;
+  std::array<StaticStringSlot, StaticStringCount<ArgTypes...>::value>
+      static_string_slots_;
 };
 
 // Explicit specialization for when kEnable == false.
@@ -283,6 +846,13 @@ class EventIf<false, ArgTypes...> {
   EventIf(int wire_id, EventClass event_class, int flags,
           const char* name_spec) {}
   EventIf(EventClass event_class, int flags, const char* name_spec) {}
+  EventIf(EventClass event_class, int flags, const EventSignature* signature) {
+  }
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  // The signature is not referenced, so it is not emitted.
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  explicit EventIf(Signature) {}
+#endif
 
   void InvokeSpecific(EventBuffer*, ArgTypes...) {}
   void Invoke(ArgTypes...) {}
@@ -305,18 +875,37 @@ class StandardEvents {
   static constexpr int kScopeLeaveEventId = 2;
   static EventEnabled<>& GetScopeLeaveEvent();
 
+  // The time epoch event is emitted directly by EventBuffers when 64bit
+  // timestamps are enabled (see EventBuffer::ReserveEventAt). It carries the
+  // upper 32 bits of the timestamps of subsequent events.
+  static constexpr int kTimeEpochEventId = 3;
+  static EventEnabled<uint32_t>& GetTimeEpochEvent();
+
   static void DefineEvent(EventBuffer* event_buffer, uint16_t wire_id,
                           uint16_t event_class, uint32_t flags,
                           const char* name, const char* args);
   static void ScopeLeave(EventBuffer* event_buffer);
 
-  // Creates a new zone, returning the zone id.
+  // Creates a new zone, returning the zone id. EventBuffers also emit this
+  // directly when the original has been overwritten.
+  static EventEnabled<uint16_t, const char*, const char*, const char*>&
+  GetCreateZoneEvent();
   static int CreateZone(EventBuffer* event_buffer, const char* name,
                         const char* type, const char* location);
 
-  // Sets a zone.
+  // Sets a zone. EventBuffers also emit this directly when resuming a part.
+  static EventEnabled<uint16_t>& GetSetZoneEvent();
   static void SetZone(EventBuffer* event_buffer, int zoneId);
 
+  // Flow events, which tie together work handed between threads (see
+  // FlowHandle). parent_id is 0 for none.
+  // Returns: The id of the new flow.
+  static uint32_t BranchFlow(EventBuffer* event_buffer, const char* name,
+                             uint32_t parent_id);
+  static void ExtendFlow(EventBuffer* event_buffer, uint32_t id,
+                         const char* name);
+  static void TerminateFlow(EventBuffer* event_buffer, uint32_t id);
+
   // Notes the start of a frame.
   static void FrameStart(EventBuffer* event_buffer, uint32_t number);
 
@@ -327,9 +916,63 @@ class StandardEvents {
   StandardEvents() = delete;
 };
 
+// An asynchronous flow of work, such as a request handed between the threads
+// of a pool. This is a small value that can be moved (or copied) into the
+// closures of the tasks that continue the flow: each task extends it, and
+// the last one terminates it. Flow events are attributed to the scope that
+// they are emitted in. Handles of flows branched on threads that are not
+// enabled are empty, like default constructed and moved from handles, and
+// ignore Extend() and Terminate(), as do threads that are not enabled.
+//
+// Example:
+//   wtf::FlowHandle flow = wtf::FlowHandle::Branch("Request#decode");
+//   pool->Post([flow]() mutable {
+//     WTF_SCOPE0("Worker#Decode");
+//     flow.Extend("Request#decode");
+//     ...
+//     flow.Terminate();
+//   });
+class FlowHandle {
+ public:
+  FlowHandle() : id_(0) {}
+  FlowHandle(const FlowHandle&) = default;
+  FlowHandle& operator=(const FlowHandle&) = default;
+  FlowHandle(FlowHandle&& other) : id_(other.id_) { other.id_ = 0; }
+  FlowHandle& operator=(FlowHandle&& other) {
+    id_ = other.id_;
+    other.id_ = 0;
+    return *this;
+  }
+
+  // Continues a flow whose id was carried by other means.
+  static FlowHandle FromId(uint32_t id) { return FlowHandle{id}; }
+
+  // Starts a new flow on the current thread, optionally as a child of
+  // another one.
+  static FlowHandle Branch(const char* name,
+                           const FlowHandle& parent = FlowHandle());
+
+  // Notes that the flow continues on the current thread, at the start of
+  // a stage called name.
+  void Extend(const char* name);
+
+  // Ends the flow on the current thread and empties the handle.
+  void Terminate();
+
+  uint32_t id() const { return id_; }
+  bool empty() const { return !id_; }
+
+ private:
+  explicit FlowHandle(uint32_t id) : id_(id) {}
+
+  uint32_t id_;
+};
+
 // Raw scope used to track enter and leave of a scope. This does not actually
 // do automatic RAII enter/exit, which is done by higher level wrapper types
 // and macros.
+// In EventBuffers with a ScopeAggregator, scopes record their duration there
+// instead of emitting events, and their arguments are not recorded.
 template <bool kEnable, typename... ArgTypes>
 class ScopedEventIf : private EventIf<kEnable, ArgTypes...> {
  public:
@@ -340,16 +983,36 @@ class ScopedEventIf : private EventIf<kEnable, ArgTypes...> {
   explicit ScopedEventIf(const char* name_spec)
       : Event<ArgTypes...>(EventClass::kScoped, 0, name_spec) {}
 
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  explicit ScopedEventIf(Signature)
+      : EventIf<kEnable, ArgTypes...>(EventClass::kScoped, 0,
+                                      &Signature::value) {}
+#endif
+
+  // The wire id of the enter event (e.g. for ShaveAutoScope).
+  using EventIf<kEnable, ArgTypes...>::wire_id;
+
   // Emits an enter event against a specific EventBuffer.
   void EnterSpecific(EventBuffer* event_buffer, ArgTypes... args) {
+    ScopeAggregator* scope_aggregator = event_buffer->scope_aggregator();
+    if (scope_aggregator) {
+      scope_aggregator->Enter(EventIf<kEnable, ArgTypes...>::wire_id());
+      return;
+    }
     Event<ArgTypes...>::InvokeSpecific(event_buffer, args...);
   }
 
   // Emits a leave event against a specific EventBuffer.
   void LeaveSpecific(EventBuffer* event_buffer) {
+    ScopeAggregator* scope_aggregator = event_buffer->scope_aggregator();
+    if (scope_aggregator) {
+      scope_aggregator->Leave();
+      return;
+    }
     // We directly emit the scope leave event to avoid some overhead.
-    event_buffer->AddEntry(StandardEvents::kScopeLeaveEventId);
-    event_buffer->AddEntry(PlatformGetTimestampMicros32());
+    event_buffer->ReserveEvent(StandardEvents::kScopeLeaveEventId, 2);
+    event_buffer->CommitEntries();
   }
 
   // Emits an enter event against the current thread's EventBuffer (if enabled).
@@ -439,6 +1102,10 @@ class ScopedEventIf<false, ArgTypes...> {
   void operator=(const ScopedEventIf&) = delete;
 
   explicit ScopedEventIf(const char*) {}
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  explicit ScopedEventIf(Signature) {}
+#endif
   void EnterSpecific(EventBuffer*, ArgTypes...) {}
   void LeaveSpecific(EventBuffer*) {}
   void Enter(ArgTypes... args) {}
@@ -452,6 +1119,216 @@ using ScopedEvent = ScopedEventIf<kMasterEnable, ArgTypes...>;
 template <typename... ArgTypes>
 using ScopedEventEnabled = ScopedEventIf<true, ArgTypes...>;
 
+// Decides which invocations of a sampled event site are recorded: one in
+// every sample_period (starting with the first), subject to the rate limit
+// of the invoking thread (see EventBuffer::TakeRateToken()). The count is
+// shared by all threads but updated without a read-modify-write, so threads
+// racing on it may occasionally skew the sampling a little.
+class EventSampler {
+ public:
+  explicit EventSampler(uint32_t sample_period)
+      : sample_period_(sample_period ? sample_period : 1),
+        count_{sample_period_ - 1} {}
+
+  // Returns: Whether to record the current invocation.
+  bool Sample(EventBuffer* event_buffer) {
+    uint32_t count = count_.load(platform::memory_order_relaxed) + 1;
+    if (count < sample_period_) {
+      count_.store(count, platform::memory_order_relaxed);
+      return false;
+    }
+    count_.store(0, platform::memory_order_relaxed);
+    return event_buffer->TakeRateToken();
+  }
+
+ private:
+  const uint32_t sample_period_;
+  platform::atomic<uint32_t> count_;
+};
+
+// Instance event that only records one in every sample_period invocations.
+// The period (up to EventFlags::kMaxSamplePeriod) is recorded in the event
+// definition's flags.
+template <bool kEnable, typename... ArgTypes>
+class SampledEventIf : private EventIf<kEnable, ArgTypes...> {
+ public:
+  SampledEventIf(const char* name_spec, uint32_t sample_period)
+      : EventIf<kEnable, ArgTypes...>(EventClass::kInstance,
+                                      EventFlags::Sampled(sample_period),
+                                      name_spec),
+        sampler_(sample_period) {}
+
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  SampledEventIf(Signature, uint32_t sample_period)
+      : EventIf<kEnable, ArgTypes...>(EventClass::kInstance,
+                                      EventFlags::Sampled(sample_period),
+                                      &Signature::value),
+        sampler_(sample_period) {}
+#endif
+
+  using EventIf<kEnable, ArgTypes...>::wire_id;
+
+  // Invokes the event with a specific EventBuffer, if sampled.
+  void InvokeSpecific(EventBuffer* event_buffer, ArgTypes... args) {
+    if (sampler_.Sample(event_buffer)) {
+      EventIf<kEnable, ArgTypes...>::InvokeSpecific(event_buffer, args...);
+    }
+  }
+
+  // Invokes the event against the current thread (if it has been enabled),
+  // if sampled.
+  void Invoke(ArgTypes... args) {
+    EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+    if (event_buffer) {
+      InvokeSpecific(event_buffer, args...);
+    }
+  }
+
+ private:
+  EventSampler sampler_;
+};
+
+// Explicit specialization for when kEnable == false.
+// This must have the same public surface area as the generic version but no-op.
+template <typename... ArgTypes>
+class SampledEventIf<false, ArgTypes...> {
+ public:
+  SampledEventIf(const char*, uint32_t) {}
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  SampledEventIf(Signature, uint32_t) {}
+#endif
+
+  void InvokeSpecific(EventBuffer*, ArgTypes...) {}
+  void Invoke(ArgTypes...) {}
+};
+
+// Scoped event that only records one in every sample_period entries (and
+// their matching leaves). See SampledEventIf. Like ScopedEventIf, the sampled
+// entries go to the ScopeAggregator of EventBuffers that have one.
+template <bool kEnable, typename... ArgTypes>
+class SampledScopedEventIf : private EventIf<kEnable, ArgTypes...> {
+ public:
+  SampledScopedEventIf(const char* name_spec, uint32_t sample_period)
+      : EventIf<kEnable, ArgTypes...>(EventClass::kScoped,
+                                      EventFlags::Sampled(sample_period),
+                                      name_spec),
+        sampler_(sample_period) {}
+
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  SampledScopedEventIf(Signature, uint32_t sample_period)
+      : EventIf<kEnable, ArgTypes...>(EventClass::kScoped,
+                                      EventFlags::Sampled(sample_period),
+                                      &Signature::value),
+        sampler_(sample_period) {}
+#endif
+
+  // Emits an enter event against a specific EventBuffer, if sampled.
+  // Returns: Whether the enter was emitted, in which case the matching
+  // LeaveSpecific() must follow.
+  bool EnterSpecific(EventBuffer* event_buffer, ArgTypes... args) {
+    if (!sampler_.Sample(event_buffer)) {
+      return false;
+    }
+    ScopeAggregator* scope_aggregator = event_buffer->scope_aggregator();
+    if (scope_aggregator) {
+      scope_aggregator->Enter(EventIf<kEnable, ArgTypes...>::wire_id());
+      return true;
+    }
+    EventIf<kEnable, ArgTypes...>::InvokeSpecific(event_buffer, args...);
+    return true;
+  }
+
+  // Emits a leave event against a specific EventBuffer.
+  void LeaveSpecific(EventBuffer* event_buffer) {
+    ScopeAggregator* scope_aggregator = event_buffer->scope_aggregator();
+    if (scope_aggregator) {
+      scope_aggregator->Leave();
+      return;
+    }
+    event_buffer->ReserveEvent(StandardEvents::kScopeLeaveEventId, 2);
+    event_buffer->CommitEntries();
+  }
+
+ private:
+  EventSampler sampler_;
+};
+
+// Explicit specialization for when kEnable == false.
+// This must have the same public surface area as the generic version but no-op.
+template <typename... ArgTypes>
+class SampledScopedEventIf<false, ArgTypes...> {
+ public:
+  SampledScopedEventIf(const char*, uint32_t) {}
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+  template <typename Signature, typename = EnableIfStaticSignature<Signature>>
+  SampledScopedEventIf(Signature, uint32_t) {}
+#endif
+  bool EnterSpecific(EventBuffer*, ArgTypes...) { return false; }
+  void LeaveSpecific(EventBuffer*) {}
+};
+
+// RAII wrapper around a static SampledScopedEvent, which leaves the scope
+// only if its entry was sampled.
+template <bool kEnable, typename... ArgTypes>
+class SampledAutoScopeIf {
+ public:
+  using EventType = SampledScopedEventIf<kEnable, ArgTypes...>;
+
+  // Disallow copy and assign.
+  SampledAutoScopeIf(const SampledAutoScopeIf&) = delete;
+  void operator=(const SampledAutoScopeIf&) = delete;
+
+  explicit SampledAutoScopeIf(EventType& event)  // NOLINT
+      : event_(event),
+        event_buffer_(nullptr) {}
+
+  void Enter(ArgTypes... args) {
+    EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+    if (event_buffer && event_.EnterSpecific(event_buffer, args...)) {
+      event_buffer_ = event_buffer;
+    }
+  }
+
+  ~SampledAutoScopeIf() {
+    if (event_buffer_) {
+      event_.LeaveSpecific(event_buffer_);
+    }
+  }
+
+ private:
+  EventType& event_;
+  EventBuffer* event_buffer_;
+};
+
+// Explicit specialization for when kEnable == false.
+// This must have the same public surface area as the generic version but no-op.
+template <typename... ArgTypes>
+class SampledAutoScopeIf<false, ArgTypes...> {
+ public:
+  using EventType = SampledScopedEventIf<false, ArgTypes...>;
+
+  // Disallow copy and assign.
+  SampledAutoScopeIf(const SampledAutoScopeIf&) = delete;
+  void operator=(const SampledAutoScopeIf&) = delete;
+
+  explicit SampledAutoScopeIf(EventType&) {}  // NOLINT
+  void Enter(ArgTypes... args) {}
+};
+
+// Default instantiations of the sampled events that are enabled if
+// kMasterEnable.
+template <typename... ArgTypes>
+using SampledEvent = SampledEventIf<kMasterEnable, ArgTypes...>;
+
+template <typename... ArgTypes>
+using SampledScopedEvent = SampledScopedEventIf<kMasterEnable, ArgTypes...>;
+
+template <typename... ArgTypes>
+using SampledAutoScope = SampledAutoScopeIf<kMasterEnable, ArgTypes...>;
+
 }  // namespace wtf
 
 #endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_EVENT_H_
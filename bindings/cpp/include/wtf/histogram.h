@@ -0,0 +1,180 @@
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_HISTOGRAM_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_HISTOGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+#include "wtf/platform.h"
+
+namespace wtf {
+
+// Log-linear histogram of durations in microseconds, in the manner of
+// HdrHistogram: values below 2^kSubBucketBits have a bucket each, and every
+// power of two above that is split into 2^kSubBucketBits equal buckets. A
+// bucket thus spans at most 1/16th of its values.
+class DurationHistogram {
+ public:
+  static constexpr int kSubBucketBits = 4;
+  static constexpr uint32_t kSubBucketCount = 1 << kSubBucketBits;
+  static constexpr size_t kBucketCount = (33 - kSubBucketBits)
+                                         << kSubBucketBits;
+
+  // Gets the bucket holding value.
+  static size_t BucketIndex(uint32_t value) {
+    if (value < kSubBucketCount) {
+      return value;
+    }
+    int shift = 31 - __builtin_clz(value) - kSubBucketBits;
+    return ((shift + 1) << kSubBucketBits) + (value >> shift) -
+           kSubBucketCount;
+  }
+
+  // Gets the smallest and largest values held by a bucket.
+  static uint32_t BucketLowerBound(size_t index);
+  static uint32_t BucketUpperBound(size_t index);
+
+  // Adds count instances of value.
+  void Add(uint32_t value, uint64_t count = 1);
+
+  // Adds count values that fall in bucket index, for merging histograms
+  // kept elsewhere. Their sum and maximum are added by AddTotals().
+  void AddToBucket(size_t index, uint64_t count);
+  void AddTotals(uint64_t sum, uint32_t max);
+
+  void Merge(const DurationHistogram& other);
+
+  uint64_t count() const { return count_; }
+  uint64_t sum() const { return sum_; }
+  uint32_t max() const { return max_; }
+  uint64_t bucket(size_t index) const { return buckets_[index]; }
+
+  // Gets the value at or below which fraction (0 to 1) of the durations
+  // fall, to within a bucket (the top of the bucket, capped at max()).
+  // Returns: 0 if the histogram is empty.
+  uint32_t ValueAtQuantile(double fraction) const;
+
+ private:
+  uint64_t buckets_[kBucketCount] = {};
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint32_t max_ = 0;
+};
+
+// Durations of the scopes of one thread by wire id, recorded in place of
+// their enter and leave events (see Runtime::SetScopeAggregation()). Memory
+// is fixed up front: a histogram for each of up to max_scopes scopes and a
+// stack of kMaxDepth open scopes. The owning thread is the only writer, so
+// counts are updated without read-modify-writes, and any other thread may
+// merge them concurrently.
+class ScopeAggregator {
+ public:
+  // Scopes nested deeper than this are not recorded.
+  static constexpr size_t kMaxDepth = 64;
+
+  // max_scopes is rounded up to a power of two.
+  explicit ScopeAggregator(size_t max_scopes);
+  ScopeAggregator(const ScopeAggregator&) = delete;
+  void operator=(const ScopeAggregator&) = delete;
+
+  // Notes the entry of a scope at the current time. Must be called from the
+  // owning thread.
+  void Enter(uint32_t wire_id) {
+    if (depth_ < kMaxDepth) {
+      stack_[depth_] =
+          OpenScope{FindHistogram(wire_id), PlatformGetTimestampMicros32()};
+    }
+    depth_++;
+  }
+
+  // Records the duration of the innermost open scope. Must be called from
+  // the owning thread.
+  void Leave() {
+    if (!depth_ || --depth_ >= kMaxDepth) {
+      CountDropped();
+      return;
+    }
+    const OpenScope& scope = stack_[depth_];
+    if (!scope.histogram) {
+      CountDropped();
+      return;
+    }
+    scope.histogram->Add(PlatformGetTimestampMicros32() - scope.enter_time);
+  }
+
+  // Adds everything recorded so far to histograms, by wire id.
+  void MergeInto(
+      std::unordered_map<uint32_t, DurationHistogram>* histograms) const;
+
+  // Number of scopes that were not recorded: past the stack depth, past
+  // max_scopes distinct scopes, or left without being entered.
+  uint32_t dropped_scopes() const {
+    return dropped_scopes_.load(platform::memory_order_relaxed);
+  }
+
+  // Forgets the open scopes, for a new owning thread. Recorded durations
+  // are kept.
+  void ResetStack() { depth_ = 0; }
+
+ private:
+  // A histogram that is updated by one thread only.
+  struct Histogram {
+    void Add(uint32_t value) {
+      auto& bucket = buckets[DurationHistogram::BucketIndex(value)];
+      bucket.store(bucket.load(platform::memory_order_relaxed) + 1,
+                   platform::memory_order_relaxed);
+      sum.store(sum.load(platform::memory_order_relaxed) + value,
+                platform::memory_order_relaxed);
+      if (value > max.load(platform::memory_order_relaxed)) {
+        max.store(value, platform::memory_order_relaxed);
+      }
+    }
+
+    // 0 while unclaimed. Stored with release once claimed.
+    platform::atomic<uint32_t> wire_id;
+    platform::atomic<uint32_t> max;
+    platform::atomic<uint64_t> sum;
+    platform::atomic<uint32_t> buckets[DurationHistogram::kBucketCount];
+  };
+
+  struct OpenScope {
+    Histogram* histogram;
+    uint32_t enter_time;
+  };
+
+  // Gets the histogram of a wire id, claiming one if needed.
+  // Returns: nullptr if all are claimed by other scopes.
+  Histogram* FindHistogram(uint32_t wire_id) {
+    for (size_t i = 0, index = wire_id & mask_; i <= mask_;
+         i++, index = (index + 1) & mask_) {
+      uint32_t slot_wire_id =
+          histograms_[index].wire_id.load(platform::memory_order_relaxed);
+      if (slot_wire_id == wire_id) {
+        return &histograms_[index];
+      }
+      if (!slot_wire_id) {
+        histograms_[index].wire_id.store(wire_id,
+                                         platform::memory_order_release);
+        return &histograms_[index];
+      }
+    }
+    return nullptr;
+  }
+
+  void CountDropped() {
+    dropped_scopes_.store(
+        dropped_scopes_.load(platform::memory_order_relaxed) + 1,
+        platform::memory_order_relaxed);
+  }
+
+  std::unique_ptr<Histogram[]> histograms_;
+  size_t mask_;
+  size_t depth_ = 0;
+  OpenScope stack_[kMaxDepth];
+  platform::atomic<uint32_t> dropped_scopes_{0};
+};
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_HISTOGRAM_H_
@@ -26,6 +26,29 @@
 #define WTF_NAMESPACE_DISABLE() \
   static constexpr bool kWtfEnabledForNamespace = false
 
+// Initializer for the events created by the macros. With constexpr
+// signatures, this is a StaticSignature for the name spec (a string literal),
+// carried to the template by a local type.
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+#define __INTERNAL_WTF_SIGNATURE(name_spec, ...)                             \
+  [] {                                                                       \
+    struct NameSpec {                                                        \
+      static constexpr const char* value() { return name_spec; }             \
+    };                                                                       \
+    return __INTERNAL_WTF_NAMESPACE::StaticSignature<NameSpec, __VA_ARGS__>{}; \
+  }()
+#define __INTERNAL_WTF_SIGNATURE0(name_spec)                        \
+  [] {                                                              \
+    struct NameSpec {                                               \
+      static constexpr const char* value() { return name_spec; }    \
+    };                                                              \
+    return __INTERNAL_WTF_NAMESPACE::StaticSignature<NameSpec>{};   \
+  }()
+#else
+#define __INTERNAL_WTF_SIGNATURE(name_spec, ...) name_spec
+#define __INTERNAL_WTF_SIGNATURE0(name_spec) name_spec
+#endif
+
 // Enables WTF tracing for a thread based on a condition.
 // Allowed Scopes: Within a function.
 #define WTF_THREAD_ENABLE_IF(condition, name)                              \
@@ -48,7 +71,7 @@
 //   WTF_EVENT0("MyClass#something_important");
 #define WTF_EVENT0(name_spec)                                       \
   static __INTERNAL_WTF_NAMESPACE::EventIf<kWtfEnabledForNamespace> \
-      __wtf_event0__##__LINE__{name_spec};                          \
+      __wtf_event0__##__LINE__{__INTERNAL_WTF_SIGNATURE0(name_spec)};  \
   __wtf_event0__##__LINE__.Invoke()
 
 // Shortcut to trace an event with arbitrary arguments.
@@ -61,7 +84,7 @@
 #define WTF_EVENT(name_spec, ...)                                     \
   static __INTERNAL_WTF_NAMESPACE::EventIf<                           \
       kWtfEnabledForNamespace, __VA_ARGS__> __wtf_eventn__##__LINE__{ \
-      name_spec};                                                     \
+      __INTERNAL_WTF_SIGNATURE(name_spec, __VA_ARGS__)};              \
   __wtf_eventn__##__LINE__.Invoke
 
 // Shortcut to trace a no-arg scope.
@@ -74,7 +97,7 @@
 //   WTF_SCOPE0("MyClass#MyMethod");
 #define WTF_SCOPE0(name_spec)                                             \
   static __INTERNAL_WTF_NAMESPACE::ScopedEventIf<kWtfEnabledForNamespace> \
-      __wtf_scope_event0_##__LINE__{name_spec};                           \
+      __wtf_scope_event0_##__LINE__{__INTERNAL_WTF_SIGNATURE0(name_spec)}; \
   __INTERNAL_WTF_NAMESPACE::AutoScopeIf<kWtfEnabledForNamespace>          \
       __wtf_scope0_##__LINE__{__wtf_scope_event0_##__LINE__};             \
   __wtf_scope0_##__LINE__.Enter()
@@ -90,9 +113,95 @@
 #define WTF_SCOPE(name_spec, ...)                                             \
   static __INTERNAL_WTF_NAMESPACE::ScopedEventIf<                             \
       kWtfEnabledForNamespace, __VA_ARGS__> __wtf_scope_eventn_##__LINE__{    \
-      name_spec};                                                             \
+      __INTERNAL_WTF_SIGNATURE(name_spec, __VA_ARGS__)};                      \
   __INTERNAL_WTF_NAMESPACE::AutoScopeIf<kWtfEnabledForNamespace, __VA_ARGS__> \
       __wtf_scopen_##__LINE__{__wtf_scope_eventn_##__LINE__};                 \
   __wtf_scopen_##__LINE__.Enter
 
+// Variants of the above that only record while a runtime category (an
+// EventCategory) is enabled. In a disabled namespace, they compile away like
+// the rest without checking the category.
+//
+// Example:
+//   WTF_EVENT_IN(gpu_category, "Gpu#submit: count", uint32_t)(count);
+//   WTF_SCOPE0_IN(gpu_category, "Gpu#Flush");
+#define WTF_EVENT0_IN(category, name_spec)                             \
+  static __INTERNAL_WTF_NAMESPACE::EventIf<kWtfEnabledForNamespace>    \
+      __wtf_category_event0__##__LINE__{                               \
+          __INTERNAL_WTF_SIGNATURE0(name_spec)};                       \
+  if (kWtfEnabledForNamespace && (category).enabled())                 \
+  __wtf_category_event0__##__LINE__.Invoke()
+
+#define WTF_EVENT_IN(category, name_spec, ...)                        \
+  static __INTERNAL_WTF_NAMESPACE::EventIf<kWtfEnabledForNamespace,   \
+                                           __VA_ARGS__>               \
+      __wtf_category_eventn__##__LINE__{                              \
+          __INTERNAL_WTF_SIGNATURE(name_spec, __VA_ARGS__)};          \
+  if (kWtfEnabledForNamespace && (category).enabled())                \
+  __wtf_category_eventn__##__LINE__.Invoke
+
+#define WTF_SCOPE0_IN(category, name_spec)                                \
+  static __INTERNAL_WTF_NAMESPACE::ScopedEventIf<kWtfEnabledForNamespace> \
+      __wtf_category_scope_event0_##__LINE__{                             \
+          __INTERNAL_WTF_SIGNATURE0(name_spec)};                          \
+  __INTERNAL_WTF_NAMESPACE::AutoScopeIf<kWtfEnabledForNamespace>          \
+      __wtf_category_scope0_##__LINE__{                                   \
+          __wtf_category_scope_event0_##__LINE__};                        \
+  if (kWtfEnabledForNamespace && (category).enabled())                    \
+  __wtf_category_scope0_##__LINE__.Enter()
+
+#define WTF_SCOPE_IN(category, name_spec, ...)                               \
+  static __INTERNAL_WTF_NAMESPACE::ScopedEventIf<kWtfEnabledForNamespace,    \
+                                                 __VA_ARGS__>                \
+      __wtf_category_scope_eventn_##__LINE__{                                \
+          __INTERNAL_WTF_SIGNATURE(name_spec, __VA_ARGS__)};                 \
+  __INTERNAL_WTF_NAMESPACE::AutoScopeIf<kWtfEnabledForNamespace, __VA_ARGS__> \
+      __wtf_category_scopen_##__LINE__{                                      \
+          __wtf_category_scope_eventn_##__LINE__};                           \
+  if (kWtfEnabledForNamespace && (category).enabled())                       \
+  __wtf_category_scopen_##__LINE__.Enter
+
+// Sampled variants of the above, for trace points too hot to record every
+// time. Only one in every sample_period invocations (starting with the
+// first) is recorded, subject to the per thread limit set with
+// Runtime::SetSampledEventRateLimit(). The sample period is recorded in the
+// event's flags (see EventFlags::Sampled()).
+//
+// Example:
+//   WTF_EVENT_SAMPLED("MyClass#hot: i", 1000, int32_t)(i);
+//   WTF_SCOPE0_SAMPLED("MyClass#HotMethod", 100);
+#define WTF_EVENT0_SAMPLED(name_spec, sample_period)                       \
+  static __INTERNAL_WTF_NAMESPACE::SampledEventIf<kWtfEnabledForNamespace> \
+      __wtf_sampled_event0__##__LINE__{                                    \
+          __INTERNAL_WTF_SIGNATURE0(name_spec), sample_period};            \
+  __wtf_sampled_event0__##__LINE__.Invoke()
+
+#define WTF_EVENT_SAMPLED(name_spec, sample_period, ...)                  \
+  static __INTERNAL_WTF_NAMESPACE::SampledEventIf<kWtfEnabledForNamespace, \
+                                                  __VA_ARGS__>            \
+      __wtf_sampled_eventn__##__LINE__{                                   \
+          __INTERNAL_WTF_SIGNATURE(name_spec, __VA_ARGS__), sample_period}; \
+  __wtf_sampled_eventn__##__LINE__.Invoke
+
+#define WTF_SCOPE0_SAMPLED(name_spec, sample_period)                    \
+  static __INTERNAL_WTF_NAMESPACE::SampledScopedEventIf<                \
+      kWtfEnabledForNamespace>                                          \
+      __wtf_sampled_scope_event0_##__LINE__{                            \
+          __INTERNAL_WTF_SIGNATURE0(name_spec), sample_period};         \
+  __INTERNAL_WTF_NAMESPACE::SampledAutoScopeIf<kWtfEnabledForNamespace> \
+      __wtf_sampled_scope0_##__LINE__{                                  \
+          __wtf_sampled_scope_event0_##__LINE__};                       \
+  __wtf_sampled_scope0_##__LINE__.Enter()
+
+#define WTF_SCOPE_SAMPLED(name_spec, sample_period, ...)                  \
+  static __INTERNAL_WTF_NAMESPACE::SampledScopedEventIf<                  \
+      kWtfEnabledForNamespace, __VA_ARGS__>                               \
+      __wtf_sampled_scope_eventn_##__LINE__{                              \
+          __INTERNAL_WTF_SIGNATURE(name_spec, __VA_ARGS__), sample_period}; \
+  __INTERNAL_WTF_NAMESPACE::SampledAutoScopeIf<kWtfEnabledForNamespace,   \
+                                               __VA_ARGS__>               \
+      __wtf_sampled_scopen_##__LINE__{                                    \
+          __wtf_sampled_scope_eventn_##__LINE__};                         \
+  __wtf_sampled_scopen_##__LINE__.Enter
+
 #endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_MACROS_H_
@@ -2,6 +2,7 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 namespace wtf {
@@ -20,6 +21,22 @@ void PlatformInitializeThreading();
 // from the call to PlatformSetTimestampEpoch().
 uint32_t PlatformGetTimestampMicros32();
 
+// Gets the same timestamp as PlatformGetTimestampMicros32() without
+// truncation, so that it does not wrap after 2^32 micros (~71 minutes).
+uint64_t PlatformGetTimestampMicros64();
+
+// Gets the index of the CPU that the calling thread runs on, which may change
+// by the time it is used. Always less than PlatformGetCpuCount().
+uint32_t PlatformGetCurrentCpu();
+
+// Gets the number of CPUs that threads may run on (at least 1).
+size_t PlatformGetCpuCount();
+
+// Copies size bytes that another core (e.g. a Myriad2 SHAVE) has written
+// into dst, by DMA where the platform has it. Only used to drain
+// ShaveEventRings.
+void PlatformCopyFromCoprocessor(void* dst, const void* src, size_t size);
+
 // Gets the EventBuffer* for a thread (which may be nullptr).
 EventBuffer* PlatformGetThreadLocalEventBuffer();
 
@@ -42,6 +59,8 @@ void PlatformSetThreadLocalEventBuffer(EventBuffer* event_buffer);
 // Select threading library.
 #if defined(WTF_SINGLE_THREADED)
 #include "wtf/platform/platform_aux_single_threaded_inl.h"
+#elif defined(WTF_TLS_THREADED)
+#include "wtf/platform/platform_aux_tls_threaded_inl.h"
 #else
 #include "wtf/platform/platform_aux_std_threaded_inl.h"
 #endif
@@ -6,7 +6,11 @@ namespace wtf {
 // In this configuration, we provide skeletons of atomics and mutexes that
 // no-op.
 namespace platform {
-struct mutex {};
+struct mutex {
+  void lock() {}
+  void unlock() {}
+  bool try_lock() { return true; }
+};
 
 template <typename T>
 struct lock_guard {
@@ -15,6 +19,12 @@ struct lock_guard {
   T& mutex;
 };
 
+enum memory_order {
+  memory_order_relaxed,
+  memory_order_acquire,
+  memory_order_release,
+};
+
 template <typename T>
 struct atomic {
   T fetch_add(T increment) {
@@ -22,10 +32,24 @@ struct atomic {
     return value;
   }
 
-  void store(T new_value) { value = new_value; }
+  T load(memory_order = memory_order_relaxed) const { return value; }
+  void store(T new_value, memory_order = memory_order_relaxed) {
+    value = new_value;
+  }
+  bool compare_exchange_strong(T& expected, T desired,
+                               memory_order = memory_order_relaxed) {
+    if (value != expected) {
+      expected = value;
+      return false;
+    }
+    value = desired;
+    return true;
+  }
 
   T value;
 };
+
+inline void atomic_thread_fence(memory_order) {}
 }  // namespace platform
 
 namespace internal {
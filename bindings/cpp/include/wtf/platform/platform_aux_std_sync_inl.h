@@ -0,0 +1,41 @@
+// Provides the platform synchronization primitives by way of the C++
+// standard library. Shared by the threading models that use real threads.
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_STD_SYNC_INL_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_STD_SYNC_INL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace wtf {
+
+// On this platform, use the standard-library versions of atomics and mutexes.
+namespace platform {
+using mutex = std::mutex;
+
+template <typename T>
+using lock_guard = std::lock_guard<T>;
+
+template <typename T>
+using unique_lock = std::unique_lock<T>;
+
+using condition_variable = std::condition_variable;
+using thread = std::thread;
+
+template <typename T>
+using atomic = std::atomic<T>;
+
+using memory_order = std::memory_order;
+constexpr memory_order memory_order_relaxed = std::memory_order_relaxed;
+constexpr memory_order memory_order_acquire = std::memory_order_acquire;
+constexpr memory_order memory_order_release = std::memory_order_release;
+
+inline void atomic_thread_fence(memory_order order) {
+  std::atomic_thread_fence(order);
+}
+}  // namespace platform
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_STD_SYNC_INL_H_
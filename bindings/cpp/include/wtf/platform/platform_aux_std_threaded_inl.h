@@ -4,24 +4,12 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_STD_THREADED_INL_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_STD_THREADED_INL_H_
 
-#include <atomic>
-#include <mutex>
-
 // TODO(wcraddock, laurenzo): Begin using the C++11 thread interface.
 #include <pthread.h>
 
-namespace wtf {
-
-// On this platform, use the standard-library versions of atomics and mutexes.
-namespace platform {
-using mutex = std::mutex;
+#include "wtf/platform/platform_aux_std_sync_inl.h"
 
-template <typename T>
-using lock_guard = std::lock_guard<T>;
-
-template <typename T>
-using atomic = std::atomic<T>;
-}  // namespace platform
+namespace wtf {
 
 namespace internal {
 extern pthread_key_t event_buffer_key;
@@ -0,0 +1,42 @@
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_TLS_THREADED_IMPL_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_TLS_THREADED_IMPL_H_
+
+#include "wtf/buffer.h"
+
+namespace wtf {
+
+namespace internal {
+thread_local EventBuffer* thread_event_buffer
+    __attribute__((tls_model("initial-exec"))) = nullptr;
+pthread_key_t event_buffer_key;
+pthread_once_t initialize_threading_once = PTHREAD_ONCE_INIT;
+
+void EventBufferDtor(void* event_buffer) {
+  // Like the key, the thread local no longer refers to the buffer, which may
+  // be handed to another thread from now on.
+  thread_event_buffer = nullptr;
+  static_cast<EventBuffer*>(event_buffer)->MarkOutOfScope();
+}
+
+void InitializeThreadingOnce() {
+  pthread_key_create(&event_buffer_key, EventBufferDtor);
+  PlatformInitialize();
+}
+}  // namespace internal
+
+void PlatformInitializeThreading() {
+  pthread_once(&internal::initialize_threading_once,
+               internal::InitializeThreadingOnce);
+}
+
+void PlatformSetThreadLocalEventBuffer(EventBuffer* event_buffer) {
+  pthread_once(&internal::initialize_threading_once,
+               internal::InitializeThreadingOnce);
+  internal::thread_event_buffer = event_buffer;
+  // The key value is only consulted by the destructor at thread exit.
+  pthread_setspecific(internal::event_buffer_key, event_buffer);
+}
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_TLS_THREADED_IMPL_H_
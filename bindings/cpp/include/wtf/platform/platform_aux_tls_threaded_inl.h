@@ -0,0 +1,29 @@
+// Provides the PlatformGetThreadLocalEventBuffer() function by way of a C++11
+// thread_local using the initial-exec TLS model, which reduces the lookup to
+// a single load relative to the thread pointer. A pthread key is still
+// registered, but only so that its destructor can mark the EventBuffer as
+// out of scope at thread exit.
+//
+// Note that initial-exec TLS draws from a small static reserve when the
+// library is loaded via dlopen(). Use the std_threaded model in that case.
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_TLS_THREADED_INL_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_TLS_THREADED_INL_H_
+
+#include <pthread.h>
+
+#include "wtf/platform/platform_aux_std_sync_inl.h"
+
+namespace wtf {
+
+namespace internal {
+extern thread_local EventBuffer* thread_event_buffer
+    __attribute__((tls_model("initial-exec")));
+}  // namespace internal
+
+inline EventBuffer* PlatformGetThreadLocalEventBuffer() {
+  return internal::thread_event_buffer;
+}
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_AUX_TLS_THREADED_INL_H_
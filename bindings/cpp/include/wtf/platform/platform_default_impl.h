@@ -1,16 +1,76 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_DEFAULT_IMPL_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_DEFAULT_IMPL_H_
 
+#if defined(WTF_USE_CYCLE_COUNTER) && defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
 #include "wtf/buffer.h"
 
 namespace wtf {
 
 namespace internal {
 uint64_t base_timestamp_nanos = 0;
+
+#if defined(WTF_USE_CYCLE_COUNTER)
+bool use_cycle_counter = false;
+uint64_t base_cycles = 0;
+uint64_t micros_per_cycle = 0;
+
+// Gets the frequency of the cycle counter in Hz, or 0 if it is not usable
+// as a time source.
+uint64_t GetCycleCounterFrequency() {
+#if defined(__x86_64__)
+  // The TSC only ticks at a constant rate across P/C-states if the CPU
+  // reports it as invariant (CPUID.80000007H:EDX[8]).
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) ||
+      !(edx & (1u << 8))) {
+    return 0;
+  }
+
+  // Calibrate against CLOCK_MONOTONIC.
+  static const long kCalibrationNanos = 10000000;
+  uint64_t start_nanos = GetNanoTime();
+  uint64_t start_cycles = GetCycleCount();
+  struct timespec ts = {0, kCalibrationNanos};
+  nanosleep(&ts, nullptr);
+  uint64_t elapsed_nanos = GetNanoTime() - start_nanos;
+  uint64_t elapsed_cycles = GetCycleCount() - start_cycles;
+  if (elapsed_nanos == 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(static_cast<unsigned __int128>(elapsed_cycles) *
+                               kNanosecondsPerSecond / elapsed_nanos);
+#else
+  // The generic timer frequency is fixed by firmware and reported directly.
+  uint64_t frequency;
+  asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+  return frequency;
+#endif
+}
+
+void InitializeCycleCounter() {
+  uint64_t frequency = GetCycleCounterFrequency();
+  if (frequency < 1000000) {
+    // Unusable or implausibly slow: fall back to clock_gettime().
+    use_cycle_counter = false;
+    return;
+  }
+  micros_per_cycle = (static_cast<unsigned __int128>(1000000) << kCycleShift) /
+                     frequency;
+  base_timestamp_nanos = GetNanoTime();
+  base_cycles = GetCycleCount();
+  use_cycle_counter = true;
+}
+#endif  // WTF_USE_CYCLE_COUNTER
 }  // namespace internal
 
 void PlatformInitialize() {
   internal::base_timestamp_nanos = internal::GetNanoTime();
+#if defined(WTF_USE_CYCLE_COUNTER)
+  internal::InitializeCycleCounter();
+#endif
 }
 
 }  // namespace wtf
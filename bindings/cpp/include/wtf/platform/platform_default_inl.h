@@ -1,7 +1,24 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_DEFAULT_INL_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_DEFAULT_INL_H_
 
+#include <sched.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+// Traces can be written straight to file descriptors.
+#define WTF_PLATFORM_HAS_FILE_DESCRIPTORS 1
+
+// The cycle counter timestamp source is opt-in via the
+// WTF_CYCLE_COUNTER_TIMESTAMPS define and only available on architectures
+// with a user readable, constant rate counter.
+#if defined(WTF_CYCLE_COUNTER_TIMESTAMPS) && \
+    (defined(__x86_64__) || defined(__aarch64__))
+#define WTF_USE_CYCLE_COUNTER 1
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#endif
 
 namespace wtf {
 
@@ -17,12 +34,70 @@ inline uint64_t GetNanoTime() {
          static_cast<uint64_t>(ts.tv_nsec);
 }
 
+#if defined(WTF_USE_CYCLE_COUNTER)
+// Like the Myriad TIM0 ticks, cycles are converted to micros relative to a
+// base count taken at PlatformInitialize(). The conversion is a fixed-point
+// multiply by micros_per_cycle (scaled by 2^kCycleShift) instead of a divide.
+static const int kCycleShift = 32;
+extern bool use_cycle_counter;
+extern uint64_t base_cycles;
+extern uint64_t micros_per_cycle;
+
+__attribute__((always_inline)) inline uint64_t GetCycleCount() {
+#if defined(__x86_64__)
+  return __rdtsc();
+#else
+  uint64_t value;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+  return value;
+#endif
+}
+#endif  // WTF_USE_CYCLE_COUNTER
+
 }  // namespace internal
 
-inline uint32_t PlatformGetTimestampMicros32() {
+inline uint64_t PlatformGetTimestampMicros64() {
+#if defined(WTF_USE_CYCLE_COUNTER)
+  if (internal::use_cycle_counter) {
+    uint64_t cycles = internal::GetCycleCount() - internal::base_cycles;
+    return static_cast<uint64_t>(
+        (static_cast<unsigned __int128>(cycles) * internal::micros_per_cycle) >>
+        internal::kCycleShift);
+  }
+#endif
   return (internal::GetNanoTime() - internal::base_timestamp_nanos) / 1000;
 }
 
+inline uint32_t PlatformGetTimestampMicros32() {
+  return static_cast<uint32_t>(PlatformGetTimestampMicros64());
+}
+
+inline size_t PlatformGetCpuCount() {
+  static const size_t cpu_count = [] {
+    long count = sysconf(_SC_NPROCESSORS_CONF);
+    return count > 0 ? static_cast<size_t>(count) : size_t{1};
+  }();
+  return cpu_count;
+}
+
+// With a recent glibc, sched_getcpu() reads the CPU that the kernel keeps in
+// the thread's restartable sequence area, so it costs a load. Elsewhere, all
+// threads share the first buffer.
+inline uint32_t PlatformGetCurrentCpu() {
+#if defined(__linux__)
+  int cpu = sched_getcpu();
+  return cpu >= 0 ? static_cast<uint32_t>(cpu) % PlatformGetCpuCount() : 0;
+#else
+  return 0;
+#endif
+}
+
+// Other cores share the memory, so this is a plain copy.
+inline void PlatformCopyFromCoprocessor(void* dst, const void* src,
+                                        size_t size) {
+  memcpy(dst, src, size);
+}
+
 }  // namespace wtf
 
 #endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_DEFAULT_INL_H_
@@ -1,7 +1,9 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_MYRIAD2SPARC_IMPL_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_MYRIAD2SPARC_IMPL_H_
 
+#include <DrvCmxDma.h>
 #include <DrvCpr.h>
+#include <rtems.h>
 
 #include "wtf/buffer.h"
 
@@ -11,6 +13,7 @@ namespace internal {
 pthread_once_t platform_initialize_once_key = PTHREAD_ONCE_INIT;
 uint64_t base_ticks = 0;
 uint64_t sysclks_per_us = 1;  // Avoid divide by zero.
+dmaRequesterId dma_requester_id;
 
 void PlatformInitializeOnce() {
   // Initialize timer.
@@ -23,6 +26,10 @@ void PlatformInitializeOnce() {
     internal::sysclks_per_us = 1;
   }
   PlatformAuxInitializeThreading();
+
+  // DMA engine for draining SHAVE event rings.
+  DrvCmxDmaInitDefault();
+  internal::dma_requester_id = DrvCmxDmaInitRequester(1);
 }
 
 }  // namespace internal
@@ -32,6 +39,19 @@ void PlatformInitialize() {
                internal::PlatformInitializeOnce);
 }
 
+void PlatformCopyFromCoprocessor(void* dst, const void* src, size_t size) {
+  // Drains are serialized by the runtime, so one transaction suffices.
+  static dmaTransactionList_t transaction;
+  dmaTransactionList_t* task = DrvCmxDmaCreateTransaction(
+      internal::dma_requester_id, &transaction,
+      static_cast<uint8_t*>(const_cast<void*>(src)),
+      static_cast<uint8_t*>(dst), size);
+  DrvCmxDmaStartListTask(task);
+  DrvCmxDmaWaitTask(task);
+  // The DMA engine bypassed the LEON data cache.
+  rtems_cache_invalidate_multiple_data_lines(dst, size);
+}
+
 }  // namespace wtf
 
 #endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_MYRIAD2_SPARC_IMPL_H_
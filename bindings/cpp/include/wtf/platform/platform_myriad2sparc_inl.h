@@ -3,8 +3,8 @@
 // reasons:
 //   - The cycle timer is lower overhead and more precise than the Posix
 //     time APIs.
-//   - This implementation can be extended to support tracing buffers on
-//     SHAVEs.
+//   - SHAVEs trace into buffers of their own (see wtf/shave.h), which are
+//     drained through the CMX DMA engine.
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_MYRIAD2SPARC_INL_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_MYRIAD2SPARC_INL_H_
 
@@ -36,11 +36,19 @@ __attribute__((always_inline)) inline uint64_t PlatformGetTickCount64() {
 
 }  // namespace internal
 
-__attribute__((always_inline)) inline uint32_t PlatformGetTimestampMicros32() {
+__attribute__((always_inline)) inline uint64_t PlatformGetTimestampMicros64() {
   uint64_t ticks = internal::PlatformGetTickCount64() - internal::base_ticks;
-  return static_cast<uint32_t>(ticks / internal::sysclks_per_us);
+  return ticks / internal::sysclks_per_us;
 }
 
+__attribute__((always_inline)) inline uint32_t PlatformGetTimestampMicros32() {
+  return static_cast<uint32_t>(PlatformGetTimestampMicros64());
+}
+
+// Threads are only supported on the LEON core that runs the RTOS.
+inline uint32_t PlatformGetCurrentCpu() { return 0; }
+inline size_t PlatformGetCpuCount() { return 1; }
+
 }  // namespace wtf
 
 #endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_PLATFORM_MYRIAD2SPARC_INL_H_
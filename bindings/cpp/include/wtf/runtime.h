@@ -1,13 +1,21 @@
 #ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_RUNTIME_H_
 #define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_RUNTIME_H_
 
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "wtf/buffer.h"
+#include "wtf/compact.h"
+#include "wtf/compress.h"
 #include "wtf/event.h"
+#include "wtf/histogram.h"
 #include "wtf/platform.h"
+#include "wtf/shave_drain.h"
 
 namespace wtf {
 
@@ -27,24 +35,214 @@ class Runtime {
   void EnableCurrentThread(const char* thread_name, const char* type = nullptr,
                            const char* location = nullptr);
 
+  // Enables flight recorder mode for threads enabled from now on: each
+  // thread keeps only its most recent events, overwriting the oldest once it
+  // holds bytes_per_thread of them (0 to disable). Save() then writes the
+  // current window, along with the zones and strings that it refers to.
+  void SetFlightRecorderBudget(size_t bytes_per_thread);
+
+  // Limits the sampled events (WTF_EVENT_SAMPLED and WTF_SCOPE_SAMPLED) of
+  // each thread enabled from now on to events_per_second, with bursts of up
+  // to burst events (0 to disable). Sampled events beyond the limit are
+  // dropped.
+  void SetSampledEventRateLimit(uint32_t events_per_second, uint32_t burst);
+
+  // Makes threads enabled from now on log into buffers shared by all threads
+  // running on the same CPU (see CpuEventBuffers) instead of buffers of
+  // their own, so that many threads, or threads that come and go, cost
+  // memory and save time by the core count. Each event takes the lock of its
+  // CPU's buffer and, after an event of another thread, a wtf.zone#set.
+  // Flight recorder mode does not apply to these threads.
+  void SetPerCpuBuffers(bool per_cpu);
+
+  // Adds a zone for the events that a SHAVE appends to ring (see
+  // wtf/shave.h), which is set up here to keep them in capacity entries. The
+  // SHAVE may start appending once this returns. Its events are moved into
+  // the zone by DrainShaveEventRings().
+  void AddShaveEventRing(ShaveEventRing* ring, uint32_t* entries,
+                         uint32_t capacity, const char* name);
+
+  // Drains ring a last time and stops draining it. The SHAVE must have
+  // stopped appending. The zone's events are kept until saved or streamed.
+  void RemoveShaveEventRing(ShaveEventRing* ring);
+
+  // Moves the events that the SHAVEs have committed into their zones. Save,
+  // SaveIncremental and the streaming writer do this first, but it should
+  // also be called periodically (e.g. once per frame) so that the rings do
+  // not fill up.
+  void DrainShaveEventRings();
+
+  // Aggregates the scopes (WTF_SCOPE0 and WTF_SCOPE, also in categories) of
+  // threads enabled from now on into per thread histograms of their
+  // durations, instead of recording their enter and leave events. Each
+  // thread gets histograms for up to max_scopes distinct scopes (about 2KB
+  // each); 0 turns aggregation off for threads enabled afterwards. Event
+  // chunks then start with a wtf.scope#summary event per scope, summarizing
+  // its durations so far across all threads.
+  void SetScopeAggregation(size_t max_scopes);
+
+  // Durations of an aggregated scope, merged across threads.
+  struct ScopeHistogram {
+    uint32_t wire_id;
+    std::string name;
+    DurationHistogram durations;
+  };
+
+  // Gets the durations of every scope aggregated so far, in the order that
+  // the scopes were registered. Threads may keep recording meanwhile.
+  std::vector<ScopeHistogram> GetScopeHistograms();
+
+  // What tracing costs: per buffer counts, lock contention and the phases
+  // of the last event chunk that was saved or streamed.
+  struct BufferStats {
+    // Zone of the thread (or SHAVE), or 0 for a per CPU buffer.
+    int zone_id;
+    std::string name;
+    // Events stored in the buffer, zone events included. With per CPU
+    // buffers, events are counted by the CPU buffer that stores them, not by
+    // the thread's forwarding buffer, so the counts add up to the total.
+    uint64_t events;
+    // Memory held in event blocks.
+    size_t bytes;
+    uint64_t block_allocations;
+    // Strings that missed the thread's cache and went to the string table.
+    uint64_t string_table_lookups;
+    // Events dropped by the memory budget and by the sampled event rate
+    // limit.
+    uint32_t dropped_events;
+    uint32_t rate_limited_events;
+  };
+  struct SaveStats {
+    // Event chunks saved or streamed so far.
+    uint64_t chunks = 0;
+    // Phases of the last one: snapshotting the buffers, serializing the
+    // event definitions (and scope summaries), laying out the parts
+    // (including compact encoding) and writing them out.
+    uint32_t snapshot_micros = 0;
+    uint32_t definitions_micros = 0;
+    uint32_t layout_micros = 0;
+    uint32_t write_micros = 0;
+  };
+  struct Stats {
+    std::vector<BufferStats> buffers;
+    // Times that interning a string or taking the runtime's lock (enabling
+    // threads, saving) had to wait for another thread.
+    uint64_t string_table_contentions = 0;
+    uint64_t runtime_contentions = 0;
+    SaveStats last_save;
+  };
+
+  // Gets the runtime's overhead so far. Threads may keep logging meanwhile.
+  Stats GetStats();
+
+  // Sets whether each event chunk starts with the runtime's stats, outside
+  // of any zone: a wtf.runtime#stats event per buffer and a
+  // wtf.runtime#saveStats event with the phases of the previous chunk.
+  void SetStatsEvents(bool enabled);
+
+  // Sets whether event chunks are saved with the thread events in the
+  // compact encoding of CompactEventEncoder, which is typically a fraction of
+  // the size (event definitions are kept standard). Tools that do not know
+  // compact event parts need the trace rewritten by ExpandCompactTrace().
+  void SetCompactEncoding(bool compact);
+
+  // Sets whether Save() and SaveToFile() retire the buffers of exited
+  // threads once they have written all of their events, so that the buffers
+  // are reused by new threads as when streaming. Later saves then no longer
+  // include the events of those threads. Off by default, in which case such
+  // buffers are only reclaimed by streaming.
+  void SetReclaimSavedThreadBuffers(bool reclaim);
+
+  // Compresses each event chunk saved or streamed from now on with
+  // compressor (nullptr to stop), e.g. an Lz4Compressor. Compression runs on
+  // the saving thread (the writer thread when streaming), never on traced
+  // threads. File headers written meanwhile carry the has_compressed_chunks
+  // flag. Tools that do not read LZ4 chunks can be given the output of
+  // DecompressTrace().
+  void SetCompressor(std::unique_ptr<Compressor> compressor);
+
   // Disables WTF data collection for this thread. Note that any collected
   // data will still be present. This is largely intended for testing.
   void DisableCurrentThread();
 
-  // Saves the current WTF trace file for all threads. This is mostly non
-  // disruptive to concurrent operations, but there are a couple of sync
-  // points that are unavoidable.
+  // Saves the current WTF trace file for all threads. Threads may keep
+  // logging while this runs: each thread's events are snapshotted at an event
+  // boundary without blocking the thread. The only sync points are the
+  // runtime and string table locks, which logging threads take when enabling
+  // and when interning strings.
   // Returns: Whether the trace was saved properly (covers both logical and
   // IO errors).
   bool Save(std::ostream* out);
 
-  // Shortcut to Save(ostream) that saves to a file.
+  // Shortcut to Save(ostream) that saves to a file. Where available, the file
+  // is written through a memory mapping, leaving write back to the page
+  // cache.
   // Returns: Whether the trace was saved properly (covers both logical and
   // IO errors).
   bool SaveToFile(const std::string& file_name);
 
+  // Progress of a trace through the runtime's state, so that successive
+  // event chunks only carry what is new. The fields are managed by the
+  // runtime: start from a default constructed cursor.
+  struct SaveCursor {
+    bool started = false;
+    int first_string_id = 0;
+    // End of the previous chunk's event definitions.
+    EventBuffer::Position definitions_position;
+    uint32_t next_chunk_id = 2;
+    uint32_t start_time = 0;
+    uint64_t time_origin = 0;
+    // Where the previous chunk left off in each thread, by zone id (and in
+    // each CPU buffer, by -1 - its index).
+    std::unordered_map<int, EventBuffer::Position> positions;
+  };
+
+  // Saves what has been collected since the previous call with the same
+  // cursor: the first call writes the file header and a chunk with
+  // everything, later ones a chunk with only the events, strings and event
+  // definitions added since. Appending the output of successive calls thus
+  // makes up one growing trace. Nothing is consumed, so Save() and other
+  // cursors still see all of the data.
+  // Returns: Whether the chunk was saved properly (covers both logical and
+  // IO errors).
+  bool SaveIncremental(std::ostream* out, SaveCursor* cursor);
+
+#if !defined(WTF_SINGLE_THREADED)
+  // Sets how many threads (including the caller) SaveToFile() spreads the
+  // copying of thread and string data over when the file is mapped. The
+  // default of 1 copies everything on the calling thread. This only pays off
+  // with idle cores to spare and traces of several megabytes.
+  void SetSaveThreadCount(size_t thread_count);
+
+  struct StreamingOptions {
+    // How often collected events are written out.
+    uint32_t flush_interval_millis = 100;
+    // Upper bound on the memory used for the events of threads (0 for no
+    // limit); event definitions are not counted. Once half of it is in use,
+    // a flush is started early. Events that do not fit are dropped.
+    size_t memory_budget_bytes = 0;
+  };
+
+  // Starts writing the trace to out from a background thread. Each flush
+  // writes the events collected since the previous one as a new chunk, along
+  // with the strings and event definitions added since, and then recycles
+  // the event storage. Save() may still be called but only includes events
+  // that have not been streamed yet.
+  // Returns: false if already streaming.
+  bool StartStreaming(std::ostream* out, const StreamingOptions& options);
+
+  // Shortcut to StartStreaming(ostream) that streams to a file.
+  bool StartStreamingToFile(const std::string& file_name,
+                            const StreamingOptions& options);
+
+  // Flushes any remaining events and stops the background writer.
+  // Returns: Whether the whole stream was written properly.
+  bool StopStreaming();
+#endif
+
   // Resets the WTF runtime state. This is intended for testing and may fail
   // or cause crashes if called when asynchronous logging is not quiesced.
+  // Note that StaticString ids cached by events are not reset.
   void ResetForTesting();
 
  private:
@@ -52,16 +250,147 @@ class Runtime {
   Runtime(const Runtime&) = delete;
   void operator=(const Runtime&) = delete;
 
-  // Creates an EventBuffer bound for a thread local, and adds it to the list
-  // of owned instances.
-  EventBuffer* CreateThreadEventBuffer();
+  // Creates an EventBuffer bound for a thread local, reusing one reclaimed
+  // from an exited thread if possible. It is only added to the list of
+  // owned instances once its zone is set, so that readers always see the
+  // zone. With per CPU buffers, this is a forwarding buffer. mu_ must be
+  // held.
+  std::unique_ptr<EventBuffer> CreateThreadEventBuffer();
+
+  // Moves the given thread event buffers, which must have been Reset(), to
+  // the free list.
+  void ReclaimThreadEventBuffers(
+      const std::vector<EventBuffer*>& event_buffers);
+
+  // Saves the trace to an OutputBuffer, which is flushed.
+  bool Save(OutputBuffer* output_buffer);
+
+  // Makes a copy of the thread event buffers, followed by the CPU buffers.
+  std::vector<EventBuffer*> GetThreadEventBuffers();
+
+  // Gets the 64bit time that event times are relative to: the earliest
+  // event still held by event_buffers (only meaningful with
+  // WTF_64BIT_TIMESTAMPS).
+  uint64_t GetTimeOrigin(const std::vector<EventBuffer*>& event_buffers);
 
-  // Writes the header chunk.
-  void WriteHeaderChunk(OutputBuffer* output_buffer);
+  // Writes the header chunk. incremental indicates that the trace consists
+  // of event chunks whose string tables only carry new strings. save_mu_
+  // must be held.
+  void WriteHeaderChunk(OutputBuffer* output_buffer, uint64_t time_origin,
+                        bool incremental);
+
+  // Starts definitions_buffer_ over, empty.
+  void ResetDefinitions();
+
+  // Serializes the event definitions registered since the last call into
+  // definitions_buffer_, and notes their compact layouts. save_mu_ must be
+  // held.
+  void DefineNewEvents();
+
+  // Writes an event chunk with everything in event_buffers that is past the
+  // cursor, and advances the cursor. If consume is true, the written events
+  // are consumed from their buffers, otherwise the cursor notes where each
+  // buffer's part ended. If consume_exited is true (only for a chunk that
+  // starts at the beginning of each buffer), the buffers of threads that had
+  // exited are consumed once the chunk is written properly. Buffers of exited
+  // threads that are left with nothing unconsumed are reclaimed. save_mu_
+  // must be held.
+  // Returns: Whether the chunk was written properly.
+  bool WriteEventsChunk(OutputBuffer* output_buffer,
+                        const std::vector<EventBuffer*>& event_buffers,
+                        SaveCursor* cursor, bool consume,
+                        bool consume_exited);
+
+  // A piece of a chunk's data: the writer writes length bytes (including
+  // alignment) to the OutputBuffer that it is given.
+  struct PartWriter {
+    size_t length;
+    std::function<bool(OutputBuffer*)> write;
+  };
+
+  // Writes the pieces in order. With a mapped output_buffer and more than
+  // one save thread, each piece gets its own range of the output and the
+  // pieces are written in parallel. save_mu_ must be held.
+  // Returns: Whether all pieces were written properly.
+  bool WriteParts(OutputBuffer* output_buffer,
+                  const std::vector<PartWriter>& part_writers);
+
+#if !defined(WTF_SINGLE_THREADED)
+  // Body of the background writer thread.
+  void StreamingThreadMain();
+
+  // Wakes the background writer to flush ahead of schedule.
+  void RequestFlush();
+#endif
 
   platform::mutex mu_;
+  platform::atomic<uint64_t> mu_contentions_{0};
+  // Serializes readers of the event buffers (Save and streaming).
+  platform::mutex save_mu_;
   StringTable shared_string_table_;
+  EventBlockPool block_pool_;
+  // Blocks of the unbounded buffers (event definitions and summaries), kept
+  // apart so that they neither count against the memory budget nor trigger
+  // flushes.
+  EventBlockPool unbounded_block_pool_;
   std::vector<std::unique_ptr<EventBuffer>> thread_event_buffers_;
+  // Buffers of exited threads, ready for reuse.
+  std::vector<std::unique_ptr<EventBuffer>> free_event_buffers_;
+  // wtf.event#define events for the first defined_event_count_ registered
+  // events, extended as more are registered. Guarded by save_mu_.
+  std::unique_ptr<EventBuffer> definitions_buffer_;
+  size_t defined_event_count_ = 0;
+  // Layouts of the defined events by wire id. Guarded by save_mu_.
+  std::unordered_map<uint32_t, CompactEventEncoder::Layout> compact_layouts_;
+  // Guarded by save_mu_.
+  bool compact_encoding_ = false;
+  // Guarded by save_mu_.
+  bool reclaim_saved_buffers_ = false;
+  // Guarded by save_mu_.
+  std::unique_ptr<Compressor> compressor_;
+  // Guarded by save_mu_.
+  bool stats_events_ = false;
+  // Phases of the last event chunk. Guarded by stats_mu_, so that stats can
+  // be read while a save is running.
+  platform::mutex stats_mu_;
+  SaveStats last_save_stats_;
+  // Ring size of new thread event buffers in blocks (0 for unbounded).
+  size_t ring_blocks_ = 0;
+  // Rate limit of new thread event buffers' sampled events (0 for none).
+  uint32_t rate_limit_per_second_ = 0;
+  uint32_t rate_limit_burst_ = 0;
+  // Histogram count of new thread event buffers' scope aggregators (0 for
+  // none).
+  size_t max_aggregated_scopes_ = 0;
+  // Aggregators taken from reused buffers while aggregation was off, kept
+  // for their durations.
+  std::vector<std::unique_ptr<ScopeAggregator>> retired_scope_aggregators_;
+  // Whether new threads log into CPU buffers, created on first use, through
+  // forwarding buffers of their own.
+  bool per_cpu_buffers_ = false;
+  std::unique_ptr<CpuEventBuffers> cpu_event_buffers_;
+  std::vector<std::unique_ptr<EventBuffer>> forwarding_event_buffers_;
+  // Drains of the SHAVE event rings, into buffers among
+  // thread_event_buffers_. Guarded by shave_mu_, which serializes drains.
+  platform::mutex shave_mu_;
+  std::vector<std::unique_ptr<ShaveEventDrain>> shave_drains_;
+#if !defined(WTF_SINGLE_THREADED)
+  // Guarded by save_mu_.
+  size_t save_thread_count_ = 1;
+#endif
+
+#if !defined(WTF_SINGLE_THREADED)
+  // Streaming state. stream_mu_ guards the stop and flush requests.
+  platform::mutex stream_mu_;
+  platform::condition_variable stream_cv_;
+  platform::thread stream_thread_;
+  std::ostream* stream_out_ = nullptr;
+  std::unique_ptr<std::ofstream> stream_file_;
+  StreamingOptions stream_options_;
+  bool stream_stop_ = false;
+  bool stream_flush_requested_ = false;
+  bool stream_success_ = false;
+#endif
 };
 
 }  // namespace wtf
@@ -0,0 +1,141 @@
+// Tracing from Myriad2 SHAVE cores.
+//
+// SHAVE kernels cannot use the runtime: they have no threads, no locks and
+// no business interning strings. Instead, each SHAVE appends events to a
+// ShaveEventRing of its own, which the LOS drains into a zone of the trace
+// (see Runtime::AddShaveEventRing()). Events are defined on the LOS as usual
+// and their wire ids handed to the kernels, which only write integers.
+//
+// This header is meant to be compiled for the SHAVEs as well, so it depends
+// on nothing but the MDK register definitions there.
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_SHAVE_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_SHAVE_H_
+
+#include <stdint.h>
+
+#if defined(__shave__)
+#include <DrvRegUtils.h>
+#include <registersMyriad.h>
+#else
+// Elsewhere (e.g. on the host, for testing), the ring is written with the
+// runtime's clock.
+#include "wtf/platform.h"
+#endif
+
+namespace wtf {
+
+// Wire id of wtf.scope#leave (StandardEvents::kScopeLeaveEventId).
+constexpr uint32_t kShaveScopeLeaveWireId = 2;
+
+// Largest event, in entries (wire id, timestamp and arguments), that an
+// EventBuffer can hold (EventBlock::kMaxEventEntries).
+constexpr uint32_t kShaveMaxEventEntries = 256;
+
+// Single producer, single consumer ring of events, shared between a SHAVE
+// (the producer) and the LOS. Each record is an event in the wire format
+// (wire id, timestamp and arguments) preceded by its entry count, so that
+// the LOS can copy events without knowing their definitions.
+//
+// The ring and its entries must be placed where both sides see each other's
+// writes without cache maintenance, e.g. in CMX, and addressed through the
+// global address space. The LOS sets it up; the SHAVE only appends.
+struct ShaveEventRing {
+  // Set up by the LOS before the SHAVE starts.
+  uint32_t* entries;
+  uint32_t capacity_mask;
+  // Base of the TIM0 free running counter and its ticks per microsecond, so
+  // that SHAVE timestamps match those of the LOS.
+  uint64_t base_ticks;
+  uint32_t sysclks_per_us;
+  // Entries appended in total, only ever advanced by the SHAVE, and events
+  // dropped because the ring was full.
+  uint32_t committed;
+  uint32_t dropped;
+  // Entries drained in total, only ever advanced by the LOS.
+  uint32_t consumed;
+};
+
+// Gets the current time the way that PlatformGetTimestampMicros32() does on
+// the LOS.
+inline uint32_t ShaveGetTimestampMicros32(const ShaveEventRing* ring) {
+#if defined(__shave__)
+  // As on the LOS, the first read latches the second.
+  uint32_t upper = GET_REG_WORD_VAL(TIM0_BASE_ADR + TIM_FREE_CNT1_OFFSET);
+  uint32_t lower = GET_REG_WORD_VAL(TIM0_BASE_ADR + TIM_FREE_CNT0_OFFSET);
+  uint64_t ticks = (static_cast<uint64_t>(upper) << 32) | lower;
+  return static_cast<uint32_t>((ticks - ring->base_ticks) /
+                               ring->sysclks_per_us);
+#else
+  (void)ring;
+  return PlatformGetTimestampMicros32();
+#endif
+}
+
+// Appends an event with arg_count 32bit arguments. This takes no locks and
+// never waits: if the LOS has not drained enough of the ring, or the event
+// is larger than kShaveMaxEventEntries, the event is counted as dropped
+// instead.
+// Returns: false if the event was dropped.
+inline bool ShaveAppendEvent(ShaveEventRing* ring, uint32_t wire_id,
+                             const uint32_t* args, uint32_t arg_count) {
+  if (arg_count > kShaveMaxEventEntries - 2) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  uint32_t count = 2 + arg_count;
+  uint32_t committed = __atomic_load_n(&ring->committed, __ATOMIC_RELAXED);
+  uint32_t consumed = __atomic_load_n(&ring->consumed, __ATOMIC_ACQUIRE);
+  if (committed - consumed + 1 + count > ring->capacity_mask + 1) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  uint32_t* entries = ring->entries;
+  uint32_t mask = ring->capacity_mask;
+  entries[committed++ & mask] = count;
+  entries[committed++ & mask] = wire_id;
+  entries[committed++ & mask] = ShaveGetTimestampMicros32(ring);
+  for (uint32_t i = 0; i < arg_count; i++) {
+    entries[committed++ & mask] = args[i];
+  }
+  // Publishes the whole record.
+  __atomic_store_n(&ring->committed, committed, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Appends an event with the given arguments, which must be 32bit integers
+// matching the event's signature (e.g. uint32_t or int32_t).
+template <typename... ArgTypes>
+inline bool ShaveEvent(ShaveEventRing* ring, uint32_t wire_id,
+                       ArgTypes... args) {
+  // The extra element keeps the array valid without arguments.
+  const uint32_t values[] = {static_cast<uint32_t>(args)..., 0};
+  return ShaveAppendEvent(ring, wire_id, values, sizeof...(ArgTypes));
+}
+
+// Leaves the scope most recently entered by appending the enter event of a
+// scoped event with ShaveEvent().
+inline bool ShaveLeaveScope(ShaveEventRing* ring) {
+  return ShaveAppendEvent(ring, kShaveScopeLeaveWireId, nullptr, 0);
+}
+
+// Appends the enter event of a scoped event on construction and leaves the
+// scope on destruction.
+class ShaveAutoScope {
+ public:
+  ShaveAutoScope(const ShaveAutoScope&) = delete;
+  void operator=(const ShaveAutoScope&) = delete;
+
+  template <typename... ArgTypes>
+  ShaveAutoScope(ShaveEventRing* ring, uint32_t wire_id, ArgTypes... args)
+      : ring_(ring) {
+    ShaveEvent(ring, wire_id, args...);
+  }
+  ~ShaveAutoScope() { ShaveLeaveScope(ring_); }
+
+ private:
+  ShaveEventRing* ring_;
+};
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_SHAVE_H_
@@ -0,0 +1,60 @@
+#ifndef TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_SHAVE_DRAIN_H_
+#define TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_SHAVE_DRAIN_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "wtf/buffer.h"
+#include "wtf/shave.h"
+
+namespace wtf {
+
+// The LOS side of a ShaveEventRing: moves the events that the SHAVE has
+// committed into an EventBuffer, which the drain writes to as its owning
+// thread. The ring's contents are fetched with PlatformCopyFromCoprocessor()
+// (CMX DMA on Myriad2), so the copying does not go through the LOS.
+//
+// Not thread safe: one thread at a time may call Drain().
+class ShaveEventDrain {
+ public:
+  // Disallow copy/assignment.
+  ShaveEventDrain(const ShaveEventDrain&) = delete;
+  void operator=(const ShaveEventDrain&) = delete;
+
+  // Sets up ring to hold its events in capacity entries (rounded down to a
+  // power of two). The ring must not be in use by the SHAVE yet.
+  // The ring, its entries and event_buffer must outlive the drain.
+  ShaveEventDrain(ShaveEventRing* ring, uint32_t* entries, uint32_t capacity,
+                  EventBuffer* event_buffer);
+
+  // Appends the events that the SHAVE has committed since the last call to
+  // the event buffer, and frees their room in the ring. This must happen
+  // often enough for the ring not to fill up, and, with
+  // WTF_64BIT_TIMESTAMPS, at least once per 2^32 micros (~71 minutes).
+  // Returns: The number of events drained.
+  size_t Drain();
+
+  ShaveEventRing* ring() { return ring_; }
+  EventBuffer* event_buffer() { return event_buffer_; }
+
+  // Number of events that the SHAVE dropped because the ring was full.
+  uint32_t dropped_events() {
+    return __atomic_load_n(&ring_->dropped, __ATOMIC_RELAXED);
+  }
+
+  // Number of malformed records skipped (e.g. from a SHAVE overrunning its
+  // ring).
+  uint32_t malformed_records() { return malformed_records_; }
+
+ private:
+  ShaveEventRing* ring_;
+  EventBuffer* event_buffer_;
+  // Local copy of the entries being drained.
+  std::vector<uint32_t> staging_;
+  uint32_t malformed_records_ = 0;
+};
+
+}  // namespace wtf
+
+#endif  // TRACING_FRAMEWORK_BINDINGS_CPP_INCLUDE_WTF_SHAVE_DRAIN_H_
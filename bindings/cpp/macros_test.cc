@@ -1,5 +1,6 @@
 #include "wtf/macros.h"
 
+#include <cstdlib>
 #include <fstream>
 
 #include "gtest/gtest.h"
@@ -30,6 +31,9 @@ class MacrosTest : public ::testing::Test {
   }
 };
 
+EventCategory test_category{"test"};
+EventCategory default_on_category{"testDefaultOn", true};
+
 TEST_F(MacrosTest, AssertMasterEnabled) {
   ASSERT_TRUE(kMasterEnable)
       << "The WTF_ENABLE define must be set for this test.";
@@ -52,6 +56,17 @@ TEST_F(MacrosTest, EventsShouldBeDisabled) {
   WTF_EVENT("ShouldBeDisalbed#E1", int32_t)(0);
   { WTF_SCOPE0("ShouldBeDisabled#InnerLoop0"); }
   { WTF_SCOPE("ShouldBeDisabled#InnerLoop1", int32_t)(1); }
+  WTF_EVENT0_SAMPLED("ShouldBeDisabled#S0", 1);
+  WTF_EVENT_SAMPLED("ShouldBeDisabled#S1", 1, int32_t)(0);
+  { WTF_SCOPE0_SAMPLED("ShouldBeDisabled#SampledLoop0", 1); }
+  { WTF_SCOPE_SAMPLED("ShouldBeDisabled#SampledLoop1", 1, int32_t)(1); }
+  WTF_EVENT0_IN(default_on_category, "ShouldBeDisabled#C0");
+  WTF_EVENT_IN(default_on_category, "ShouldBeDisabled#C1", int32_t)(0);
+  { WTF_SCOPE0_IN(default_on_category, "ShouldBeDisabled#CategoryLoop0"); }
+  {
+    WTF_SCOPE_IN(default_on_category, "ShouldBeDisabled#CategoryLoop1",
+                 int32_t)(1);
+  }
   EXPECT_FALSE(EventsHaveBeenLogged());
 }
 
@@ -84,6 +99,72 @@ TEST_F(MacrosTest, EventsShouldBeEnabled) {
   { WTF_SCOPE("ShouldBeEnabled#InnerLoop1", int32_t)(1); }
   EXPECT_TRUE(EventsHaveBeenLogged());
   ClearEventBuffer();
+
+  // The first invocation of a sampled event is always recorded.
+  WTF_EVENT0_SAMPLED("ShouldBeEnabled#S0", 10);
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  WTF_EVENT_SAMPLED("ShouldBeEnabled#S1", 10, int32_t)(0);
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  { WTF_SCOPE0_SAMPLED("ShouldBeEnabled#SampledLoop0", 10); }
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  { WTF_SCOPE_SAMPLED("ShouldBeEnabled#SampledLoop1", 10, int32_t)(1); }
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+}
+
+TEST_F(MacrosTest, CategoriesToggleAtRuntime) {
+  // Categories start with their default, or as the environment says.
+  EXPECT_FALSE(test_category.enabled());
+  EXPECT_TRUE(default_on_category.enabled());
+  setenv("WTF_CATEGORIES", "-testDefaultOn,testFromEnv", 1);
+  static EventCategory env_category{"testFromEnv"};
+  static EventCategory env_default_on_category{"testDefaultOn", true};
+  unsetenv("WTF_CATEGORIES");
+  EXPECT_TRUE(env_category.enabled());
+  EXPECT_FALSE(env_default_on_category.enabled());
+
+  WTF_THREAD_ENABLE_IF(true, "ShouldBeEnabled");
+  ClearEventBuffer();
+  { WTF_EVENT0_IN(test_category, "Category#E0"); }
+  { WTF_EVENT_IN(test_category, "Category#E1", int32_t)(0); }
+  { WTF_SCOPE0_IN(test_category, "Category#Loop0"); }
+  { WTF_SCOPE_IN(test_category, "Category#Loop1", int32_t)(1); }
+  EXPECT_FALSE(EventsHaveBeenLogged());
+
+  test_category.set_enabled(true);
+  { WTF_EVENT0_IN(test_category, "Category#E0"); }
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  { WTF_EVENT_IN(test_category, "Category#E1", int32_t)(0); }
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  { WTF_SCOPE0_IN(test_category, "Category#Loop0"); }
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  { WTF_SCOPE_IN(test_category, "Category#Loop1", int32_t)(1); }
+  EXPECT_TRUE(EventsHaveBeenLogged());
+  ClearEventBuffer();
+
+  // A configured spec applies to existing and new categories.
+  EventCategory::Configure("*,-test");
+  EXPECT_FALSE(test_category.enabled());
+  EXPECT_TRUE(env_category.enabled());
+  EXPECT_TRUE(env_default_on_category.enabled());
+  static EventCategory configured_category{"testConfigured"};
+  EXPECT_TRUE(configured_category.enabled());
+
+  EventCategory::Configure("");
+  EXPECT_FALSE(env_category.enabled());
+  EXPECT_TRUE(default_on_category.enabled());
 }
 
 }  // namespace enabled
@@ -147,6 +228,44 @@ TEST_F(MacrosTest, BasicEndToEnd) {
   EXPECT_TRUE(Runtime::GetInstance()->SaveToFile("/tmp/macrobuf.wtf-trace"));
 }
 
+#if defined(WTF_CONSTEXPR_SIGNATURES)
+// Builds the signature for a name spec the way the macros do.
+#define TEST_SIGNATURE(name_spec, ...)                                \
+  [] {                                                                \
+    struct NameSpec {                                                 \
+      static constexpr const char* value() { return name_spec; }      \
+    };                                                                \
+    return &StaticSignature<NameSpec, __VA_ARGS__>::value;            \
+  }()
+
+TEST_F(MacrosTest, SignaturesMatchRuntimeParsing) {
+  auto check = [](const EventSignature* signature,
+                  const EventDefinition& definition) {
+    EXPECT_EQ(definition.name(), signature->name);
+    EXPECT_EQ(definition.arguments(), signature->arguments);
+  };
+  check(TEST_SIGNATURE("Foo#bar: a, b", int32_t, const char*),
+        EventDefinition::Create<int32_t, const char*>(0, EventClass::kInstance,
+                                                      0, "Foo#bar: a, b"));
+  check(TEST_SIGNATURE("Foo#bar:  a,b ", uint16_t, uint32_t, StaticString),
+        EventDefinition::Create<uint16_t, uint32_t, StaticString>(
+            0, EventClass::kInstance, 0, "Foo#bar:  a,b "));
+  check(TEST_SIGNATURE("Foo#noNames", int16_t, int32_t),
+        EventDefinition::Create<int16_t, int32_t>(0, EventClass::kInstance, 0,
+                                                  "Foo#noNames"));
+  check(TEST_SIGNATURE("Foo#many: a", int32_t, int32_t, int32_t, int32_t,
+                       int32_t, int32_t, int32_t, int32_t, int32_t, int32_t,
+                       int32_t),
+        EventDefinition::Create<int32_t, int32_t, int32_t, int32_t, int32_t,
+                                int32_t, int32_t, int32_t, int32_t, int32_t,
+                                int32_t>(0, EventClass::kInstance, 0,
+                                         "Foo#many: a"));
+  check(TEST_SIGNATURE("Foo#wide: a, b, c", int64_t, double, Uint8Array),
+        EventDefinition::Create<int64_t, double, Uint8Array>(
+            0, EventClass::kInstance, 0, "Foo#wide: a, b, c"));
+}
+#endif
+
 }  // namespace
 }  // namespace wtf
 
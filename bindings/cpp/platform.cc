@@ -11,6 +11,8 @@
 // Select threading library.
 #if defined(WTF_SINGLE_THREADED)
 #include "wtf/platform/platform_aux_single_threaded_impl.h"
+#elif defined(WTF_TLS_THREADED)
+#include "wtf/platform/platform_aux_tls_threaded_impl.h"
 #else
 #include "wtf/platform/platform_aux_std_threaded_impl.h"
 #endif
@@ -1,17 +1,76 @@
 #include "wtf/runtime.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <fstream>
 
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "jsoncpp/json/json.h"
 
 namespace wtf {
 
+namespace {
+
+// Summarizes the durations of an aggregated scope, as of the chunk.
+EventEnabled<const char*, uint64_t, uint64_t, uint32_t, uint32_t, uint32_t,
+             uint32_t>&
+GetScopeSummaryEvent() {
+  static EventEnabled<const char*, uint64_t, uint64_t, uint32_t, uint32_t,
+                      uint32_t, uint32_t>
+      event{
+          "wtf.scope#summary: name, count, totalMicros, p50Micros, p90Micros, "
+          "p99Micros, maxMicros"};
+  return event;
+}
+
+// Overhead of a buffer, as of the chunk.
+EventEnabled<uint32_t, const char*, uint64_t, uint64_t, uint64_t, uint64_t,
+             uint32_t>&
+GetRuntimeStatsEvent() {
+  static EventEnabled<uint32_t, const char*, uint64_t, uint64_t, uint64_t,
+                      uint64_t, uint32_t>
+      event{
+          "wtf.runtime#stats: zoneId, name, events, bytes, blockAllocations, "
+          "stringTableLookups, droppedEvents"};
+  return event;
+}
+
+// Phases of the previous chunk, and lock contention so far.
+EventEnabled<uint32_t, uint32_t, uint32_t, uint32_t, uint64_t, uint64_t>&
+GetRuntimeSaveStatsEvent() {
+  static EventEnabled<uint32_t, uint32_t, uint32_t, uint32_t, uint64_t,
+                      uint64_t>
+      event{
+          "wtf.runtime#saveStats: snapshotMicros, definitionsMicros, "
+          "layoutMicros, writeMicros, stringTableContentions, "
+          "runtimeContentions"};
+  return event;
+}
+
+// Microseconds since start, for the save phases.
+uint32_t MicrosSince(uint64_t start) {
+  return static_cast<uint32_t>(std::min<uint64_t>(
+      PlatformGetTimestampMicros64() - start, UINT32_MAX));
+}
+
+}  // namespace
+
 Runtime::Runtime() {
   PlatformInitializeThreading();
 
   // Force reference event types that we inline manually.
   StandardEvents::GetScopeLeaveEvent();
+  StandardEvents::GetSetZoneEvent();
+#if defined(WTF_64BIT_TIMESTAMPS)
+  StandardEvents::GetTimeEpochEvent();
+#endif
+  ResetDefinitions();
 }
 
 Runtime* Runtime::GetInstance() {
@@ -21,14 +80,88 @@ Runtime* Runtime::GetInstance() {
 
 void Runtime::ResetForTesting() {
   thread_event_buffers_.clear();
+  free_event_buffers_.clear();
   shared_string_table_.Clear();
+  // Definitions refer to strings, so they are serialized again.
+  ResetDefinitions();
+  ring_blocks_ = 0;
+  rate_limit_per_second_ = 0;
+  rate_limit_burst_ = 0;
+  max_aggregated_scopes_ = 0;
+  retired_scope_aggregators_.clear();
+  per_cpu_buffers_ = false;
+  forwarding_event_buffers_.clear();
+  cpu_event_buffers_.reset();
+  shave_drains_.clear();
+  compact_encoding_ = false;
+  reclaim_saved_buffers_ = false;
+  compressor_.reset();
+  stats_events_ = false;
+  {
+    platform::lock_guard<platform::mutex> lock{stats_mu_};
+    last_save_stats_ = SaveStats();
+  }
+#if !defined(WTF_SINGLE_THREADED)
+  save_thread_count_ = 1;
+#endif
+}
+
+std::unique_ptr<EventBuffer> Runtime::CreateThreadEventBuffer() {
+  std::unique_ptr<EventBuffer> event_buffer;
+  if (per_cpu_buffers_) {
+    if (!cpu_event_buffers_) {
+      cpu_event_buffers_.reset(new CpuEventBuffers(
+          &shared_string_table_, &block_pool_, PlatformGetCpuCount()));
+    }
+    // Forwarding buffers hold no events, so those of exited threads can be
+    // reused right away.
+    auto it = std::find_if(forwarding_event_buffers_.begin(),
+                           forwarding_event_buffers_.end(),
+                           [](std::unique_ptr<EventBuffer>& forwarding) {
+                             return forwarding->out_of_scope();
+                           });
+    if (it != forwarding_event_buffers_.end()) {
+      event_buffer = std::move(*it);
+      forwarding_event_buffers_.erase(it);
+      event_buffer->Reset();
+    } else {
+      event_buffer.reset(
+          new EventBuffer(&shared_string_table_, cpu_event_buffers_.get()));
+    }
+  } else if (!free_event_buffers_.empty()) {
+    event_buffer = std::move(free_event_buffers_.back());
+    free_event_buffers_.pop_back();
+  } else {
+    event_buffer.reset(new EventBuffer(&shared_string_table_, &block_pool_));
+  }
+  if (ring_blocks_ && !event_buffer->cpu_event_buffers()) {
+    event_buffer->set_ring_blocks(ring_blocks_);
+  }
+  if (rate_limit_per_second_) {
+    event_buffer->set_rate_limit(rate_limit_per_second_, rate_limit_burst_);
+  }
+  if (max_aggregated_scopes_ && !event_buffer->scope_aggregator()) {
+    event_buffer->set_scope_aggregator(std::unique_ptr<ScopeAggregator>{
+        new ScopeAggregator(max_aggregated_scopes_)});
+  } else if (!max_aggregated_scopes_ && event_buffer->scope_aggregator()) {
+    retired_scope_aggregators_.push_back(
+        event_buffer->ReleaseScopeAggregator());
+  }
+  return event_buffer;
 }
 
-EventBuffer* Runtime::CreateThreadEventBuffer() {
-  EventBuffer* r;
-  thread_event_buffers_.emplace_back(
-      r = new EventBuffer(&shared_string_table_));
-  return r;
+void Runtime::ReclaimThreadEventBuffers(
+    const std::vector<EventBuffer*>& event_buffers) {
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  for (auto event_buffer : event_buffers) {
+    auto it = std::find_if(thread_event_buffers_.begin(),
+                           thread_event_buffers_.end(),
+                           [event_buffer](std::unique_ptr<EventBuffer>& owned) {
+                             return owned.get() == event_buffer;
+                           });
+    free_event_buffers_.push_back(std::move(*it));
+    thread_event_buffers_.erase(it);
+  }
 }
 
 void Runtime::EnableCurrentThread(const char* thread_name, const char* type,
@@ -36,23 +169,223 @@ void Runtime::EnableCurrentThread(const char* thread_name, const char* type,
   if (PlatformGetThreadLocalEventBuffer()) {
     return;
   }
-  EventBuffer* event_buffer;
+  std::unique_ptr<EventBuffer> event_buffer;
   {
-    platform::lock_guard<platform::mutex> lock{mu_};
+    CountingLockGuard lock{&mu_, &mu_contentions_};
     event_buffer = CreateThreadEventBuffer();
   }
 
-  int zone_id =
-      StandardEvents::CreateZone(event_buffer, thread_name, type, location);
-  StandardEvents::SetZone(event_buffer, zone_id);
-  PlatformSetThreadLocalEventBuffer(event_buffer);
+  int zone_id = StandardEvents::CreateZone(event_buffer.get(), thread_name,
+                                           type, location);
+  // Forwarding buffers set their zone in each CPU buffer as they go.
+  bool forwarding = event_buffer->cpu_event_buffers() != nullptr;
+  if (!forwarding) {
+    StandardEvents::SetZone(event_buffer.get(), zone_id);
+  }
+  event_buffer->SetZone(zone_id, thread_name, type, location);
+  PlatformSetThreadLocalEventBuffer(event_buffer.get());
+
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  (forwarding ? forwarding_event_buffers_ : thread_event_buffers_)
+      .push_back(std::move(event_buffer));
+}
+
+void Runtime::SetFlightRecorderBudget(size_t bytes_per_thread) {
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  ring_blocks_ = 0;
+  if (bytes_per_thread) {
+    ring_blocks_ = std::max<size_t>(bytes_per_thread / sizeof(EventBlock), 2);
+  }
+}
+
+void Runtime::SetSampledEventRateLimit(uint32_t events_per_second,
+                                       uint32_t burst) {
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  rate_limit_per_second_ = events_per_second;
+  rate_limit_burst_ = burst;
+}
+
+void Runtime::SetPerCpuBuffers(bool per_cpu) {
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  per_cpu_buffers_ = per_cpu;
+}
+
+void Runtime::AddShaveEventRing(ShaveEventRing* ring, uint32_t* entries,
+                                uint32_t capacity, const char* name) {
+  std::unique_ptr<EventBuffer> event_buffer{
+      new EventBuffer(&shared_string_table_, &block_pool_)};
+  {
+    CountingLockGuard lock{&mu_, &mu_contentions_};
+    if (ring_blocks_) {
+      event_buffer->set_ring_blocks(ring_blocks_);
+    }
+  }
+  int zone_id = StandardEvents::CreateZone(event_buffer.get(), name, "SHAVE",
+                                           nullptr);
+  StandardEvents::SetZone(event_buffer.get(), zone_id);
+  event_buffer->SetZone(zone_id, name, "SHAVE", nullptr);
+  std::unique_ptr<ShaveEventDrain> drain{
+      new ShaveEventDrain(ring, entries, capacity, event_buffer.get())};
+
+  {
+    CountingLockGuard lock{&mu_, &mu_contentions_};
+    thread_event_buffers_.push_back(std::move(event_buffer));
+  }
+  platform::lock_guard<platform::mutex> lock{shave_mu_};
+  shave_drains_.push_back(std::move(drain));
+}
+
+void Runtime::RemoveShaveEventRing(ShaveEventRing* ring) {
+  platform::lock_guard<platform::mutex> lock{shave_mu_};
+  auto it = std::find_if(shave_drains_.begin(), shave_drains_.end(),
+                         [ring](std::unique_ptr<ShaveEventDrain>& drain) {
+                           return drain->ring() == ring;
+                         });
+  if (it == shave_drains_.end()) {
+    return;
+  }
+  (*it)->Drain();
+  // Like the buffer of an exited thread, it is reclaimed once saved.
+  (*it)->event_buffer()->MarkOutOfScope();
+  shave_drains_.erase(it);
+}
+
+void Runtime::DrainShaveEventRings() {
+  platform::lock_guard<platform::mutex> lock{shave_mu_};
+  for (auto& drain : shave_drains_) {
+    drain->Drain();
+  }
+}
+
+void Runtime::SetScopeAggregation(size_t max_scopes) {
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  max_aggregated_scopes_ = max_scopes;
+}
+
+std::vector<Runtime::ScopeHistogram> Runtime::GetScopeHistograms() {
+  std::unordered_map<uint32_t, DurationHistogram> histograms;
+  {
+    CountingLockGuard lock{&mu_, &mu_contentions_};
+    for (auto event_buffers : {&thread_event_buffers_, &free_event_buffers_,
+                               &forwarding_event_buffers_}) {
+      for (auto& event_buffer : *event_buffers) {
+        if (event_buffer->scope_aggregator()) {
+          event_buffer->scope_aggregator()->MergeInto(&histograms);
+        }
+      }
+    }
+    for (auto& scope_aggregator : retired_scope_aggregators_) {
+      scope_aggregator->MergeInto(&histograms);
+    }
+  }
+
+  std::vector<ScopeHistogram> scope_histograms;
+  if (histograms.empty()) {
+    return scope_histograms;
+  }
+  for (auto& event_definition :
+       EventRegistry::GetInstance()->GetEventDefinitions()) {
+    auto it = histograms.find(event_definition.wire_id());
+    if (it == histograms.end()) {
+      continue;
+    }
+    scope_histograms.emplace_back();
+    ScopeHistogram& scope_histogram = scope_histograms.back();
+    scope_histogram.wire_id = it->first;
+    event_definition.AppendName(&scope_histogram.name);
+    scope_histogram.durations = it->second;
+  }
+  return scope_histograms;
+}
+
+Runtime::Stats Runtime::GetStats() {
+  Stats stats;
+  {
+    CountingLockGuard lock{&mu_, &mu_contentions_};
+    auto add = [&stats](EventBuffer* event_buffer) {
+      stats.buffers.push_back(BufferStats{
+          event_buffer->zone_id(), event_buffer->zone_name(),
+          event_buffer->events_written(), event_buffer->bytes_held(),
+          event_buffer->block_allocations(),
+          event_buffer->string_table_lookups(),
+          event_buffer->dropped_events(),
+          event_buffer->rate_limited_events()});
+    };
+    for (auto event_buffers :
+         {&thread_event_buffers_, &forwarding_event_buffers_}) {
+      for (auto& event_buffer : *event_buffers) {
+        add(event_buffer.get());
+      }
+    }
+    if (cpu_event_buffers_) {
+      for (size_t i = 0; i < cpu_event_buffers_->size(); i++) {
+        add(cpu_event_buffers_->at(i));
+      }
+    }
+  }
+  stats.string_table_contentions = shared_string_table_.lock_contentions();
+  stats.runtime_contentions = mu_contentions_.load();
+  platform::lock_guard<platform::mutex> lock{stats_mu_};
+  stats.last_save = last_save_stats_;
+  return stats;
+}
+
+void Runtime::SetStatsEvents(bool enabled) {
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+  stats_events_ = enabled;
+}
+
+void Runtime::SetCompactEncoding(bool compact) {
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+  compact_encoding_ = compact;
+}
+
+void Runtime::SetReclaimSavedThreadBuffers(bool reclaim) {
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+  reclaim_saved_buffers_ = reclaim;
+}
+
+void Runtime::SetCompressor(std::unique_ptr<Compressor> compressor) {
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+  compressor_ = std::move(compressor);
 }
 
 void Runtime::DisableCurrentThread() {
   PlatformSetThreadLocalEventBuffer(nullptr);
 }
 
-void Runtime::WriteHeaderChunk(OutputBuffer* output_buffer) {
+std::vector<EventBuffer*> Runtime::GetThreadEventBuffers() {
+  CountingLockGuard lock{&mu_, &mu_contentions_};
+  std::vector<EventBuffer*> event_buffers;
+  event_buffers.reserve(thread_event_buffers_.size());
+  for (auto& event_buffer : thread_event_buffers_) {
+    event_buffers.push_back(event_buffer.get());
+  }
+  if (cpu_event_buffers_) {
+    for (size_t i = 0; i < cpu_event_buffers_->size(); i++) {
+      event_buffers.push_back(cpu_event_buffers_->at(i));
+    }
+  }
+  return event_buffers;
+}
+
+uint64_t Runtime::GetTimeOrigin(
+    const std::vector<EventBuffer*>& event_buffers) {
+  uint64_t time_origin = 0;
+#if defined(WTF_64BIT_TIMESTAMPS)
+  time_origin = PlatformGetTimestampMicros64();
+  for (auto event_buffer : event_buffers) {
+    uint64_t first_timestamp;
+    if (event_buffer->GetFirstTimestamp(&first_timestamp)) {
+      time_origin = std::min(time_origin, first_timestamp);
+    }
+  }
+#endif
+  return time_origin;
+}
+
+void Runtime::WriteHeaderChunk(OutputBuffer* output_buffer,
+                               uint64_t time_origin, bool incremental) {
   static const uint32_t kMagicNumber = 0xdeadbeef;
   static const uint32_t kWtfVersion = 0xe8214400;
   static const uint32_t kFormatVersion = 10;
@@ -65,6 +398,12 @@ void Runtime::WriteHeaderChunk(OutputBuffer* output_buffer) {
   // Header chunk.
   Json::Value flags(Json::arrayValue);
   flags.append("has_high_resolution_times");
+  if (incremental) {
+    flags.append("has_incremental_string_tables");
+  }
+  if (compressor_) {
+    flags.append("has_compressed_chunks");
+  }
 
   Json::Value context(Json::objectValue);
   context["contextType"] = "script";
@@ -75,6 +414,13 @@ void Runtime::WriteHeaderChunk(OutputBuffer* output_buffer) {
   json["flags"] = flags;
   json["timebase"] = 0;  // We reset the platform to a 0 time base ourselves.
   json["contextInfo"] = context;
+#if defined(WTF_64BIT_TIMESTAMPS)
+  // Times are reconstructed from epoch events and rebased against this so
+  // that they fit the loader's 32bit range.
+  Json::Value metadata(Json::objectValue);
+  metadata["timeOrigin64"] = static_cast<Json::UInt64>(time_origin);
+  json["metadata"] = metadata;
+#endif
 
   Json::FastWriter json_writer;
   auto json_string = json_writer.write(json);
@@ -97,53 +443,92 @@ void Runtime::WriteHeaderChunk(OutputBuffer* output_buffer) {
 }
 
 bool Runtime::SaveToFile(const std::string& file_name) {
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+  // Regular files are sized chunk by chunk and written through a mapping.
+  // Anything else (pipes, FIFOs, devices) is written to, and only opened for
+  // writing.
+  struct stat file_stat;
+  bool regular =
+      stat(file_name.c_str(), &file_stat) != 0 || S_ISREG(file_stat.st_mode);
+  int fd = open(file_name.c_str(),
+                (regular ? O_RDWR | O_TRUNC : O_WRONLY) | O_CREAT | O_CLOEXEC,
+                0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return false;
+  }
+  OutputBuffer output_buffer{fd, S_ISREG(file_stat.st_mode)
+                                     ? OutputBuffer::FdMode::kMap
+                                     : OutputBuffer::FdMode::kWrite};
+  bool success = Save(&output_buffer);
+  success = output_buffer.Close() && success;
+  return close(fd) == 0 && success;
+#else
   std::fstream out;
   out.open(file_name, std::ios_base::out | std::ios_base::trunc);
   if (out.fail()) {
     return false;
   }
-  bool success = wtf::Runtime::GetInstance()->Save(&out);
+  bool success = Save(&out);
   out.close();
   return success && !out.fail();
+#endif
 }
 
 bool Runtime::Save(std::ostream* out) {
+  OutputBuffer output_buffer{out};
+  return Save(&output_buffer) && !out->fail();
+}
+
+bool Runtime::Save(OutputBuffer* output_buffer) {
+  DrainShaveEventRings();
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+
   // Make a copy of the thread event buffers in a lock. The rest can run
   // lock free.
-  std::vector<EventBuffer*> local_thread_event_buffers;
-  {
-    platform::lock_guard<platform::mutex> lock{mu_};
-    local_thread_event_buffers.reserve(thread_event_buffers_.size());
-    for (auto& event_buffer : thread_event_buffers_) {
-      local_thread_event_buffers.push_back(event_buffer.get());
-    }
-  }
+  std::vector<EventBuffer*> local_thread_event_buffers =
+      GetThreadEventBuffers();
 
-  OutputBuffer output_buffer{out};
-  WriteHeaderChunk(&output_buffer);
+  // All times in the trace are relative to the earliest event.
+  SaveCursor cursor;
+  cursor.time_origin = GetTimeOrigin(local_thread_event_buffers);
 
-  // There will be two parts: string and event. The event part is actually
-  // a merged combination of the meta event + each thread event.
-  const size_t kPartCount = 2;
-  OutputBuffer::PartHeader part_headers[kPartCount];
-  OutputBuffer::PartHeader* strings_header = &part_headers[0];
-  OutputBuffer::PartHeader* events_header = &part_headers[1];
+  WriteHeaderChunk(output_buffer, cursor.time_origin, false);
+  return WriteEventsChunk(output_buffer, local_thread_event_buffers, &cursor,
+                          false, reclaim_saved_buffers_);
+}
 
-  // Accumulate headers for each thread.
-  std::vector<OutputBuffer::PartHeader> thread_part_headers;
-  thread_part_headers.resize(local_thread_event_buffers.size());
-  size_t thread_parts_length = 0;
-  for (size_t i = 0; i < local_thread_event_buffers.size(); i++) {
-    auto thread_part_header = &thread_part_headers[i];
-    local_thread_event_buffers[i]->PopulateHeader(thread_part_header);
-    thread_parts_length += thread_part_header->length;
+bool Runtime::SaveIncremental(std::ostream* out, SaveCursor* cursor) {
+  OutputBuffer output_buffer{out};
+  DrainShaveEventRings();
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+  std::vector<EventBuffer*> local_thread_event_buffers =
+      GetThreadEventBuffers();
+  if (!cursor->started) {
+    cursor->started = true;
+    cursor->time_origin = GetTimeOrigin(local_thread_event_buffers);
+    WriteHeaderChunk(&output_buffer, cursor->time_origin, true);
   }
+  return WriteEventsChunk(&output_buffer, local_thread_event_buffers, cursor,
+                          false, false) &&
+         output_buffer.Flush();
+}
 
-  // Populate the EventBuffer of event registrations. This is done after all
-  // events have been snapshotted to make sure we got everything.
-  OutputBuffer::PartHeader event_def_header;
-  auto event_definitions = EventRegistry::GetInstance()->GetEventDefinitions();
-  EventBuffer event_def_buffer{&shared_string_table_};
+void Runtime::ResetDefinitions() {
+  definitions_buffer_.reset(
+      new EventBuffer(&shared_string_table_, &unbounded_block_pool_));
+  definitions_buffer_->set_bounded(false);
+  defined_event_count_ = 0;
+  compact_layouts_.clear();
+}
+
+void Runtime::DefineNewEvents() {
+  auto event_definitions =
+      EventRegistry::GetInstance()->GetEventDefinitions(defined_event_count_);
+  defined_event_count_ += event_definitions.size();
   std::string tmp_name;
   std::string tmp_arguments;
   for (auto& event_definition : event_definitions) {
@@ -152,44 +537,404 @@ bool Runtime::Save(std::ostream* out) {
     event_definition.AppendName(&tmp_name);
     event_definition.AppendArguments(&tmp_arguments);
     StandardEvents::DefineEvent(
-        &event_def_buffer, event_definition.wire_id(),
+        definitions_buffer_.get(), event_definition.wire_id(),
         static_cast<uint16_t>(event_definition.event_class()),
         event_definition.flags(), tmp_name.c_str(), tmp_arguments.c_str());
+    compact_layouts_[event_definition.wire_id()] =
+        CompactEventEncoder::GetLayout(tmp_arguments);
   }
-  event_def_buffer.PopulateHeader(&event_def_header);
+}
+
+bool Runtime::WriteEventsChunk(OutputBuffer* output_buffer,
+                               const std::vector<EventBuffer*>& event_buffers,
+                               SaveCursor* cursor, bool consume,
+                               bool consume_exited) {
+  // There will be two parts: string and event. The event part is actually
+  // a merged combination of the meta event + each thread event. With compact
+  // encoding, the thread events make up a third part instead.
+  SaveStats save_stats;
+  uint64_t phase_start = PlatformGetTimestampMicros64();
+  const size_t part_count = compact_encoding_ ? 3 : 2;
+  OutputBuffer::PartHeader part_headers[3];
+  OutputBuffer::PartHeader* strings_header = &part_headers[0];
+  OutputBuffer::PartHeader* events_header = &part_headers[1];
+
+  // Accumulate headers for each thread. Ring buffers are held off from
+  // overwriting until their data has been written.
+  std::vector<OutputBuffer::PartHeader> thread_part_headers;
+  thread_part_headers.resize(event_buffers.size());
+  size_t thread_parts_length = 0;
+  std::unordered_map<int, EventBuffer::Position> positions;
+  // Whether each buffer's thread had exited before its part was populated, so
+  // that the part holds all of its events.
+  std::vector<bool> exited(event_buffers.size());
+  for (size_t i = 0; i < event_buffers.size(); i++) {
+    auto thread_part_header = &thread_part_headers[i];
+    EventBuffer* event_buffer = event_buffers[i];
+    event_buffer->LockReader();
+    exited[i] = consume_exited && event_buffer->out_of_scope();
+    if (consume) {
+      event_buffer->PopulateHeader(thread_part_header);
+    } else {
+      // Resume where the previous chunk ended. Zones of buffers that are no
+      // longer around are dropped from the cursor. CPU buffers, which have no
+      // zone, go by negative keys.
+      int key = event_buffer->cpu_index() < 0 ? event_buffer->zone_id()
+                                              : -1 - event_buffer->cpu_index();
+      auto it = cursor->positions.find(key);
+      event_buffer->PopulateHeader(
+          thread_part_header,
+          it != cursor->positions.end() ? &it->second : nullptr,
+          &positions[key]);
+    }
+    thread_parts_length += thread_part_header->length;
+  }
+  if (!consume) {
+    cursor->positions.swap(positions);
+  }
+  save_stats.snapshot_micros = MicrosSince(phase_start);
+  phase_start = PlatformGetTimestampMicros64();
+
+  // Summaries of the aggregated scopes and the runtime's stats follow the
+  // event definitions, outside of any zone. Their definitions and names must
+  // be in before those of the chunk are populated.
+  std::unique_ptr<EventBuffer> summary_buffer;
+  OutputBuffer::PartHeader summary_header{0, 0, 0};
+  std::vector<ScopeHistogram> scope_histograms = GetScopeHistograms();
+  if (!scope_histograms.empty() || stats_events_) {
+    summary_buffer.reset(
+        new EventBuffer(&shared_string_table_, &unbounded_block_pool_));
+    summary_buffer->set_bounded(false);
+    auto& summary_event = GetScopeSummaryEvent();
+    for (auto& scope_histogram : scope_histograms) {
+      const DurationHistogram& durations = scope_histogram.durations;
+      summary_event.InvokeSpecific(
+          summary_buffer.get(), scope_histogram.name.c_str(),
+          durations.count(), durations.sum(), durations.ValueAtQuantile(0.5),
+          durations.ValueAtQuantile(0.9), durations.ValueAtQuantile(0.99),
+          durations.max());
+    }
+    if (stats_events_) {
+      Stats stats = GetStats();
+      auto& stats_event = GetRuntimeStatsEvent();
+      for (auto& buffer_stats : stats.buffers) {
+        stats_event.InvokeSpecific(
+            summary_buffer.get(), buffer_stats.zone_id,
+            buffer_stats.name.c_str(), buffer_stats.events,
+            buffer_stats.bytes, buffer_stats.block_allocations,
+            buffer_stats.string_table_lookups,
+            buffer_stats.dropped_events + buffer_stats.rate_limited_events);
+      }
+      GetRuntimeSaveStatsEvent().InvokeSpecific(
+          summary_buffer.get(), stats.last_save.snapshot_micros,
+          stats.last_save.definitions_micros, stats.last_save.layout_micros,
+          stats.last_save.write_micros, stats.string_table_contentions,
+          stats.runtime_contentions);
+    }
+    summary_buffer->PopulateHeader(&summary_header);
+  }
+
+  // Populate the event registrations past the cursor. This is done after all
+  // events have been snapshotted to make sure we got everything.
+  OutputBuffer::PartHeader event_def_header;
+  DefineNewEvents();
+  definitions_buffer_->PopulateHeader(&event_def_header,
+                                     &cursor->definitions_position,
+                                     &cursor->definitions_position);
+  save_stats.definitions_micros = MicrosSince(phase_start);
+  phase_start = PlatformGetTimestampMicros64();
 
   // Create the combined events header that consists of the event definition
-  // buffer + each thread buffer.
+  // buffer + the scope summaries + each thread buffer.
   *events_header = event_def_header;
-  events_header->length += thread_parts_length;
+  events_header->length += summary_header.length + thread_parts_length;
+
+  // Compact encoding needs the layouts of all events, and its length is only
+  // known once done, so it happens up front from a copy of the thread data.
+  bool success = true;
+  std::string compact_events;
+  if (compact_encoding_) {
+    compact_events.reserve(thread_parts_length / 2);
+    CompactEventEncoder encoder{&compact_layouts_, &compact_events};
+    std::vector<uint32_t> words;
+    for (size_t i = 0; i < event_buffers.size(); i++) {
+      size_t length = thread_part_headers[i].length;
+      if (!length) {
+        continue;
+      }
+      words.resize(length / sizeof(uint32_t));
+      OutputBuffer words_buffer{reinterpret_cast<char*>(words.data()), length};
+      success = event_buffers[i]->WriteTo(&thread_part_headers[i],
+                                          &words_buffer) &&
+                words_buffer.Close() &&
+                encoder.Encode(words.data(), words.size()) && success;
+    }
+    events_header->length = event_def_header.length + summary_header.length;
+    part_headers[2] = OutputBuffer::PartHeader{
+        CompactEventEncoder::kPartType, 0,
+        static_cast<uint32_t>(compact_events.size())};
+  }
 
   // Must populate the strings header last so that we get all strings that
   // may have been referenced (note specifically that processing event
   // registrations adds strings).
-  shared_string_table_.PopulateHeader(strings_header);
+  int first_string_id = cursor->first_string_id;
+  shared_string_table_.PopulateHeader(strings_header, first_string_id,
+                                      &cursor->first_string_id);
 
   // Setup the chunk.
+  uint32_t end_time = static_cast<uint32_t>(std::min<uint64_t>(
+      PlatformGetTimestampMicros64() - cursor->time_origin, UINT32_MAX));
   OutputBuffer::ChunkHeader chunk_header{
-      2,                               // Id.
-      0x2,                             // Type = Events.
-      0,                               // Start time.
-      PlatformGetTimestampMicros32(),  // End time.
+      cursor->next_chunk_id++,  // Id.
+      0x2,                      // Type = Events.
+      cursor->start_time,       // Start time.
+      end_time,                 // End time.
   };
-  output_buffer.StartChunk(chunk_header, part_headers, kPartCount);
+  cursor->start_time = end_time;
+  output_buffer->set_compressor(compressor_.get());
+  output_buffer->StartChunk(chunk_header, part_headers, part_count);
 
   // And write each part. Order must match header order in part_headers.
+  // Event buffer data is whole words, so only the string table and compact
+  // events need alignment.
+  auto aligned = [](size_t length) {
+    return (length + OutputBuffer::kAlignment - 1) / OutputBuffer::kAlignment *
+           OutputBuffer::kAlignment;
+  };
+  std::vector<PartWriter> part_writers;
+  part_writers.reserve(3 + event_buffers.size());
+  part_writers.push_back(PartWriter{
+      aligned(strings_header->length), [&](OutputBuffer* out) {
+        return shared_string_table_.WriteTo(strings_header, out,
+                                            first_string_id);
+      }});
+  part_writers.push_back(
+      PartWriter{event_def_header.length, [&](OutputBuffer* out) {
+                   return definitions_buffer_->WriteTo(&event_def_header, out);
+                 }});
+  if (summary_buffer) {
+    part_writers.push_back(
+        PartWriter{summary_header.length, [&](OutputBuffer* out) {
+                     return summary_buffer->WriteTo(&summary_header, out);
+                   }});
+  }
+  if (compact_encoding_) {
+    part_writers.push_back(
+        PartWriter{aligned(compact_events.size()), [&](OutputBuffer* out) {
+                     out->AppendSpan(compact_events.data(),
+                                     compact_events.size());
+                     out->Align();
+                     return true;
+                   }});
+  } else {
+    for (size_t i = 0; i < event_buffers.size(); i++) {
+      part_writers.push_back(PartWriter{
+          thread_part_headers[i].length, [&, i](OutputBuffer* out) {
+            return event_buffers[i]->WriteTo(&thread_part_headers[i], out);
+          }});
+    }
+  }
+  save_stats.layout_micros = MicrosSince(phase_start);
+  phase_start = PlatformGetTimestampMicros64();
+  success = WriteParts(output_buffer, part_writers) && success;
+
+  // Written spans refer to the buffers, which may be recycled once released.
+  // The out of scope mark is checked first, so that a buffer seen as
+  // consumed afterwards has nothing more coming.
+  success = output_buffer->Flush() && success;
+  output_buffer->set_compressor(nullptr);
+  save_stats.write_micros = MicrosSince(phase_start);
+  {
+    platform::lock_guard<platform::mutex> lock{stats_mu_};
+    save_stats.chunks = last_save_stats_.chunks + 1;
+    last_save_stats_ = save_stats;
+  }
+  std::vector<EventBuffer*> reclaimed;
+  for (size_t i = 0; i < event_buffers.size(); i++) {
+    EventBuffer* event_buffer = event_buffers[i];
+    if (consume || (exited[i] && success)) {
+      event_buffer->Consume(thread_part_headers[i]);
+    }
+    if (event_buffer->out_of_scope() && event_buffer->consumed()) {
+      event_buffer->Reset();
+      reclaimed.push_back(event_buffer);
+    }
+    event_buffer->UnlockReader();
+  }
+  if (!reclaimed.empty()) {
+    ReclaimThreadEventBuffers(reclaimed);
+  }
+  return success;
+}
+
+bool Runtime::WriteParts(OutputBuffer* output_buffer,
+                         const std::vector<PartWriter>& part_writers) {
   bool success = true;
-  success =
-      shared_string_table_.WriteTo(strings_header, &output_buffer) && success;
-  success =
-      event_def_buffer.WriteTo(&event_def_header, &output_buffer) && success;
-  for (size_t i = 0; i < local_thread_event_buffers.size(); i++) {
-    success = local_thread_event_buffers[i]->WriteTo(&thread_part_headers[i],
-                                                     &output_buffer) &&
+#if !defined(WTF_SINGLE_THREADED)
+  // Below this, starting threads costs more than it saves.
+  static constexpr size_t kMinParallelBytes = 1 << 20;
+  size_t total_length = 0;
+  for (auto& part_writer : part_writers) {
+    total_length += part_writer.length;
+  }
+  size_t thread_count =
+      std::min(save_thread_count_, total_length / kMinParallelBytes);
+  char* range =
+      thread_count > 1 ? output_buffer->ReserveRange(total_length) : nullptr;
+  if (range) {
+    // Lay out the pieces, then hand them out to the threads largest first,
+    // so that no thread is left with a big one at the end.
+    std::vector<char*> ranges;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < part_writers.size(); i++) {
+      ranges.push_back(range);
+      order.push_back(i);
+      range += part_writers[i].length;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return part_writers[a].length > part_writers[b].length;
+    });
+    platform::atomic<size_t> next{0};
+    platform::atomic<bool> all_written{true};
+    auto work = [&]() {
+      for (size_t n; (n = next.fetch_add(1)) < order.size();) {
+        size_t i = order[n];
+        OutputBuffer piece{ranges[i], part_writers[i].length};
+        if (!part_writers[i].write(&piece) || !piece.Close()) {
+          all_written.store(false);
+        }
+      }
+    };
+    std::vector<platform::thread> threads;
+    for (size_t i = 1; i < thread_count; i++) {
+      threads.emplace_back(work);
+    }
+    work();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return all_written.load();
+  }
+#endif
+  for (auto& part_writer : part_writers) {
+    success = part_writer.write(output_buffer) && success;
+  }
+  return success;
+}
+
+#if !defined(WTF_SINGLE_THREADED)
+void Runtime::SetSaveThreadCount(size_t thread_count) {
+  platform::lock_guard<platform::mutex> lock{save_mu_};
+  save_thread_count_ = std::max<size_t>(thread_count, 1);
+}
+
+bool Runtime::StartStreaming(std::ostream* out,
+                             const StreamingOptions& options) {
+  platform::lock_guard<platform::mutex> lock{stream_mu_};
+  if (stream_out_) {
+    return false;
+  }
+  stream_out_ = out;
+  stream_options_ = options;
+  stream_stop_ = false;
+  stream_flush_requested_ = false;
+  stream_success_ = true;
+
+  size_t max_blocks = options.memory_budget_bytes / sizeof(EventBlock);
+  if (options.memory_budget_bytes) {
+    max_blocks = std::max<size_t>(max_blocks, 1);
+  }
+  block_pool_.Reserve(max_blocks);
+  block_pool_.set_max_blocks(max_blocks);
+  block_pool_.SetWatermark((max_blocks + 1) / 2, [this]() { RequestFlush(); });
+
+  stream_thread_ = platform::thread{&Runtime::StreamingThreadMain, this};
+  return true;
+}
+
+bool Runtime::StartStreamingToFile(const std::string& file_name,
+                                   const StreamingOptions& options) {
+  std::unique_ptr<std::ofstream> file{new std::ofstream{
+      file_name, std::ios_base::out | std::ios_base::trunc}};
+  if (file->fail()) {
+    return false;
+  }
+  if (!StartStreaming(file.get(), options)) {
+    return false;
+  }
+  stream_file_ = std::move(file);
+  return true;
+}
+
+bool Runtime::StopStreaming() {
+  {
+    platform::lock_guard<platform::mutex> lock{stream_mu_};
+    if (!stream_out_) {
+      return false;
+    }
+    stream_stop_ = true;
+  }
+  stream_cv_.notify_one();
+  stream_thread_.join();
+
+  block_pool_.SetWatermark(0, nullptr);
+  block_pool_.set_max_blocks(0);
+
+  platform::lock_guard<platform::mutex> lock{stream_mu_};
+  bool success = stream_success_;
+  if (stream_file_) {
+    stream_file_->close();
+    success = success && !stream_file_->fail();
+    stream_file_.reset();
+  }
+  stream_out_ = nullptr;
+  return success;
+}
+
+void Runtime::RequestFlush() {
+  {
+    platform::lock_guard<platform::mutex> lock{stream_mu_};
+    stream_flush_requested_ = true;
+  }
+  stream_cv_.notify_one();
+}
+
+void Runtime::StreamingThreadMain() {
+  std::ostream* out = stream_out_;
+  OutputBuffer output_buffer{out};
+  SaveCursor cursor;
+  {
+    platform::lock_guard<platform::mutex> lock{save_mu_};
+    cursor.time_origin = GetTimeOrigin(GetThreadEventBuffers());
+    WriteHeaderChunk(&output_buffer, cursor.time_origin, true);
+  }
+
+  bool success = true;
+  bool stop = false;
+  while (!stop) {
+    {
+      platform::unique_lock<platform::mutex> lock{stream_mu_};
+      auto interval =
+          std::chrono::milliseconds(stream_options_.flush_interval_millis);
+      stream_cv_.wait_for(lock, interval, [this]() {
+        return stream_stop_ || stream_flush_requested_;
+      });
+      stop = stream_stop_;
+      stream_flush_requested_ = false;
+    }
+
+    DrainShaveEventRings();
+    platform::lock_guard<platform::mutex> lock{save_mu_};
+    success = WriteEventsChunk(&output_buffer, GetThreadEventBuffers(),
+                               &cursor, true, false) &&
               success;
+    out->flush();
   }
 
-  return success && !out->fail();
+  platform::lock_guard<platform::mutex> lock{stream_mu_};
+  stream_success_ = success && !out->fail();
 }
+#endif
 
 }  // namespace wtf
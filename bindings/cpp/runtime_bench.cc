@@ -0,0 +1,391 @@
+#include "wtf/macros.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+namespace wtf {
+namespace {
+
+// Per thread ring size used while timing the hot path, so that memory stays
+// bounded however many iterations the library decides to run.
+constexpr size_t kBenchRingBytes = 256 * 1024;
+
+// Enables the calling thread, in flight recorder mode.
+void EnableBenchThread() {
+  if (PlatformGetThreadLocalEventBuffer()) {
+    return;
+  }
+  Runtime::GetInstance()->SetFlightRecorderBudget(kBenchRingBytes);
+  Runtime::GetInstance()->EnableCurrentThread("BenchThread");
+}
+
+// Runs a benchmark at 1, 2, 4 and 8 threads and at one thread per CPU.
+void ThreadCounts(benchmark::internal::Benchmark* benchmark) {
+#if defined(WTF_SINGLE_THREADED)
+  benchmark->Threads(1);
+#else
+  benchmark->ThreadRange(1, 8)->ThreadPerCpu();
+#endif
+}
+
+// Stream buffer that copies everything into a small reused scratch area, so
+// that Save() is measured including the copy but without any IO.
+class ScratchStreambuf : public std::streambuf {
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    for (std::streamsize remaining = n; remaining;) {
+      size_t count = std::min<size_t>(remaining, sizeof(scratch_) - offset_);
+      memcpy(scratch_ + offset_, s, count);
+      offset_ = (offset_ + count) % sizeof(scratch_);
+      s += count;
+      remaining -= count;
+    }
+    return n;
+  }
+  int_type overflow(int_type c) override {
+    char ch = traits_type::to_char_type(c);
+    xsputn(&ch, 1);
+    return traits_type::not_eof(c);
+  }
+
+ private:
+  char scratch_[1 << 20];
+  size_t offset_ = 0;
+};
+
+namespace disabled {
+WTF_NAMESPACE_DISABLE();
+
+void BM_DisabledEvent(benchmark::State& state) {
+  EnableBenchThread();
+  int32_t i = 0;
+  for (auto _ : state) {
+    WTF_EVENT("bench#disabled", int32_t)(i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DisabledEvent)->Apply(ThreadCounts);
+
+void BM_DisabledScope(benchmark::State& state) {
+  EnableBenchThread();
+  for (auto _ : state) {
+    WTF_SCOPE0("bench#disabledScope");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DisabledScope)->Apply(ThreadCounts);
+
+}  // namespace disabled
+
+namespace enabled {
+WTF_NAMESPACE_ENABLE();
+
+void BM_Event0(benchmark::State& state) {
+  EnableBenchThread();
+  for (auto _ : state) {
+    WTF_EVENT0("bench#event0");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Event0)->Apply(ThreadCounts);
+
+template <typename... ArgTypes>
+void BM_Event(benchmark::State& state) {
+  EnableBenchThread();
+  uint32_t i = 0;
+  for (auto _ : state) {
+    WTF_EVENT("bench#event", ArgTypes...)(static_cast<ArgTypes>(i)...);
+    i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_Event, int32_t)->Apply(ThreadCounts);
+BENCHMARK_TEMPLATE(BM_Event, int32_t, int32_t)->Apply(ThreadCounts);
+BENCHMARK_TEMPLATE(BM_Event, int32_t, int32_t, int32_t)->Apply(ThreadCounts);
+BENCHMARK_TEMPLATE(BM_Event, int32_t, int32_t, int32_t, int32_t)
+    ->Apply(ThreadCounts);
+BENCHMARK_TEMPLATE(BM_Event, int32_t, int32_t, int32_t, int32_t, int32_t)
+    ->Apply(ThreadCounts);
+BENCHMARK_TEMPLATE(BM_Event, int64_t, double)->Apply(ThreadCounts);
+
+void BM_SampledEvent(benchmark::State& state) {
+  EnableBenchThread();
+  int32_t i = 0;
+  for (auto _ : state) {
+    WTF_EVENT_SAMPLED("bench#sampled", 1000, int32_t)(i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SampledEvent)->Apply(ThreadCounts);
+
+EventCategory bench_category{"bench"};
+
+// An event in a category that is off at runtime.
+void BM_DisabledCategoryEvent(benchmark::State& state) {
+  EnableBenchThread();
+  int32_t i = 0;
+  for (auto _ : state) {
+    WTF_EVENT_IN(bench_category, "bench#category", int32_t)(i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DisabledCategoryEvent)->Apply(ThreadCounts);
+
+void BM_EventString(benchmark::State& state) {
+  EnableBenchThread();
+  static const char* kValues[] = {"idle", "running", "blocked", "done"};
+  size_t i = 0;
+  for (auto _ : state) {
+    WTF_EVENT("bench#string", const char*)(kValues[i++ % 4]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EventString)->Apply(ThreadCounts);
+
+void BM_EventStaticString(benchmark::State& state) {
+  EnableBenchThread();
+  for (auto _ : state) {
+    WTF_EVENT("bench#staticString", StaticString)("running");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EventStaticString)->Apply(ThreadCounts);
+
+void BM_Scope0(benchmark::State& state) {
+  EnableBenchThread();
+  for (auto _ : state) {
+    WTF_SCOPE0("bench#scope0");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Scope0)->Apply(ThreadCounts);
+
+void BM_Scope(benchmark::State& state) {
+  EnableBenchThread();
+  int32_t i = 0;
+  for (auto _ : state) {
+    WTF_SCOPE("bench#scope", int32_t)(i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Scope)->Apply(ThreadCounts);
+
+// Branches and terminates a flow, which allocates a flow id.
+void BM_FlowBranch(benchmark::State& state) {
+  EnableBenchThread();
+  for (auto _ : state) {
+    FlowHandle flow = FlowHandle::Branch("bench#flow");
+    flow.Terminate();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FlowBranch)->Apply(ThreadCounts);
+
+// Enables the calling thread with its scopes aggregated into histograms.
+void EnableAggregatingBenchThread() {
+  EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+  if (event_buffer && event_buffer->scope_aggregator()) {
+    return;
+  }
+  Runtime::GetInstance()->DisableCurrentThread();
+  Runtime::GetInstance()->SetScopeAggregation(64);
+  Runtime::GetInstance()->EnableCurrentThread("AggregatingBenchThread");
+}
+
+// Like BM_Scope0 and BM_Scope, with the scopes aggregated.
+void BM_AggregatedScope0(benchmark::State& state) {
+  EnableAggregatingBenchThread();
+  for (auto _ : state) {
+    WTF_SCOPE0("bench#aggregatedScope0");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AggregatedScope0)->Apply(ThreadCounts);
+
+void BM_AggregatedScope(benchmark::State& state) {
+  EnableAggregatingBenchThread();
+  int32_t i = 0;
+  for (auto _ : state) {
+    WTF_SCOPE("bench#aggregatedScope", int32_t)(i++);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AggregatedScope)->Apply(ThreadCounts);
+
+// Enables the calling thread to log into the per CPU buffers.
+void EnablePerCpuBenchThread() {
+  EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+  if (event_buffer && event_buffer->cpu_event_buffers()) {
+    return;
+  }
+  Runtime::GetInstance()->DisableCurrentThread();
+  Runtime::GetInstance()->SetScopeAggregation(0);
+  Runtime::GetInstance()->SetPerCpuBuffers(true);
+  Runtime::GetInstance()->EnableCurrentThread("PerCpuBenchThread");
+}
+
+// Like BM_Event0, through the per CPU buffers. These do not overwrite, so
+// the iterations are capped to bound memory.
+void BM_PerCpuEvent0(benchmark::State& state) {
+  EnablePerCpuBenchThread();
+  for (auto _ : state) {
+    WTF_EVENT0("bench#perCpuEvent0");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PerCpuEvent0)->Apply(ThreadCounts)->Iterations(1 << 21);
+
+// Resets the runtime to hold a trace of bytes of events from the calling
+// thread.
+void FillTrace(size_t bytes) {
+  Runtime* runtime = Runtime::GetInstance();
+  runtime->DisableCurrentThread();
+  runtime->ResetForTesting();
+  runtime->EnableCurrentThread("SaveThread");
+  // 5 words per event.
+  for (size_t i = 0; i < bytes / 20; i++) {
+    WTF_EVENT("bench#save", int32_t, int32_t, int32_t)(i, i, i);
+  }
+}
+
+void ResetTrace() {
+  Runtime::GetInstance()->DisableCurrentThread();
+  Runtime::GetInstance()->ResetForTesting();
+}
+
+// Saves a trace holding state.range(0) MiB of events from one thread.
+void BM_Save(benchmark::State& state) {
+  const size_t kBytes = static_cast<size_t>(state.range(0)) << 20;
+  FillTrace(kBytes);
+  std::unique_ptr<ScratchStreambuf> streambuf{new ScratchStreambuf};
+  std::ostream out{streambuf.get()};
+  for (auto _ : state) {
+    if (!Runtime::GetInstance()->Save(&out)) {
+      state.SkipWithError("Save failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kBytes);
+  ResetTrace();
+}
+BENCHMARK(BM_Save)->Arg(1)->Arg(16)->Arg(128)->Unit(benchmark::kMillisecond);
+
+// Times Save() of what FillTrace(bytes) collected, like BM_Save, and reports
+// the size of the output relative to the events as "ratio".
+void SaveWithRatio(benchmark::State& state, size_t bytes) {
+  std::ostringstream sized_out;
+  Runtime::GetInstance()->Save(&sized_out);
+  state.counters["ratio"] =
+      static_cast<double>(sized_out.tellp()) / static_cast<double>(bytes);
+  std::unique_ptr<ScratchStreambuf> streambuf{new ScratchStreambuf};
+  std::ostream out{streambuf.get()};
+  for (auto _ : state) {
+    if (!Runtime::GetInstance()->Save(&out)) {
+      state.SkipWithError("Save failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+  ResetTrace();
+}
+
+// Like BM_Save, with compact encoding.
+void BM_SaveCompact(benchmark::State& state) {
+  const size_t kBytes = static_cast<size_t>(state.range(0)) << 20;
+  FillTrace(kBytes);
+  Runtime::GetInstance()->SetCompactEncoding(true);
+  SaveWithRatio(state, kBytes);
+}
+BENCHMARK(BM_SaveCompact)->Arg(1)->Arg(16)->Unit(benchmark::kMillisecond);
+
+// Like BM_Save, with LZ4 compression (and optionally compact encoding).
+void BM_SaveLz4(benchmark::State& state) {
+  const size_t kBytes = static_cast<size_t>(state.range(0)) << 20;
+  FillTrace(kBytes);
+  Runtime::GetInstance()->SetCompactEncoding(state.range(1));
+  Runtime::GetInstance()->SetCompressor(
+      std::unique_ptr<Compressor>{new Lz4Compressor});
+  SaveWithRatio(state, kBytes);
+}
+BENCHMARK(BM_SaveLz4)
+    ->Args({1, 0})
+    ->Args({16, 0})
+    ->Args({16, 1})
+    ->Unit(benchmark::kMillisecond);
+
+// Like BM_Save, but to a file in TMPDIR via SaveToFile().
+void BM_SaveToFile(benchmark::State& state) {
+  const size_t kBytes = static_cast<size_t>(state.range(0)) << 20;
+  FillTrace(kBytes);
+  const char* tmpdir = getenv("TMPDIR");
+  std::string file_name =
+      std::string(tmpdir ? tmpdir : "/tmp") + "/wtf_bench.wtf-trace";
+  for (auto _ : state) {
+    if (!Runtime::GetInstance()->SaveToFile(file_name)) {
+      state.SkipWithError("SaveToFile failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kBytes);
+  remove(file_name.c_str());
+  ResetTrace();
+}
+BENCHMARK(BM_SaveToFile)->Arg(16)->Arg(128)->Unit(benchmark::kMillisecond);
+
+#if !defined(WTF_SINGLE_THREADED)
+// Saves 128 MiB of events from 8 threads to a file, copying with
+// state.range(0) threads.
+void BM_SaveToFileParallel(benchmark::State& state) {
+  static constexpr size_t kThreadCount = 8;
+  static constexpr size_t kBytes = 128 << 20;
+  ResetTrace();
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreadCount; t++) {
+    threads.emplace_back([]() {
+      Runtime::GetInstance()->EnableCurrentThread("SaveThread");
+      for (size_t i = 0; i < kBytes / kThreadCount / 20; i++) {
+        WTF_EVENT("bench#save", int32_t, int32_t, int32_t)(i, i, i);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  Runtime::GetInstance()->SetSaveThreadCount(state.range(0));
+  const char* tmpdir = getenv("TMPDIR");
+  std::string file_name =
+      std::string(tmpdir ? tmpdir : "/tmp") + "/wtf_bench.wtf-trace";
+  for (auto _ : state) {
+    if (!Runtime::GetInstance()->SaveToFile(file_name)) {
+      state.SkipWithError("SaveToFile failed");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * kBytes);
+  remove(file_name.c_str());
+  ResetTrace();
+}
+BENCHMARK(BM_SaveToFileParallel)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+#endif
+
+}  // namespace enabled
+
+}  // namespace
+}  // namespace wtf
+
+BENCHMARK_MAIN();
@@ -1,14 +1,212 @@
 #include "wtf/runtime.h"
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <thread>
 
 #include "gtest/gtest.h"
+#include "wtf/shave.h"
 
 namespace wtf {
 namespace {
 
+// Minimal reader for saved traces. Verifies the chunk layout and that each
+// events part decodes into whole events, using the wtf.event#define events
+// in the trace itself to learn the size of every other event.
+class TraceReader {
+ public:
+  explicit TraceReader(const std::string& data) : data_(data) {
+#if defined(WTF_64BIT_TIMESTAMPS)
+    // Like the loader, know about epoch events ahead of their definition.
+    definitions_[StandardEvents::kTimeEpochEventId] = {"wtf.timing#epoch",
+                                                       {1}};
+#endif
+  }
+
+  // Parses the trace. Returns false and adds a test failure if malformed.
+  bool Parse() {
+    if (!ReadWord(&pos_, 0xdeadbeef) || !Skip(2)) return false;
+    while (pos_ < data_.size()) {
+      if (!ParseChunk()) return false;
+    }
+    return true;
+  }
+
+  // Number of times an event with the given name was seen.
+  size_t count(const std::string& name) { return counts_[name]; }
+
+  // Keeps the arguments of each event with the given name for arguments().
+  // Must be called before Parse().
+  void Record(const std::string& name) { arguments_[name]; }
+  const std::vector<std::vector<uint32_t>>& arguments(
+      const std::string& name) {
+    return arguments_[name];
+  }
+
+  // Zones (as set by wtf.zone#set within the part) of the recorded events
+  // with the given name, in the order of arguments().
+  const std::vector<uint32_t>& zones(const std::string& name) {
+    return zones_[name];
+  }
+
+  // Flags of the event with the given name.
+  uint32_t flags(const std::string& name) { return flags_[name]; }
+
+  // Gets a string by id, as of the last chunk.
+  std::string GetString(uint32_t id) {
+    return id < strings_.size() ? strings_[id] : std::string();
+  }
+
+ private:
+  bool Fail(const char* message) {
+    ADD_FAILURE() << message << " at byte " << pos_;
+    return false;
+  }
+
+  uint32_t WordAt(size_t offset) {
+    uint32_t value;
+    memcpy(&value, data_.data() + offset, sizeof(value));
+    return value;
+  }
+
+  bool ReadWord(size_t* offset, uint32_t expected) {
+    if (*offset + 4 > data_.size() || WordAt(*offset) != expected) {
+      return Fail("Unexpected word");
+    }
+    *offset += 4;
+    return true;
+  }
+
+  bool Skip(size_t words) {
+    pos_ += words * 4;
+    return pos_ <= data_.size() || Fail("Truncated");
+  }
+
+  bool ParseChunk() {
+    if (pos_ + 24 > data_.size()) return Fail("Truncated chunk header");
+    size_t chunk_start = pos_;
+    uint32_t chunk_length = WordAt(pos_ + 8);
+    uint32_t part_count = WordAt(pos_ + 20);
+    size_t parts_start = pos_ + 24 + part_count * 12;
+    if (chunk_start + chunk_length > data_.size()) {
+      return Fail("Truncated chunk");
+    }
+
+    // Strings precede events within a chunk, so load them first.
+    for (uint32_t i = 0; i < part_count; i++) {
+      size_t part_header = pos_ + 24 + i * 12;
+      uint32_t type = WordAt(part_header);
+      size_t offset = parts_start + WordAt(part_header + 4);
+      size_t length = WordAt(part_header + 8);
+      if (type == 0x10000) {
+        std::string json = data_.substr(offset, length);
+        incremental_ =
+            json.find("has_incremental_string_tables") != std::string::npos;
+      } else if (type == 0x30000) {
+        if (!incremental_) {
+          strings_.clear();
+        }
+        size_t end = offset + length;
+        while (offset < end) {
+          strings_.emplace_back(data_.c_str() + offset);
+          offset += strings_.back().size() + 1;
+        }
+      } else if (type == 0x20002) {
+        if (length % 4) return Fail("Unaligned events part");
+        if (!ParseEvents(offset, offset + length)) return false;
+      }
+    }
+    pos_ = chunk_start + chunk_length;
+    return true;
+  }
+
+  // Gets the number of entries of each argument in an argument signature,
+  // with 0 for arrays.
+  static std::vector<size_t> ArgumentEntries(const std::string& args) {
+    std::vector<size_t> entries;
+    std::istringstream in{args};
+    std::string type;
+    std::string name;
+    while (in >> type >> name) {
+      if (type.find("[]") != std::string::npos) {
+        entries.push_back(0);
+      } else if (type == "int64" || type == "uint64" || type == "float64") {
+        entries.push_back(2);
+      } else {
+        entries.push_back(1);
+      }
+    }
+    return entries;
+  }
+
+  bool ParseEvents(size_t offset, size_t end) {
+    uint32_t zone = 0;
+    while (offset < end) {
+      uint32_t wire_id = WordAt(offset);
+      auto it = definitions_.find(wire_id);
+      if (wire_id == 1) {
+        // wtf.event#define: wireId, eventClass, flags, name, args.
+        if (offset + 7 * 4 > end) return Fail("Partial define event");
+        std::string name = GetString(WordAt(offset + 20));
+        std::string args = GetString(WordAt(offset + 24));
+        definitions_[WordAt(offset + 8)] = {name, ArgumentEntries(args)};
+        flags_[name] = WordAt(offset + 16);
+        counts_["wtf.event#define"] += 1;
+        offset += 7 * 4;
+      } else if (it == definitions_.end()) {
+        return Fail("Undefined event");
+      } else {
+        size_t entries = 2;
+        for (size_t arg_entries : it->second.second) {
+          if (!arg_entries) {
+            // Arrays are a length followed by the padded elements.
+            if (offset + (entries + 1) * 4 > end) return Fail("Partial array");
+            uint32_t length = WordAt(offset + entries * 4);
+            arg_entries = 1 + (length == 0xffffffff ? 0 : (length + 3) / 4);
+          }
+          entries += arg_entries;
+        }
+        if (offset + entries * 4 > end) return Fail("Partial event");
+        auto recorded = arguments_.find(it->second.first);
+        if (recorded != arguments_.end()) {
+          recorded->second.emplace_back(entries - 2);
+          for (size_t i = 2; i < entries; i++) {
+            recorded->second.back()[i - 2] = WordAt(offset + i * 4);
+          }
+          zones_[it->second.first].push_back(zone);
+        }
+        if (it->second.first == "wtf.zone#set") {
+          zone = WordAt(offset + 8);
+        }
+        offset += entries * 4;
+        counts_[it->second.first] += 1;
+      }
+    }
+    return true;
+  }
+
+  const std::string& data_;
+  size_t pos_ = 0;
+  bool incremental_ = false;
+  std::vector<std::string> strings_;
+  std::map<uint32_t, std::pair<std::string, std::vector<size_t>>>
+      definitions_;
+  std::map<std::string, size_t> counts_;
+  std::map<std::string, uint32_t> flags_;
+  std::map<std::string, std::vector<std::vector<uint32_t>>> arguments_;
+  std::map<std::string, std::vector<uint32_t>> zones_;
+};
+
 class RuntimeTest : public ::testing::Test {
  protected:
+  void TearDown() override {
+    Runtime::GetInstance()->DisableCurrentThread();
+    Runtime::GetInstance()->ResetForTesting();
+  }
 };
 
 TEST_F(RuntimeTest, BasicEndToEnd) {
@@ -26,11 +224,949 @@ TEST_F(RuntimeTest, BasicEndToEnd) {
     s.Leave();
   }
 
-  std::fstream out;
-  out.open("tmptestbuf.wtf-trace", std::ios_base::out | std::ios_base::trunc);
-  Runtime::GetInstance()->Save(&out);
-  out.close();
+  std::ostringstream out_stream;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  std::string data = out_stream.str();
+  TraceReader reader{data};
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(11u, reader.count("foo#bar"));
+  EXPECT_EQ(10u, reader.count("bar#scope"));
+  EXPECT_EQ(10u, reader.count("wtf.scope#leave"));
+
+  // Saving to a file makes the same trace.
+  ASSERT_TRUE(Runtime::GetInstance()->SaveToFile("tmptestbuf.wtf-trace"));
+  std::ifstream in{"tmptestbuf.wtf-trace"};
+  std::string file_data{std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>()};
+  TraceReader file_reader{file_data};
+  ASSERT_TRUE(file_reader.Parse());
+  EXPECT_EQ(11u, file_reader.count("foo#bar"));
+  EXPECT_EQ(10u, file_reader.count("wtf.scope#leave"));
+}
+
+#if defined(WTF_PLATFORM_HAS_FILE_DESCRIPTORS)
+TEST_F(RuntimeTest, SaveToFileWritesToPipes) {
+  Runtime::GetInstance()->EnableCurrentThread("PipeThread");
+  Event<uint32_t> event{"pipe#event: i"};
+  for (uint32_t i = 0; i < 10; i++) {
+    event.Invoke(i);
+  }
+
+  // Small enough a trace to fit in the pipe without a reader.
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_TRUE(Runtime::GetInstance()->SaveToFile("/dev/fd/" +
+                                                 std::to_string(fds[1])));
+  close(fds[1]);
+  std::string data;
+  char chunk[4096];
+  ssize_t length;
+  while ((length = read(fds[0], chunk, sizeof(chunk))) > 0) {
+    data.append(chunk, length);
+  }
+  close(fds[0]);
+
+  TraceReader reader{data};
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(10u, reader.count("pipe#event"));
+}
+#endif  // WTF_PLATFORM_HAS_FILE_DESCRIPTORS
+
+TEST_F(RuntimeTest, StaticStringArguments) {
+  StringTable string_table;
+  EventBlockPool block_pool;
+  EventBuffer event_buffer{&string_table, &block_pool};
+  EventEnabled<StaticString, uint32_t, StaticString> event{
+      "worker#state: state, i, queue"};
+
+  static const char* kStates[] = {"idle", "running", "idle", "done"};
+  for (uint32_t i = 0; i < 4; i++) {
+    event.InvokeSpecific(&event_buffer, kStates[i], i, "queue");
+  }
+  event.InvokeSpecific(&event_buffer, nullptr, 4, "queue");
+
+  OutputBuffer::PartHeader header;
+  event_buffer.PopulateHeader(&header);
+  std::ostringstream out;
+  OutputBuffer output_buffer{&out};
+  ASSERT_TRUE(event_buffer.WriteTo(&header, &output_buffer));
+  std::string data = out.str();
+#if defined(WTF_64BIT_TIMESTAMPS)
+  // Skip the leading epoch event.
+  data.erase(0, 3 * sizeof(uint32_t));
+#endif
+  ASSERT_EQ(5 * 5 * sizeof(uint32_t), data.size());
+  const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+  int queue_id = string_table.GetStringId("queue");
+  for (uint32_t i = 0; i < 4; i++) {
+    const uint32_t* event_words = words + i * 5;
+    EXPECT_EQ(static_cast<uint32_t>(string_table.GetStringId(kStates[i])),
+              event_words[2]);
+    EXPECT_EQ(i, event_words[3]);
+    EXPECT_EQ(static_cast<uint32_t>(queue_id), event_words[4]);
+  }
+  EXPECT_EQ(static_cast<uint32_t>(StringTable::kEmptyStringId), words[22]);
+}
+
+TEST_F(RuntimeTest, WideAndByteArrayArguments) {
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  using WideEvent = Event<int64_t, uint64_t, float, double, bool, Uint8Array>;
+  WideEvent event{"foo#wide: a, b, c, d, e, f"};
+  static const uint8_t kBytes[] = {1, 2, 3, 4, 5};
+  event.Invoke(-2, 0x123456789abcdef0u, 1.5f, -0.25, true, {kBytes, 5});
+  event.Invoke(0, 0, 0, 0, false, {nullptr, 0});
+  std::vector<uint8_t> large(4096, 7);
+  event.Invoke(0, 0, 0, 0, false, {large.data(), large.size()});
+
+  std::ostringstream out_stream;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  std::string data = out_stream.str();
+  TraceReader reader{data};
+  reader.Record("foo#wide");
+  ASSERT_TRUE(reader.Parse());
+  const auto& arguments = reader.arguments("foo#wide");
+  ASSERT_EQ(3u, arguments.size());
+
+  const std::vector<uint32_t>& first = arguments[0];
+  ASSERT_EQ(WideEvent::kEntryCount - 2 + 2, first.size());
+  EXPECT_EQ(0xfffffffeu, first[0]);
+  EXPECT_EQ(0xffffffffu, first[1]);
+  EXPECT_EQ(0x9abcdef0u, first[2]);
+  EXPECT_EQ(0x12345678u, first[3]);
+  float c;
+  memcpy(&c, &first[4], sizeof(c));
+  EXPECT_EQ(1.5f, c);
+  double d;
+  memcpy(&d, &first[5], sizeof(d));
+  EXPECT_EQ(-0.25, d);
+  EXPECT_EQ(1u, first[7]);
+  EXPECT_EQ(5u, first[8]);
+  EXPECT_EQ(0x04030201u, first[9]);
+  EXPECT_EQ(0x00000005u, first[10]);
+
+  // A null array is a lone 0xffffffff length.
+  ASSERT_EQ(WideEvent::kEntryCount - 2, arguments[1].size());
+  EXPECT_EQ(0u, arguments[1][7]);
+  EXPECT_EQ(0xffffffffu, arguments[1][8]);
+
+  // Large arrays are truncated to fill the largest possible event.
+  const std::vector<uint32_t>& third = arguments[2];
+  ASSERT_EQ(EventBlock::kMaxEventEntries - 2, third.size());
+  EXPECT_EQ(static_cast<uint32_t>(WideEvent::kMaxVariableBytes), third[8]);
+  EXPECT_EQ(0x07070707u, third.back());
+}
+
+TEST_F(RuntimeTest, SampledEvents) {
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  SampledEvent<int32_t> event{"foo#sampled: i", 4};
+  for (int32_t i = 0; i < 10; i++) {
+    event.Invoke(i);
+  }
+  SampledScopedEvent<> scope_event{"foo#sampledScope", 3};
+  for (int i = 0; i < 6; i++) {
+    SampledAutoScope<> scope{scope_event};
+    scope.Enter();
+  }
+
+  // Threads enabled from now on are rate limited.
+  Runtime::GetInstance()->SetSampledEventRateLimit(1, 5);
+  Runtime::GetInstance()->DisableCurrentThread();
+  Runtime::GetInstance()->EnableCurrentThread("LimitedThread");
+  SampledEvent<> limited_event{"foo#limited", 1};
+  for (int i = 0; i < 100; i++) {
+    limited_event.Invoke();
+  }
+  EXPECT_EQ(95u, PlatformGetThreadLocalEventBuffer()->rate_limited_events());
+
+  std::ostringstream out_stream;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  std::string data = out_stream.str();
+  TraceReader reader{data};
+  reader.Record("foo#sampled");
+  ASSERT_TRUE(reader.Parse());
+  const auto& arguments = reader.arguments("foo#sampled");
+  ASSERT_EQ(3u, arguments.size());
+  EXPECT_EQ(0u, arguments[0][0]);
+  EXPECT_EQ(4u, arguments[1][0]);
+  EXPECT_EQ(8u, arguments[2][0]);
+  EXPECT_EQ(4u, reader.flags("foo#sampled") >> EventFlags::kSamplePeriodShift);
+  EXPECT_EQ(2u, reader.count("foo#sampledScope"));
+  EXPECT_EQ(2u, reader.count("wtf.scope#leave"));
+  EXPECT_EQ(3u,
+            reader.flags("foo#sampledScope") >> EventFlags::kSamplePeriodShift);
+  EXPECT_EQ(5u, reader.count("foo#limited"));
+}
+
+TEST_F(RuntimeTest, AggregatedScopes) {
+  Runtime::GetInstance()->SetScopeAggregation(16);
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  ScopedEvent<uint32_t> outer{"foo#outer: i"};
+  ScopedEvent<> inner{"foo#inner"};
+  for (uint32_t i = 0; i < 10; i++) {
+    AutoScope<uint32_t> outer_scope{outer};
+    outer_scope.Enter(i);
+    AutoScope<> inner_scope{inner};
+    inner_scope.Enter();
+    usleep(100);
+  }
+  inner.Enter();
+  inner.Leave();
+
+  auto histograms = Runtime::GetInstance()->GetScopeHistograms();
+  ASSERT_EQ(2u, histograms.size());
+  EXPECT_EQ("foo#outer", histograms[0].name);
+  EXPECT_EQ(10u, histograms[0].durations.count());
+  EXPECT_GE(histograms[0].durations.ValueAtQuantile(0.5), 100u);
+  EXPECT_EQ("foo#inner", histograms[1].name);
+  EXPECT_EQ(11u, histograms[1].durations.count());
+  EXPECT_GE(histograms[1].durations.ValueAtQuantile(0.9), 100u);
+
+  // Instead of the scopes, the trace has their summaries.
+  std::ostringstream out_stream;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  std::string data = out_stream.str();
+  TraceReader reader{data};
+  reader.Record("wtf.scope#summary");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(0u, reader.count("foo#outer"));
+  EXPECT_EQ(0u, reader.count("foo#inner"));
+  EXPECT_EQ(0u, reader.count("wtf.scope#leave"));
+  const auto& summaries = reader.arguments("wtf.scope#summary");
+  ASSERT_EQ(2u, summaries.size());
+  // name, count (2 words), totalMicros (2 words), p50, p90, p99, max.
+  ASSERT_EQ(9u, summaries[1].size());
+  EXPECT_EQ("foo#inner", reader.GetString(summaries[1][0]));
+  EXPECT_EQ(11u, summaries[1][1]);
+  EXPECT_EQ(0u, summaries[1][2]);
+  EXPECT_EQ(histograms[1].durations.ValueAtQuantile(0.5), summaries[1][5]);
+  EXPECT_LE(summaries[1][5], summaries[1][8]);
+
+  // Threads enabled after aggregation is turned off emit scopes again.
+  Runtime::GetInstance()->SetScopeAggregation(0);
+  Runtime::GetInstance()->DisableCurrentThread();
+  Runtime::GetInstance()->EnableCurrentThread("TracingThread");
+  inner.Enter();
+  inner.Leave();
+  out_stream.str("");
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  data = out_stream.str();
+  TraceReader tracing_reader{data};
+  ASSERT_TRUE(tracing_reader.Parse());
+  EXPECT_EQ(1u, tracing_reader.count("foo#inner"));
+  EXPECT_EQ(2u, tracing_reader.count("wtf.scope#summary"));
+}
+
+TEST_F(RuntimeTest, AggregatedSampledScopes) {
+  Runtime::GetInstance()->SetScopeAggregation(16);
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  SampledScopedEvent<uint32_t> scope_event{"foo#sampledOuter: i", 3};
+  for (uint32_t i = 0; i < 9; i++) {
+    SampledAutoScope<uint32_t> scope{scope_event};
+    scope.Enter(i);
+  }
+
+  // Only the sampled entries are aggregated.
+  auto histograms = Runtime::GetInstance()->GetScopeHistograms();
+  ASSERT_EQ(1u, histograms.size());
+  EXPECT_EQ("foo#sampledOuter", histograms[0].name);
+  EXPECT_EQ(3u, histograms[0].durations.count());
+
+  std::ostringstream out_stream;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  std::string data = out_stream.str();
+  TraceReader reader{data};
+  reader.Record("wtf.scope#summary");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(0u, reader.count("foo#sampledOuter"));
+  EXPECT_EQ(0u, reader.count("wtf.scope#leave"));
+  const auto& summaries = reader.arguments("wtf.scope#summary");
+  ASSERT_EQ(1u, summaries.size());
+  EXPECT_EQ("foo#sampledOuter", reader.GetString(summaries[0][0]));
+  EXPECT_EQ(3u, summaries[0][1]);
+}
+
+TEST_F(RuntimeTest, FlowsFollowHandles) {
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  FlowHandle flow = FlowHandle::Branch("Request#decode");
+  ASSERT_FALSE(flow.empty());
+  FlowHandle child = FlowHandle::Branch("Request#child", flow);
+  EXPECT_NE(flow.id(), child.id());
+
+  auto continue_flow = [](FlowHandle flow) {
+    Runtime::GetInstance()->EnableCurrentThread("WorkerThread");
+    ScopedEvent<> scope{"Worker#Decode"};
+    scope.Enter();
+    flow.Extend("Request#decode");
+    flow.Terminate();
+    EXPECT_TRUE(flow.empty());
+    flow.Terminate();
+    scope.Leave();
+  };
+  uint32_t id = flow.id();
+#if defined(WTF_SINGLE_THREADED)
+  continue_flow(std::move(flow));
+#else
+  std::thread worker{continue_flow, std::move(flow)};
+  worker.join();
+#endif
+  EXPECT_TRUE(flow.empty());
+  child.Terminate();
+  FlowHandle::FromId(id).Extend("Request#done");
+
+  std::ostringstream out_stream;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out_stream));
+  std::string data = out_stream.str();
+  TraceReader reader{data};
+  reader.Record("wtf.flow#branch");
+  reader.Record("wtf.flow#extend");
+  reader.Record("wtf.flow#terminate");
+  ASSERT_TRUE(reader.Parse());
+  const auto& branches = reader.arguments("wtf.flow#branch");
+  ASSERT_EQ(2u, branches.size());
+  EXPECT_EQ(id, branches[0][0]);
+  EXPECT_EQ(0u, branches[0][1]);
+  EXPECT_EQ("Request#decode", reader.GetString(branches[0][2]));
+  EXPECT_EQ(id, branches[1][1]);
+  // Thread parts may come in any order.
+  std::map<std::string, uint32_t> extends;
+  for (const auto& arguments : reader.arguments("wtf.flow#extend")) {
+    extends[reader.GetString(arguments[1])] = arguments[0];
+  }
+  EXPECT_EQ(2u, reader.count("wtf.flow#extend"));
+  EXPECT_EQ(id, extends["Request#decode"]);
+  EXPECT_EQ(id, extends["Request#done"]);
+  // Terminating an empty handle emits nothing.
+  std::vector<uint32_t> terminates;
+  for (const auto& arguments : reader.arguments("wtf.flow#terminate")) {
+    terminates.push_back(arguments[0]);
+  }
+  std::sort(terminates.begin(), terminates.end());
+  EXPECT_EQ((std::vector<uint32_t>{id, branches[1][0]}), terminates);
+}
+
+TEST_F(RuntimeTest, PerCpuBuffersKeepEventsInTheirZones) {
+  static EventEnabled<uint32_t> event{"perCpu#event: thread"};
+  static constexpr uint32_t kEventCount = 1000;
+  auto log = [](uint32_t thread) {
+    std::string name = "PerCpuThread" + std::to_string(thread);
+    Runtime::GetInstance()->EnableCurrentThread(name.c_str());
+    EXPECT_NE(nullptr,
+              PlatformGetThreadLocalEventBuffer()->cpu_event_buffers());
+    for (uint32_t i = 0; i < kEventCount; i++) {
+      event.Invoke(thread);
+    }
+  };
+  auto log_on_threads = [&log](uint32_t first, uint32_t count) {
+#if defined(WTF_SINGLE_THREADED)
+    // Each thread gets a zone of its own, and the main thread's comes back.
+    EventBuffer* main_event_buffer = PlatformGetThreadLocalEventBuffer();
+    for (uint32_t thread = first; thread < first + count; thread++) {
+      Runtime::GetInstance()->DisableCurrentThread();
+      log(thread);
+    }
+    PlatformSetThreadLocalEventBuffer(main_event_buffer);
+#else
+    std::vector<std::thread> threads;
+    for (uint32_t thread = first; thread < first + count; thread++) {
+      threads.emplace_back(log, thread);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+#endif
+  };
+
+  // Chunks that resume a CPU buffer start in the zone of its last writer,
+  // which the main thread relies on after the first chunk.
+  Runtime::GetInstance()->SetPerCpuBuffers(true);
+  std::ostringstream out;
+  Runtime::SaveCursor cursor;
+  log(0);
+  log_on_threads(1, 4);
+  ASSERT_TRUE(Runtime::GetInstance()->SaveIncremental(&out, &cursor));
+  log(0);
+  log_on_threads(5, 4);
+  ASSERT_TRUE(Runtime::GetInstance()->SaveIncremental(&out, &cursor));
+
+  std::string data = out.str();
+  TraceReader reader{data};
+  reader.Record("perCpu#event");
+  reader.Record("wtf.zone#create");
+  ASSERT_TRUE(reader.Parse());
+  std::map<uint32_t, uint32_t> zone_threads;
+  for (const auto& arguments : reader.arguments("wtf.zone#create")) {
+    std::string name = reader.GetString(arguments[1]);
+    ASSERT_EQ(0u, name.find("PerCpuThread"));
+    zone_threads[arguments[0]] = std::stoul(name.substr(12));
+  }
+  EXPECT_EQ(9u, zone_threads.size());
+  const auto& arguments = reader.arguments("perCpu#event");
+  const auto& zones = reader.zones("perCpu#event");
+  ASSERT_EQ(10 * kEventCount, arguments.size());
+  std::map<uint32_t, size_t> thread_counts;
+  for (size_t i = 0; i < arguments.size(); i++) {
+    ASSERT_EQ(1u, zone_threads.count(zones[i]));
+    EXPECT_EQ(zone_threads[zones[i]], arguments[i][0]);
+    thread_counts[arguments[i][0]]++;
+  }
+  EXPECT_EQ(2 * kEventCount, thread_counts[0]);
+  EXPECT_EQ(static_cast<size_t>(kEventCount), thread_counts[8]);
+}
+
+TEST_F(RuntimeTest, ShaveEventsLandInTheirZone) {
+  static EventEnabled<uint32_t> frame_event{"shave#frame: frame"};
+  static ScopedEventEnabled<> kernel_scope{"shave#kernel"};
+  ShaveEventRing ring;
+  uint32_t entries[64];
+  Runtime::GetInstance()->AddShaveEventRing(&ring, entries, 64, "SHAVE0");
+
+  // The SHAVE side, which is plain host code here.
+  for (uint32_t frame = 0; frame < 30; frame++) {
+    ShaveAutoScope scope(&ring, kernel_scope.wire_id());
+    ShaveEvent(&ring, frame_event.wire_id(), frame);
+    if (frame % 5 == 4) {
+      Runtime::GetInstance()->DrainShaveEventRings();
+    }
+  }
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  Runtime::GetInstance()->RemoveShaveEventRing(&ring);
+
+  std::string data = out.str();
+  TraceReader reader{data};
+  reader.Record("shave#frame");
+  reader.Record("wtf.zone#create");
+  ASSERT_TRUE(reader.Parse());
+  ASSERT_EQ(1u, reader.arguments("wtf.zone#create").size());
+  const auto& zone = reader.arguments("wtf.zone#create")[0];
+  EXPECT_EQ("SHAVE0", reader.GetString(zone[1]));
+  ASSERT_EQ(30u, reader.arguments("shave#frame").size());
+  for (uint32_t frame = 0; frame < 30; frame++) {
+    EXPECT_EQ(frame, reader.arguments("shave#frame")[frame][0]);
+    EXPECT_EQ(zone[0], reader.zones("shave#frame")[frame]);
+  }
+  EXPECT_EQ(30u, reader.count("shave#kernel"));
+  EXPECT_EQ(30u, reader.count("wtf.scope#leave"));
+}
+
+TEST_F(RuntimeTest, StatsAccountForTheOverhead) {
+  Runtime::GetInstance()->SetStatsEvents(true);
+  Runtime::GetInstance()->EnableCurrentThread("StatsThread");
+  EventBuffer* event_buffer = PlatformGetThreadLocalEventBuffer();
+  uint64_t lookups = event_buffer->string_table_lookups();
+  Event<const char*> event{"stats#event: s"};
+  for (size_t i = 0; i < 3000; i++) {
+    event.Invoke("same");
+  }
+  // One miss for the string, whatever the cache held.
+  EXPECT_EQ(lookups + 1, event_buffer->string_table_lookups());
+
+  std::ostringstream first;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&first));
+  std::ostringstream second;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&second));
+
+  Runtime::Stats stats = Runtime::GetInstance()->GetStats();
+  ASSERT_EQ(1u, stats.buffers.size());
+  const Runtime::BufferStats& buffer_stats = stats.buffers[0];
+  EXPECT_EQ(event_buffer->zone_id(), buffer_stats.zone_id);
+  EXPECT_EQ("StatsThread", buffer_stats.name);
+  // Counting the zone's creation and setting.
+  EXPECT_EQ(3002u, buffer_stats.events);
+  // 3000 events of 3 entries take 3 blocks.
+  EXPECT_EQ(2u, buffer_stats.block_allocations);
+  EXPECT_EQ(3 * sizeof(EventBlock), buffer_stats.bytes);
+  EXPECT_EQ(0u, buffer_stats.dropped_events);
+  EXPECT_EQ(2u, stats.last_save.chunks);
+
+  // The second trace carries the first save's phases.
+  std::string data = second.str();
+  TraceReader reader{data};
+  reader.Record("wtf.runtime#stats");
+  reader.Record("wtf.runtime#saveStats");
+  ASSERT_TRUE(reader.Parse());
+  ASSERT_EQ(1u, reader.arguments("wtf.runtime#stats").size());
+  const auto& arguments = reader.arguments("wtf.runtime#stats")[0];
+  EXPECT_EQ(static_cast<uint32_t>(buffer_stats.zone_id), arguments[0]);
+  EXPECT_EQ("StatsThread", reader.GetString(arguments[1]));
+  // 64bit arguments take two entries, low word first.
+  EXPECT_EQ(3002u, arguments[2]);
+  EXPECT_EQ(0u, arguments[3]);
+  EXPECT_EQ(1u, reader.count("wtf.runtime#saveStats"));
+
+  // With per CPU buffers, each event is counted once, by the buffer that
+  // stores it, so the counts add up to the events in the trace (less the
+  // wtf.zone#set that the part of the first thread's buffer starts with).
+  Runtime::GetInstance()->SetPerCpuBuffers(true);
+  Runtime::GetInstance()->DisableCurrentThread();
+  Runtime::GetInstance()->EnableCurrentThread("CpuStatsThread");
+  for (size_t i = 0; i < 1000; i++) {
+    event.Invoke("same");
+  }
+  std::ostringstream third;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&third));
+  data = third.str();
+  TraceReader cpu_reader{data};
+  ASSERT_TRUE(cpu_reader.Parse());
+  EXPECT_EQ(4000u, cpu_reader.count("stats#event"));
+  uint64_t total_events = 0;
+  for (const auto& cpu_buffer_stats :
+       Runtime::GetInstance()->GetStats().buffers) {
+    total_events += cpu_buffer_stats.events;
+  }
+  EXPECT_EQ(cpu_reader.count("stats#event") +
+                cpu_reader.count("wtf.zone#create") +
+                cpu_reader.count("wtf.zone#set") - 1,
+            total_events);
+}
+
+TEST_F(RuntimeTest, CompactTracesExpandToStandardTraces) {
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  Event<int32_t, const char*> event{"foo#event: i, s"};
+  Event<int64_t, double, Uint8Array> wide_event{"foo#wide: a, b, c"};
+  static const uint8_t kBytes[] = {1, 2, 3};
+  for (int32_t i = -500; i < 500; i++) {
+    event.Invoke(i, i % 2 ? "odd" : "even");
+    wide_event.Invoke(i * 1000000000ll, i / 4.0, {kBytes, 3});
+  }
+
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  std::string standard_data = out.str();
+  TraceReader standard_reader{standard_data};
+  standard_reader.Record("foo#event");
+  standard_reader.Record("foo#wide");
+  ASSERT_TRUE(standard_reader.Parse());
+
+  Runtime::GetInstance()->SetCompactEncoding(true);
+  std::ostringstream compact_out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&compact_out));
+  std::string compact_data = compact_out.str();
+  EXPECT_LT(compact_data.size(), standard_data.size() * 3 / 4);
+
+  std::string data;
+  ASSERT_TRUE(ExpandCompactTrace(compact_data, &data));
+  ASSERT_EQ(standard_data.size(), data.size());
+  TraceReader reader{data};
+  reader.Record("foo#event");
+  reader.Record("foo#wide");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(1000u, reader.arguments("foo#event").size());
+  EXPECT_EQ(standard_reader.arguments("foo#event"),
+            reader.arguments("foo#event"));
+  EXPECT_EQ(standard_reader.arguments("foo#wide"),
+            reader.arguments("foo#wide"));
+
+  // Incremental chunks are encoded on their own.
+  std::string incremental_data;
+  Runtime::SaveCursor cursor;
+  for (int i = 0; i < 2; i++) {
+    event.Invoke(i, "incremental");
+    std::ostringstream chunk_out;
+    ASSERT_TRUE(Runtime::GetInstance()->SaveIncremental(&chunk_out, &cursor));
+    incremental_data += chunk_out.str();
+  }
+  ASSERT_TRUE(ExpandCompactTrace(incremental_data, &data));
+  TraceReader incremental_reader{data};
+  ASSERT_TRUE(incremental_reader.Parse());
+  EXPECT_EQ(1002u, incremental_reader.count("foo#event"));
+}
+
+TEST_F(RuntimeTest, CompressedTracesDecompressToStandardTraces) {
+  Runtime::GetInstance()->EnableCurrentThread("TestThread");
+  Event<int32_t, const char*> event{"foo#event: i, s"};
+  for (int32_t i = 0; i < 10000; i++) {
+    event.Invoke(i % 16, i % 2 ? "odd" : "even");
+  }
+
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  std::string standard_data = out.str();
+
+  Runtime::GetInstance()->SetCompressor(
+      std::unique_ptr<Compressor>{new Lz4Compressor});
+  ASSERT_TRUE(Runtime::GetInstance()->SaveToFile("tmpcompressed.wtf-trace"));
+  std::ifstream in{"tmpcompressed.wtf-trace"};
+  std::string compressed_data{std::istreambuf_iterator<char>(in),
+                              std::istreambuf_iterator<char>()};
+  EXPECT_LT(compressed_data.size(), standard_data.size() / 2);
+  EXPECT_NE(std::string::npos, compressed_data.find("has_compressed_chunks"));
+
+  std::string data;
+  ASSERT_TRUE(DecompressTrace(compressed_data, &data));
+  // Only the flag in the header makes a difference in size.
+  EXPECT_EQ(standard_data.size() + sizeof(",\"has_compressed_chunks\"") - 1,
+            data.size());
+  TraceReader reader{data};
+  reader.Record("foo#event");
+  ASSERT_TRUE(reader.Parse());
+  ASSERT_EQ(10000u, reader.arguments("foo#event").size());
+  EXPECT_EQ(15u, reader.arguments("foo#event")[15][0]);
+  EXPECT_EQ("odd", reader.GetString(reader.arguments("foo#event")[15][1]));
+}
+
+TEST_F(RuntimeTest, TimestampsTrackWallTime) {
+  Runtime::GetInstance();  // Initializes the platform.
+  uint32_t start = PlatformGetTimestampMicros32();
+  usleep(20000);
+  uint32_t elapsed = PlatformGetTimestampMicros32() - start;
+  EXPECT_GE(elapsed, 19000u);
+  EXPECT_LT(elapsed, 1000000u);
+}
+
+TEST_F(RuntimeTest, FlightRecorderKeepsRecentWindow) {
+  static constexpr uint32_t kEventCount = 100000;
+  EventEnabled<uint32_t> event{"recorder#event: i"};
+  Runtime::GetInstance()->SetFlightRecorderBudget(4 * sizeof(EventBlock));
+  Runtime::GetInstance()->EnableCurrentThread("RecorderThread");
+  for (uint32_t i = 0; i < kEventCount; i++) {
+    event.Invoke(i);
+  }
+
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  std::string data = out.str();
+  EXPECT_LT(data.size(), 5 * sizeof(EventBlock));
+  TraceReader reader{data};
+  reader.Record("recorder#event");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(1u, reader.count("wtf.zone#create"));
+  auto& arguments = reader.arguments("recorder#event");
+  ASSERT_LT(0u, arguments.size());
+  ASSERT_GT(kEventCount, arguments.size());
+  for (size_t i = 0; i < arguments.size(); i++) {
+    EXPECT_EQ(kEventCount - arguments.size() + i, arguments[i][0]);
+  }
+}
+
+TEST_F(RuntimeTest, IncrementalSavesConcatenate) {
+  EventEnabled<uint32_t, const char*> event{"incremental#event: i, s"};
+  Runtime::GetInstance()->EnableCurrentThread("IncrementalThread");
+  Runtime::SaveCursor cursor;
+  std::string data;
+  std::vector<size_t> sizes;
+  static constexpr uint32_t kSaveCount = 3;
+  static constexpr uint32_t kEventsPerSave = 1000;
+  for (uint32_t save = 0; save < kSaveCount; save++) {
+    for (uint32_t i = save * kEventsPerSave; i < (save + 1) * kEventsPerSave;
+         i++) {
+      event.Invoke(i, std::to_string(save).c_str());
+    }
+    std::ostringstream out;
+    ASSERT_TRUE(Runtime::GetInstance()->SaveIncremental(&out, &cursor));
+    data += out.str();
+    sizes.push_back(out.str().size());
+  }
+
+  // Each save only carries its own events.
+  EXPECT_LT(sizes[2], sizes[0]);
+  EXPECT_EQ(sizes[1], sizes[2]);
+  TraceReader reader{data};
+  reader.Record("incremental#event");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(1u, reader.count("wtf.zone#create"));
+  auto& arguments = reader.arguments("incremental#event");
+  ASSERT_EQ(static_cast<size_t>(kSaveCount * kEventsPerSave),
+            arguments.size());
+  for (uint32_t i = 0; i < arguments.size(); i++) {
+    EXPECT_EQ(i, arguments[i][0]);
+    EXPECT_EQ(std::to_string(i / kEventsPerSave),
+              reader.GetString(arguments[i][1]));
+  }
+
+  // A save with nothing new is an empty chunk.
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->SaveIncremental(&out, &cursor));
+  EXPECT_GT(sizes[2], out.str().size());
+}
+
+TEST_F(RuntimeTest, EventsRegisteredBetweenSavesAreDefined) {
+  Runtime::GetInstance()->EnableCurrentThread("DefineThread");
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+
+  // Definitions serialized by the first save are kept and extended.
+  EventEnabled<uint32_t> event{"late#event: i"};
+  event.Invoke(1);
+  std::ostringstream late_out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&late_out));
+  std::string data = late_out.str();
+  TraceReader reader{data};
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(1u, reader.count("late#event"));
+}
+
+#if !defined(WTF_SINGLE_THREADED)
+TEST_F(RuntimeTest, EventsRegisterConcurrently) {
+  static constexpr int kThreadCount = 4;
+  static constexpr int kEventsPerThread = 100;
+  EventRegistry* registry = EventRegistry::GetInstance();
+  size_t first_index = registry->GetEventDefinitions().size();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; t++) {
+    threads.emplace_back([]() {
+      for (int i = 0; i < kEventsPerThread; i++) {
+        EventEnabled<> event{"concurrent#event"};
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto definitions = registry->GetEventDefinitions(first_index);
+  ASSERT_EQ(static_cast<size_t>(kThreadCount * kEventsPerThread),
+            definitions.size());
+  for (auto& definition : definitions) {
+    EXPECT_EQ("concurrent#event", definition.name());
+  }
+}
+
+TEST_F(RuntimeTest, SaveWhileThreadsWrite) {
+  static constexpr int kThreadCount = 8;
+  static constexpr int kEventsPerThread = 100000;
+  static EventEnabled<uint32_t, const char*> event{"stress#event: i, s"};
+  static ScopedEventEnabled<uint32_t> scope{"stress#scope: i"};
+
+  platform::atomic<int> running{kThreadCount};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; t++) {
+    threads.emplace_back([&running]() {
+      Runtime::GetInstance()->EnableCurrentThread("StressThread");
+      for (int i = 0; i < kEventsPerThread; i++) {
+        AutoScopeEnabled<uint32_t> auto_scope{scope};
+        auto_scope.Enter(i);
+        event.Invoke(i, (i % 2) ? "odd" : "even");
+      }
+      running.fetch_add(-1);
+    });
+  }
+
+  // Save repeatedly while the threads are logging. Every snapshot must
+  // decode into whole events.
+  int save_count = 0;
+  do {
+    std::ostringstream out;
+    ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+    std::string data = out.str();
+    TraceReader reader{data};
+    ASSERT_TRUE(reader.Parse());
+    EXPECT_GE(reader.count("stress#scope"), reader.count("stress#event"));
+    save_count += 1;
+  } while (running.load() > 0);
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  std::string data = out.str();
+  TraceReader reader{data};
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(static_cast<size_t>(kThreadCount * kEventsPerThread),
+            reader.count("stress#event"));
+  EXPECT_EQ(static_cast<size_t>(kThreadCount * kEventsPerThread),
+            reader.count("wtf.scope#leave"));
+  EXPECT_GT(save_count, 0);
+}
+
+TEST_F(RuntimeTest, ParallelSaveMatchesSerialSave) {
+  static constexpr int kThreadCount = 4;
+  static constexpr int kEventsPerThread = 100000;
+  static EventEnabled<uint32_t, const char*> event{"parallel#event: i, s"};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; t++) {
+    threads.emplace_back([]() {
+      Runtime::GetInstance()->EnableCurrentThread("ParallelThread");
+      for (int i = 0; i < kEventsPerThread; i++) {
+        event.Invoke(i, std::to_string(i % 100).c_str());
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  std::string serial_data = out.str();
+  TraceReader serial_reader{serial_data};
+  serial_reader.Record("parallel#event");
+  ASSERT_TRUE(serial_reader.Parse());
+
+  Runtime::GetInstance()->SetSaveThreadCount(4);
+  ASSERT_TRUE(Runtime::GetInstance()->SaveToFile("tmpparallel.wtf-trace"));
+  std::ifstream in{"tmpparallel.wtf-trace"};
+  std::string data{std::istreambuf_iterator<char>(in),
+                   std::istreambuf_iterator<char>()};
+  ASSERT_EQ(serial_data.size(), data.size());
+  TraceReader reader{data};
+  reader.Record("parallel#event");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(static_cast<size_t>(kThreadCount), reader.count("wtf.zone#create"));
+  EXPECT_EQ(serial_reader.arguments("parallel#event"),
+            reader.arguments("parallel#event"));
+  EXPECT_EQ(static_cast<size_t>(kThreadCount * kEventsPerThread),
+            reader.arguments("parallel#event").size());
+}
+
+TEST_F(RuntimeTest, StreamingWritesSuccessiveChunks) {
+  static EventEnabled<uint32_t, const char*> event{"stream#event: i, s"};
+  std::ostringstream out;
+  Runtime::StreamingOptions options;
+  options.flush_interval_millis = 1;
+  ASSERT_TRUE(Runtime::GetInstance()->StartStreaming(&out, options));
+  EXPECT_FALSE(Runtime::GetInstance()->StartStreaming(&out, options));
+
+  // Strings are introduced over time so that they land in different chunks.
+  static constexpr int kEventCount = 20;
+  std::thread thread{[]() {
+    Runtime::GetInstance()->EnableCurrentThread("StreamThread");
+    for (int i = 0; i < kEventCount; i++) {
+      event.Invoke(i, std::to_string(i).c_str());
+      usleep(2000);
+    }
+  }};
+  thread.join();
+  ASSERT_TRUE(Runtime::GetInstance()->StopStreaming());
+
+  std::string data = out.str();
+  TraceReader reader{data};
+  reader.Record("stream#event");
+  ASSERT_TRUE(reader.Parse());
+  auto& arguments = reader.arguments("stream#event");
+  ASSERT_EQ(static_cast<size_t>(kEventCount), arguments.size());
+  for (int i = 0; i < kEventCount; i++) {
+    EXPECT_EQ(static_cast<uint32_t>(i), arguments[i][0]);
+    EXPECT_EQ(std::to_string(i), reader.GetString(arguments[i][1]));
+  }
+  EXPECT_EQ(1u, reader.count("wtf.zone#create"));
+  EXPECT_LT(1u, reader.count("wtf.zone#set"));
+}
+
+TEST_F(RuntimeTest, StreamedBuffersOfExitedThreadsAreReused) {
+  static EventEnabled<uint32_t> event{"reuse#event: i"};
+  static constexpr uint32_t kEventCount = 10000;
+  auto run_thread = [](uint32_t first) {
+    EventBuffer* event_buffer = nullptr;
+    std::thread thread{[&event_buffer, first]() {
+      Runtime::GetInstance()->EnableCurrentThread("ReuseThread");
+      event_buffer = PlatformGetThreadLocalEventBuffer();
+      for (uint32_t i = first; i < first + kEventCount; i++) {
+        event.Invoke(i);
+      }
+    }};
+    thread.join();
+    return event_buffer;
+  };
+
+  // The last flush consumes everything from the exited thread, after which
+  // its buffer goes to the next thread.
+  std::ostringstream out;
+  Runtime::StreamingOptions options;
+  ASSERT_TRUE(Runtime::GetInstance()->StartStreaming(&out, options));
+  EventBuffer* first_buffer = run_thread(0);
+  ASSERT_TRUE(Runtime::GetInstance()->StopStreaming());
+  EXPECT_EQ(first_buffer, run_thread(kEventCount));
+
+  // Events from the second thread are written once, under its own zone.
+  std::ostringstream saved_out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&saved_out));
+  std::string data = saved_out.str();
+  TraceReader reader{data};
+  reader.Record("reuse#event");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(1u, reader.count("wtf.zone#create"));
+  auto& arguments = reader.arguments("reuse#event");
+  ASSERT_EQ(static_cast<size_t>(kEventCount), arguments.size());
+  EXPECT_EQ(kEventCount, arguments[0][0]);
+
+  // Saving does not consume, so the second buffer is kept for later saves.
+  std::ostringstream resaved_out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&resaved_out));
+  EXPECT_EQ(data.size(), resaved_out.str().size());
+  EXPECT_NE(first_buffer, run_thread(0));
+}
+
+TEST_F(RuntimeTest, SavedBuffersOfExitedThreadsAreReused) {
+  static EventEnabled<uint32_t> event{"savedReuse#event: i"};
+  static constexpr uint32_t kEventCount = 10000;
+  auto run_thread = [](uint32_t first) {
+    EventBuffer* event_buffer = nullptr;
+    std::thread thread{[&event_buffer, first]() {
+      Runtime::GetInstance()->EnableCurrentThread("SavedReuseThread");
+      event_buffer = PlatformGetThreadLocalEventBuffer();
+      for (uint32_t i = first; i < first + kEventCount; i++) {
+        event.Invoke(i);
+      }
+    }};
+    thread.join();
+    return event_buffer;
+  };
+
+  // A save writes everything from the exited thread, after which its buffer
+  // goes to the next thread.
+  Runtime::GetInstance()->SetReclaimSavedThreadBuffers(true);
+  EventBuffer* first_buffer = run_thread(0);
+  std::ostringstream out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&out));
+  {
+    std::string data = out.str();
+    TraceReader reader{data};
+    reader.Record("savedReuse#event");
+    ASSERT_TRUE(reader.Parse());
+    auto& arguments = reader.arguments("savedReuse#event");
+    ASSERT_EQ(static_cast<size_t>(kEventCount), arguments.size());
+    EXPECT_EQ(0u, arguments[0][0]);
+  }
+  EXPECT_EQ(first_buffer, run_thread(kEventCount));
+
+  // The next save only has the events of the second thread.
+  std::ostringstream saved_out;
+  ASSERT_TRUE(Runtime::GetInstance()->Save(&saved_out));
+  std::string data = saved_out.str();
+  TraceReader reader{data};
+  reader.Record("savedReuse#event");
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(1u, reader.count("wtf.zone#create"));
+  auto& arguments = reader.arguments("savedReuse#event");
+  ASSERT_EQ(static_cast<size_t>(kEventCount), arguments.size());
+  EXPECT_EQ(kEventCount, arguments[0][0]);
+}
+
+TEST_F(RuntimeTest, StreamingStaysWithinBudget) {
+  static constexpr int kThreadCount = 4;
+  static constexpr int kEventsPerThread = 200000;
+  static EventEnabled<uint32_t> event{"budget#event: i"};
+  std::ostringstream out;
+  Runtime::StreamingOptions options;
+  options.memory_budget_bytes = 16 * sizeof(EventBlock);
+  ASSERT_TRUE(Runtime::GetInstance()->StartStreaming(&out, options));
+
+  platform::atomic<uint32_t> dropped{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; t++) {
+    threads.emplace_back([&dropped]() {
+      Runtime::GetInstance()->EnableCurrentThread("BudgetThread");
+      for (int i = 0; i < kEventsPerThread; i++) {
+        event.Invoke(i);
+      }
+      dropped.fetch_add(PlatformGetThreadLocalEventBuffer()->dropped_events());
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_TRUE(Runtime::GetInstance()->StopStreaming());
+
+  std::string data = out.str();
+  TraceReader reader{data};
+  ASSERT_TRUE(reader.Parse());
+  EXPECT_EQ(static_cast<size_t>(kThreadCount * kEventsPerThread),
+            reader.count("budget#event") + dropped.load());
+  EXPECT_GT(reader.count("budget#event"), 0u);
 }
+#endif  // !WTF_SINGLE_THREADED
 
 }  // namespace
 }  // namespace wtf
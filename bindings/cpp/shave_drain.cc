@@ -0,0 +1,93 @@
+#include "wtf/shave_drain.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "wtf/event.h"
+#include "wtf/platform.h"
+
+namespace wtf {
+
+static_assert(kShaveScopeLeaveWireId == StandardEvents::kScopeLeaveEventId,
+              "SHAVE scopes must leave with wtf.scope#leave");
+static_assert(kShaveMaxEventEntries == EventBlock::kMaxEventEntries,
+              "SHAVE events must fit in an event block");
+
+ShaveEventDrain::ShaveEventDrain(ShaveEventRing* ring, uint32_t* entries,
+                                 uint32_t capacity, EventBuffer* event_buffer)
+    : ring_(ring), event_buffer_(event_buffer) {
+  uint32_t rounded = 1;
+  while (rounded <= capacity / 2) {
+    rounded *= 2;
+  }
+  ring->entries = entries;
+  ring->capacity_mask = rounded - 1;
+  ring->base_ticks = 0;
+  ring->sysclks_per_us = 1;
+#if defined(__myriad2__) && defined(__sparc__)
+  ring->base_ticks = internal::base_ticks;
+  ring->sysclks_per_us = static_cast<uint32_t>(internal::sysclks_per_us);
+#endif
+  ring->committed = 0;
+  ring->dropped = 0;
+  ring->consumed = 0;
+}
+
+size_t ShaveEventDrain::Drain() {
+  uint32_t consumed = ring_->consumed;
+  uint32_t committed = __atomic_load_n(&ring_->committed, __ATOMIC_ACQUIRE);
+  uint32_t count = committed - consumed;
+  if (!count) {
+    return 0;
+  }
+
+  // Copy out at most two ranges, as the committed entries may wrap around
+  // the end of the ring. Their room can be reused as soon as they are
+  // copied.
+  staging_.resize(count);
+  uint32_t start = consumed & ring_->capacity_mask;
+  uint32_t first = std::min(count, ring_->capacity_mask + 1 - start);
+  PlatformCopyFromCoprocessor(staging_.data(), ring_->entries + start,
+                              first * sizeof(uint32_t));
+  if (first < count) {
+    PlatformCopyFromCoprocessor(staging_.data() + first, ring_->entries,
+                                (count - first) * sizeof(uint32_t));
+  }
+  __atomic_store_n(&ring_->consumed, committed, __ATOMIC_RELEASE);
+
+#if defined(WTF_64BIT_TIMESTAMPS)
+  // Events carry the low 32 bits of their time. They happened before now,
+  // and less than 2^32 micros before, which gives their epoch.
+  const uint64_t now = PlatformGetTimestampMicros64();
+  const uint64_t kEpochSize = uint64_t{1} << 32;
+#endif
+  size_t events = 0;
+  for (size_t i = 0; i < count;) {
+    uint32_t record_count = staging_[i];
+    if (record_count < 2 || record_count > count - i - 1 ||
+        record_count > EventBlock::kMaxEventEntries) {
+      // Nothing after this can be trusted to start on a record.
+      malformed_records_ += 1;
+      break;
+    }
+    const uint32_t* record = &staging_[i + 1];
+#if defined(WTF_64BIT_TIMESTAMPS)
+    uint64_t timestamp = (now & ~(kEpochSize - 1)) | record[1];
+    if (timestamp > now && timestamp >= kEpochSize) {
+      timestamp -= kEpochSize;
+    }
+    uint32_t* entries =
+        event_buffer_->ReserveEventAt(record[0], record_count, timestamp);
+    memcpy(entries + 2, record + 2, (record_count - 2) * sizeof(uint32_t));
+#else
+    uint32_t* entries = event_buffer_->ReserveEntries(record_count);
+    memcpy(entries, record, record_count * sizeof(uint32_t));
+#endif
+    event_buffer_->CommitEntries();
+    events += 1;
+    i += 1 + record_count;
+  }
+  return events;
+}
+
+}  // namespace wtf
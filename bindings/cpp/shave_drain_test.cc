@@ -0,0 +1,132 @@
+#include "wtf/shave_drain.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "wtf/event.h"
+#include "wtf/shave.h"
+
+namespace wtf {
+namespace {
+
+class ShaveDrainTest : public ::testing::Test {
+ protected:
+  // Reads the event buffer as wire ids and arguments, leaving out the
+  // timestamps and any epoch events.
+  std::vector<uint32_t> ReadEvents(EventBuffer* event_buffer) {
+    OutputBuffer::PartHeader header;
+    event_buffer->PopulateHeader(&header);
+    std::ostringstream out;
+    OutputBuffer output_buffer{&out};
+    EXPECT_TRUE(event_buffer->WriteTo(&header, &output_buffer));
+    event_buffer->Consume(header);
+    std::string data = out.str();
+    const uint32_t* words = reinterpret_cast<const uint32_t*>(data.data());
+    size_t word_count = data.size() / sizeof(uint32_t);
+    std::vector<uint32_t> events;
+    for (size_t i = 0; i < word_count; i++) {
+      if (words[i] == StandardEvents::kTimeEpochEventId) {
+        i += 2;
+        continue;
+      }
+      events.push_back(words[i]);
+      if (words[i] == 100) {
+        events.push_back(words[i + 2]);
+        i += 1;
+      }
+      i += 1;
+    }
+    return events;
+  }
+
+  StringTable string_table_;
+  EventBlockPool block_pool_;
+  ShaveEventRing ring_;
+  uint32_t entries_[40];
+};
+
+TEST_F(ShaveDrainTest, DrainsEventsAcrossTheWrap) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  // Rounded down to 32 entries.
+  ShaveEventDrain drain{&ring_, entries_, 40, &event_buffer};
+  EXPECT_EQ(31u, ring_.capacity_mask);
+  EXPECT_EQ(0u, drain.Drain());
+
+  // Wire id 100 takes one argument, 101 none.
+  for (uint32_t round = 0; round < 3; round++) {
+    {
+      ShaveAutoScope scope{&ring_, 101};
+      EXPECT_TRUE(ShaveEvent(&ring_, 100, round));
+      EXPECT_TRUE(ShaveEvent(&ring_, 100, round + 10));
+    }
+    EXPECT_EQ(4u, drain.Drain());
+    EXPECT_EQ((std::vector<uint32_t>{101, 100, round, 100, round + 10,
+                                     kShaveScopeLeaveWireId}),
+              ReadEvents(&event_buffer));
+  }
+  EXPECT_EQ(ring_.committed, ring_.consumed);
+  EXPECT_EQ(0u, drain.dropped_events());
+  EXPECT_EQ(0u, drain.malformed_records());
+}
+
+TEST_F(ShaveDrainTest, FullRingsDropEvents) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  ShaveEventDrain drain{&ring_, entries_, 32, &event_buffer};
+  // Records of 4 entries: 8 fit.
+  for (uint32_t i = 0; i < 10; i++) {
+    EXPECT_EQ(i < 8, ShaveEvent(&ring_, 100, i));
+  }
+  EXPECT_EQ(2u, drain.dropped_events());
+  EXPECT_EQ(8u, drain.Drain());
+  EXPECT_TRUE(ShaveEvent(&ring_, 100, 8u));
+  EXPECT_EQ(1u, drain.Drain());
+  std::vector<uint32_t> events = ReadEvents(&event_buffer);
+  ASSERT_EQ(18u, events.size());
+  EXPECT_EQ(7u, events[15]);
+  EXPECT_EQ(8u, events[17]);
+}
+
+TEST_F(ShaveDrainTest, MalformedRecordsAreSkipped) {
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  ShaveEventDrain drain{&ring_, entries_, 32, &event_buffer};
+  ShaveEvent(&ring_, 101);
+  // A record claiming more entries than were committed.
+  entries_[ring_.committed] = 20;
+  ring_.committed += 1;
+  EXPECT_EQ(1u, drain.Drain());
+  EXPECT_EQ(1u, drain.malformed_records());
+  EXPECT_EQ(ring_.committed, ring_.consumed);
+  EXPECT_EQ((std::vector<uint32_t>{101}), ReadEvents(&event_buffer));
+}
+
+TEST_F(ShaveDrainTest, OversizedRecordsAreSkipped) {
+  std::vector<uint32_t> entries(1024);
+  EventBuffer event_buffer{&string_table_, &block_pool_};
+  ShaveEventDrain drain{&ring_, entries.data(), 1024, &event_buffer};
+
+  // The SHAVE refuses events that no event buffer could hold.
+  std::vector<uint32_t> args(kShaveMaxEventEntries - 1, 7);
+  EXPECT_FALSE(ShaveAppendEvent(&ring_, 101, args.data(), args.size()));
+  EXPECT_EQ(1u, drain.dropped_events());
+  EXPECT_EQ(0u, ring_.committed);
+
+  // And the drain refuses records claiming to be one (e.g. if corrupt).
+  ShaveEvent(&ring_, 101);
+  uint32_t record_count = kShaveMaxEventEntries + 1;
+  entries[ring_.committed] = record_count;
+  ring_.committed += 1 + record_count;
+  EXPECT_EQ(1u, drain.Drain());
+  EXPECT_EQ(1u, drain.malformed_records());
+  EXPECT_EQ(ring_.committed, ring_.consumed);
+  EXPECT_EQ((std::vector<uint32_t>{101}), ReadEvents(&event_buffer));
+}
+
+}  // namespace
+}  // namespace wtf
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -64,7 +64,20 @@ wtf.data.formats.FileFlags = {
   /**
    * Indicates that times in the file are actually counts.
    */
-  TIMES_AS_COUNT: (1 << 1)
+  TIMES_AS_COUNT: (1 << 1),
+
+  /**
+   * Indicates that the string table of each event data chunk only contains
+   * the strings added since the previous chunk, as written by streaming
+   * tracers.
+   */
+  HAS_INCREMENTAL_STRING_TABLES: (1 << 2),
+
+  /**
+   * Indicates that chunks may be compressed, as written by the C++ bindings
+   * with a compressor set.
+   */
+  HAS_COMPRESSED_CHUNKS: (1 << 3)
 };
 
 
@@ -82,6 +95,12 @@ wtf.data.formats.FileFlags.toStrings = function(value) {
   if (value & wtf.data.formats.FileFlags.TIMES_AS_COUNT) {
     result.push('times_as_count');
   }
+  if (value & wtf.data.formats.FileFlags.HAS_INCREMENTAL_STRING_TABLES) {
+    result.push('has_incremental_string_tables');
+  }
+  if (value & wtf.data.formats.FileFlags.HAS_COMPRESSED_CHUNKS) {
+    result.push('has_compressed_chunks');
+  }
   return result;
 };
 
@@ -101,6 +120,12 @@ wtf.data.formats.FileFlags.fromStrings = function(value) {
       case 'times_as_count':
         result |= wtf.data.formats.FileFlags.TIMES_AS_COUNT;
         break;
+      case 'has_incremental_string_tables':
+        result |= wtf.data.formats.FileFlags.HAS_INCREMENTAL_STRING_TABLES;
+        break;
+      case 'has_compressed_chunks':
+        result |= wtf.data.formats.FileFlags.HAS_COMPRESSED_CHUNKS;
+        break;
     }
   }
   return result;
@@ -79,8 +79,14 @@ wtf.data.Variable.TYPE_MAP_ = {
   'long': 'int32',
   'uint32': 'uint32',
   'unsigned long': 'uint32',
+  'int64': 'int64',
+  'long long': 'int64',
+  'uint64': 'uint64',
+  'unsigned long long': 'uint64',
   'float32': 'float32',
   'float': 'float32',
+  'float64': 'float64',
+  'double': 'float64',
   'ascii': 'ascii',
   'utf8': 'utf8',
   'char': 'char',
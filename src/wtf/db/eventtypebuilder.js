@@ -72,6 +72,9 @@ wtf.db.EventTypeBuilder.prototype.generate = function(eventType) {
       case 'len':
         this.append('var ' + name + ';');
         break;
+      case 'dataView':
+        this.append('var dataView = new DataView(buffer.arrayBuffer);');
+        break;
       default:
         this.append('var ' + name + ' = buffer.' + name + ';');
         break;
@@ -329,6 +332,38 @@ wtf.db.EventTypeBuilder.READERS_ = ({
       ];
     }
   },
+  'int64': {
+    uses: ['uint32Array', 'int32Array'],
+    size: 8,
+    read: function(a, offset) {
+      // Values beyond 2^53 lose precision.
+      return [
+        'var ' + a + '_ = int32Array[' + offset + ' + 1] * 4294967296 + ' +
+            'uint32Array[' + offset + '];'
+      ];
+    }
+  },
+  'uint64': {
+    uses: ['uint32Array'],
+    size: 8,
+    read: function(a, offset) {
+      // Values beyond 2^53 lose precision.
+      return [
+        'var ' + a + '_ = uint32Array[' + offset + ' + 1] * 4294967296 + ' +
+            'uint32Array[' + offset + '];'
+      ];
+    }
+  },
+  'float64': {
+    uses: ['dataView'],
+    size: 8,
+    read: function(a, offset) {
+      // Only 4b aligned, so read through a DataView.
+      return [
+        'var ' + a + '_ = dataView.getFloat64((' + offset + ') << 2, true);'
+      ];
+    }
+  },
   'ascii': {
     uses: ['uint32Array', 'stringTable'],
     size: 4,
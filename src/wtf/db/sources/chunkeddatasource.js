@@ -16,11 +16,13 @@ goog.provide('wtf.db.sources.ChunkedDataSource');
 goog.require('goog.asserts');
 goog.require('wtf.data.EventFlag');
 goog.require('wtf.data.Variable');
+goog.require('wtf.data.formats.FileFlags');
 goog.require('wtf.db.DataSource');
 goog.require('wtf.db.EventType');
 goog.require('wtf.db.TimeRange');
 goog.require('wtf.db.Unit');
 goog.require('wtf.io.BufferView');
+goog.require('wtf.io.StringTable');
 goog.require('wtf.io.cff.ChunkType');
 goog.require('wtf.io.cff.PartType');
 goog.require('wtf.io.cff.StreamSource');
@@ -84,6 +86,33 @@ wtf.db.sources.ChunkedDataSource = function(db, sourceInfo, streamSource) {
    */
   this.timeRangeRenames_ = {};
 
+  /**
+   * Upper 32 bits of event times, as set by the most recent wtf.timing#epoch
+   * event, pre-multiplied by 2^32. Null if the source has no epoch events, in
+   * which case event times are plain 32-bit values.
+   * @type {?number}
+   * @private
+   */
+  this.timeEpoch_ = null;
+
+  /**
+   * 64-bit time that is subtracted from event times when epochs are in use,
+   * as specified in the file header metadata (timeOrigin64). This keeps
+   * times in range even in long running traces.
+   * @type {number}
+   * @private
+   */
+  this.timeOrigin_ = 0;
+
+  /**
+   * All strings seen so far when the file has incremental string tables, in
+   * which case each chunk only carries the strings added since the previous
+   * one. Null otherwise.
+   * @type {wtf.io.StringTable}
+   * @private
+   */
+  this.stringTable_ = null;
+
   /**
    * A fast dispatch table for BUILTIN events, keyed on event name.
    * Each function handles an event of the given type.
@@ -198,6 +227,12 @@ wtf.db.sources.ChunkedDataSource.prototype.chunkReceived_ = function(chunk) {
 wtf.db.sources.ChunkedDataSource.prototype.processFileHeaderChunk_ =
     function(chunk) {
   var fileHeaderPart = chunk.getFileHeader();
+  this.timeOrigin_ = fileHeaderPart.getMetadata()['timeOrigin64'] || 0;
+  if (fileHeaderPart.getFlags() &
+      wtf.data.formats.FileFlags.HAS_INCREMENTAL_STRING_TABLES) {
+    this.stringTable_ = new wtf.io.StringTable();
+    this.stringTable_.deserialize('');
+  }
 
   // Compute time delay.
   var db = this.getDatabase();
@@ -238,6 +273,13 @@ wtf.db.sources.ChunkedDataSource.prototype.setupBinaryDispatchTable_ =
       wtf.data.EventFlag.BUILTIN | wtf.data.EventFlag.INTERNAL));
   this.eventWireTable_[1] = eventTypeTable.getByName('wtf.event#define');
 
+  // The C++ bindings reserve wire ID 3 for epoch events, which may precede
+  // their own definition. A later definition of ID 3 replaces this one.
+  eventTypeTable.defineType(wtf.db.EventType.createInstance(
+      'wtf.timing#epoch(uint32 epoch)',
+      wtf.data.EventFlag.BUILTIN | wtf.data.EventFlag.INTERNAL));
+  this.eventWireTable_[3] = eventTypeTable.getByName('wtf.timing#epoch');
+
   this.binaryDispatch_['wtf.event#define'] = function(eventType, args) {
     var argString = args['args'];
     var argMap = argString ?
@@ -283,6 +325,11 @@ wtf.db.sources.ChunkedDataSource.prototype.setupBinaryDispatchTable_ =
     return true;
   };
 
+  this.binaryDispatch_['wtf.timing#epoch'] = function(eventType, args) {
+    this.timeEpoch_ = args['epoch'] * 4294967296;
+    return false;
+  };
+
   // TODO(benvanik): rename flows like time ranges
 };
 
@@ -300,6 +347,15 @@ wtf.db.sources.ChunkedDataSource.prototype.processBinaryEventBuffer_ =
   var bufferView = part.getValue();
   goog.asserts.assert(bufferView);
 
+  // Resolve strings against everything seen so far.
+  if (this.stringTable_) {
+    var stringTable = wtf.io.BufferView.getStringTable(bufferView);
+    if (stringTable) {
+      this.stringTable_.append(stringTable);
+    }
+    wtf.io.BufferView.setStringTable(bufferView, this.stringTable_);
+  }
+
   // Read all events from the buffer.
   var uint32Array = bufferView['uint32Array'];
   var eventWireTable = this.eventWireTable_;
@@ -340,6 +396,9 @@ wtf.db.sources.ChunkedDataSource.prototype.processBinaryEventBuffer_ =
     }
 
     if (insertEvent) {
+      if (this.timeEpoch_ !== null) {
+        time = this.timeEpoch_ + time - this.timeOrigin_;
+      }
       var eventList = this.currentZone_.getEventList();
       eventList.insert(
           eventType,
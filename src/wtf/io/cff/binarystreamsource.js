@@ -29,6 +29,7 @@ goog.require('wtf.io.cff.chunks.EventDataChunk');
 goog.require('wtf.io.cff.chunks.FileHeaderChunk');
 goog.require('wtf.io.cff.parts.FileHeaderPart');
 goog.require('wtf.io.cff.parts.LegacyEventBufferPart');
+goog.require('wtf.io.lz4');
 goog.require('wtf.version');
 
 
@@ -343,6 +344,14 @@ wtf.io.cff.BinaryStreamSource.prototype.parseChunk_ = function(data, o) {
     throw new Error('Data does not contain the entire chunk.');
   }
 
+  // Compressed chunks hold the original chunk in their only part.
+  if (partCount == 1 &&
+      header[6] == wtf.io.cff.BinaryStreamSource.COMPRESSED_CHUNK_PART_TYPE_) {
+    this.parseCompressedChunk_(
+        new Uint8Array(data, o + headerByteLength + header[7], header[8]));
+    return o + chunkLength;
+  }
+
   // Skip unknown chunk types.
   if (chunkType == wtf.io.cff.ChunkType.UNKNOWN) {
     if (goog.global.console) {
@@ -404,6 +413,48 @@ wtf.io.cff.BinaryStreamSource.prototype.parseChunk_ = function(data, o) {
 };
 
 
+/**
+ * Part type of the single part of a compressed chunk.
+ * @const
+ * @type {number}
+ * @private
+ */
+wtf.io.cff.BinaryStreamSource.COMPRESSED_CHUNK_PART_TYPE_ = 0x50000;
+
+
+/**
+ * Compression formats of compressed chunks.
+ * @enum {number}
+ * @private
+ */
+wtf.io.cff.BinaryStreamSource.CompressionFormat_ = {
+  LZ4: 1
+};
+
+
+/**
+ * Parses the part of a compressed chunk: the format, the length of the
+ * original chunk and then the compressed original chunk.
+ * Throws errors on failure.
+ * @param {!Uint8Array} data Part binary data.
+ * @private
+ */
+wtf.io.cff.BinaryStreamSource.prototype.parseCompressedChunk_ = function(
+    data) {
+  if (data.byteLength < 2 * 4) {
+    throw new Error('Compressed chunk too small.');
+  }
+  var view = new DataView(data.buffer, data.byteOffset, 2 * 4);
+  var format = view.getUint32(0, true);
+  var length = view.getUint32(4, true);
+  if (format != wtf.io.cff.BinaryStreamSource.CompressionFormat_.LZ4) {
+    throw new Error('Chunk compression format ' + format + ' not supported.');
+  }
+  var chunk = wtf.io.lz4.decompressBlock(data.subarray(2 * 4), length);
+  this.parseChunk_(chunk.buffer, 0);
+};
+
+
 /**
  * Parses part data from a blob.
  * Throws errors on failure.
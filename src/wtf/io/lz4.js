@@ -0,0 +1,94 @@
+/**
+ * Copyright 2013 Google, Inc. All Rights Reserved.
+ *
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/**
+ * @fileoverview LZ4 block format decompression, as used by compressed chunks
+ * from the C++ bindings.
+ */
+
+goog.provide('wtf.io.lz4');
+
+
+/**
+ * Decompresses an LZ4 block.
+ * Throws errors on malformed data.
+ * @param {!Uint8Array} source Compressed block.
+ * @param {number} length Length of the decompressed data.
+ * @return {!Uint8Array} Decompressed data.
+ */
+wtf.io.lz4.decompressBlock = function(source, length) {
+  var target = new Uint8Array(length);
+  var lengths = [0];
+  var i = 0;
+  var o = 0;
+  while (i < source.length) {
+    var token = source[i++];
+
+    // Literals.
+    var literalLength = token >> 4;
+    if (literalLength == 15) {
+      i = wtf.io.lz4.readLength_(source, i, lengths);
+      literalLength += lengths[0];
+    }
+    if (i + literalLength > source.length || o + literalLength > length) {
+      throw new Error('Malformed LZ4 literals.');
+    }
+    target.set(source.subarray(i, i + literalLength), o);
+    i += literalLength;
+    o += literalLength;
+    if (i == source.length) {
+      // The last sequence has no match.
+      break;
+    }
+
+    // Match, which may overlap what it produces.
+    if (i + 2 > source.length) {
+      throw new Error('Truncated LZ4 match.');
+    }
+    var offset = source[i] | (source[i + 1] << 8);
+    i += 2;
+    var matchLength = token & 15;
+    if (matchLength == 15) {
+      i = wtf.io.lz4.readLength_(source, i, lengths);
+      matchLength += lengths[0];
+    }
+    matchLength += 4;
+    if (!offset || offset > o || o + matchLength > length) {
+      throw new Error('Malformed LZ4 match.');
+    }
+    for (var n = 0; n < matchLength; n++, o++) {
+      target[o] = target[o - offset];
+    }
+  }
+  if (o != length) {
+    throw new Error('LZ4 block is short of its length.');
+  }
+  return target;
+};
+
+
+/**
+ * Reads the bytes that extend a length past its 4 bits in a token.
+ * @param {!Uint8Array} source Compressed block.
+ * @param {number} i Offset of the first byte.
+ * @param {!Array.<number>} result Receives the length at index 0.
+ * @return {number} Offset past the last byte.
+ * @private
+ */
+wtf.io.lz4.readLength_ = function(source, i, result) {
+  var length = 0;
+  var b;
+  do {
+    if (i >= source.length) {
+      throw new Error('Truncated LZ4 length.');
+    }
+    b = source[i++];
+    length += b;
+  } while (b == 255);
+  result[0] = length;
+  return i;
+};
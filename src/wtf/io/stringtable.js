@@ -13,6 +13,7 @@
 
 goog.provide('wtf.io.StringTable');
 
+goog.require('goog.asserts');
 goog.require('wtf.io.Blob');
 
 
@@ -78,6 +79,23 @@ wtf.io.StringTable.prototype.addString = function(value) {
 };
 
 
+/**
+ * Appends all strings from another table, so that their ordinals follow the
+ * existing ones. Both tables must have been deserialized.
+ * @param {!wtf.io.StringTable} other String table.
+ */
+wtf.io.StringTable.prototype.append = function(other) {
+  goog.asserts.assert(!this.hasNullTerminators_);
+  goog.asserts.assert(!other.hasNullTerminators_);
+  // Deserialized values end with the empty remainder after the last nul.
+  var values = this.values_;
+  if (values.length && values[values.length - 1] == '') {
+    values.pop();
+  }
+  this.values_ = values.concat(other.values_);
+};
+
+
 /**
  * Gets a string from the table.
  * @param {number} ordinal Ordinal.